@@ -31,34 +31,76 @@
 */
 
 #include "json.h"
+#ifdef _MSC_VER
+  #define _CRT_SECURE_NO_WARNINGS  /* _vsnprintf */
+#endif
 #include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
 #include <string.h>
 #include <limits.h>
+#include <stdint.h>
+#include <time.h>
 #include <assert.h>
+#ifdef _MSC_VER
+  #include <windows.h>
+#else
+  #include <pthread.h>
+#endif
 
 /*----------------------------------------------------------------------------*/
 
+#ifdef _MSC_VER
+  #define _VSNPRINTF  _vsnprintf
+#else
+  #define _VSNPRINTF  vsnprintf
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+  #define _PREFETCH(p)  __builtin_prefetch(p)
+#else
+  #define _PREFETCH(p)  ((void)0)
+#endif
+
+/* json_value.flags */
+#define FLAG_TRAILING  0x01  /* json_string in trailing mode */
+#define FLAG_FROZEN    0x02  /* read-only, see json_freeze */
+#define FLAG_HASHED    0x04  /* the hash field of an object or array is valid */
+#define FLAG_BLOCK     0x08  /* inside a json_compact block, never freed alone */
+#define FLAG_BLOCK_ROOT 0x10 /* the first node of a block, freeing it frees the block */
+#define FLAG_TYPED     0x20  /* json_array holding a vector of doubles instead of pointers */
+#define FLAG_LAZY      0x40  /* container whose children are still in the source text, see json_lazy.c */
+
 struct json_value {
     json_alloc_func alloc_func;
     unsigned char type;
+    unsigned char flags;
+    /* Number of owners. A node with more than 1 owner is shared between trees 
+       (see json_share) and is never modified in place, the mutators refuse 
+       it and json_dotset copies it into the parent it changes. */
+    unsigned short refcount;
 };
 
 typedef struct json_string {
     json_alloc_func alloc_func;
     unsigned char type;
+    unsigned char flags;
+    unsigned short refcount;
+    unsigned int len;
     /* We provide a initial string to alloc the json_string. after that, we can 
        modify the json_string but rarely. Trailing mode can optimize this case. 
-       In trailing mode, we only alloc 1 memory block, both for the json_string struct and the string data. */
-    unsigned char trailing;
-    unsigned short trailing_extra_cb;
-    unsigned int len;
+       In trailing mode, we only alloc 1 memory block, both for the json_string struct and the string data. 
+       extra_cb is shared by both modes, it is needed to free the json_string struct. */
     union {
         struct {
+            unsigned short extra_cb;
             char str[1];
         } trailing_str;
         struct {
-            char *ptr;
+            unsigned short extra_cb;
             unsigned int capacity;
+            char *ptr;
         } str;
     };
 } json_string;
@@ -66,42 +108,202 @@ typedef struct json_string {
 typedef struct json_number {
     json_alloc_func alloc_func;
     unsigned char type;
+    unsigned char flags;
+    unsigned short refcount;
     double dbl;
 } json_number;
 
+/* names shorter than this are stored inline, right next to their hash */
+#define INLINE_NAME_CB 16
+
+/* keys searched side by side in json_object_get_many */
+#define GET_MANY_BATCH 32
+
 typedef struct _json_object_item {
     int sorted_index;
     unsigned int name_len;
     unsigned int name_hash;
-    const char *name_str;
+    union {
+        char str[INLINE_NAME_CB];  /* name_len < INLINE_NAME_CB */
+        char *ptr;                 /* name_len >= INLINE_NAME_CB */
+    } name;
     json_value *value;
 } _json_object_item;
 
 typedef struct json_object {
     json_alloc_func alloc_func;
     unsigned char type;
+    unsigned char flags;
+    unsigned short refcount;
     int capacity;
     _json_object_item *items;
     int size;
+    /* Content hash, see json_hash. Cached by json_freeze only: there is no way 
+       to reach the parents (there may be several) when a descendant changes, 
+       so only frozen subtrees can keep a hash. */
+    uint64_t hash;
 } json_object;
 
+/* json_compact puts a whole tree in one allocation, the root right after this */
+typedef struct _json_block {
+    size_t size;
+    double align;
+} _json_block;
+
+#define _BLOCK_ALIGN(n)  (((n) + 7) & ~(size_t)7)
+
 typedef struct json_array {
     json_alloc_func alloc_func;
     unsigned char type;
+    unsigned char flags;
+    unsigned short refcount;
     unsigned int capacity;
-    json_value **values;
+    json_value **values;  /* a _typed_vector* if FLAG_TYPED */
     unsigned int size;
+    uint64_t hash;  /* as in json_object */
 } json_array;
 
+/* refcounts change atomically, frozen trees are shared between threads */
+#ifdef _MSC_VER
+  #define _REFCOUNT_CAS(v, o, n)  \
+    (InterlockedCompareExchange16((volatile SHORT*)&(v)->refcount, (SHORT)(n), (SHORT)(o)) == (SHORT)(o))
+#else
+  #define _REFCOUNT_CAS(v, o, n)  \
+    __sync_bool_compare_and_swap(&(v)->refcount, (unsigned short)(o), (unsigned short)(n))
+#endif
+/* so are the element nodes of a frozen typed array, made by concurrent readers */
+#ifdef _MSC_VER
+  #define _NODE_CAS(p, o, n)  \
+    (InterlockedCompareExchangePointer((PVOID volatile*)(p), (PVOID)(n), (PVOID)(o)) == (PVOID)(o))
+#else
+  #define _NODE_CAS(p, o, n)  __sync_bool_compare_and_swap((p), (o), (n))
+#endif
+
+typedef struct _typed_vector {
+    json_value **nodes;        /* element nodes made so far, NULL until the first */
+    unsigned int nodes_size;   /* entries in nodes, at least the capacity of the array */
+    double numbers[1];         /* capacity of them, an element with a node has its number there */
+} _typed_vector;
+
+#define _TYPED_VECTOR(array)  ((_typed_vector*)(array)->values)
+#define _TYPED_VECTOR_SIZE(capacity)  (offsetof(_typed_vector, numbers) + sizeof(double) * (capacity))
+/* the element node handed out by the walker of a typed array must fit in it */
+typedef char _walk_number_fits[sizeof(((json_walker*)0)->number) >= sizeof(json_number) ? 1 : -1];
+/* a lazy container keeps its document in items/values and its entry in capacity */
+#define _READY(v)  (!((v)->flags & FLAG_LAZY) || _lazy_expand(v))
+#define _STRING_PTR(string)  (((string)->flags & FLAG_TRAILING) ? (string)->trailing_str.str : (string)->str.ptr)
+
 extern void* json_default_alloc_func(
     void *ptr, 
     size_t osize, 
     size_t nsize
     );
+json_value* json_object_set_len(
+    json_value *v, 
+    const char *name, 
+    unsigned int len, 
+    json_value *value
+    );
+json_value* json_array_insert(
+    json_value *v, 
+    unsigned int index, 
+    json_value *value
+    );
+json_value* json_pointer_update(
+    json_value *v, 
+    const char *tokens, 
+    unsigned int count, 
+    json_value* (*func)(json_value *parent, const char *token, void *ctx), 
+    void *ctx
+    );
+int json_is_shared(
+    json_value *v
+    );
+unsigned int json_hash_keyed(
+    const char *str, 
+    size_t len, 
+    uint64_t k0, 
+    uint64_t k1
+    );
+json_value* json_array_append_number(
+    json_value *v, 
+    double dbl
+    );
+json_value* json_object_get_hint(
+    json_value *v, 
+    const json_key *key, 
+    unsigned int *hint
+    );
+json_value* json_shallow_copy(
+    json_value *v
+    );
+json_value* json_share(
+    json_value *v
+    );
+json_value* json_lazy_node(
+    json_value_type type, 
+    void *doc, 
+    unsigned int entry, 
+    unsigned int size, 
+    json_alloc_func alloc_func
+    );
+double json_nan();
+unsigned int json_segment_to_index(
+    const char *str, 
+    unsigned int len
+    );
+const char* json_as_string(
+    json_value *v
+    );
+double json_as_number(
+    json_value *v
+    );
+int json_as_boolean(
+    json_value *v
+    );
+json_value* json_as_type(
+    json_value *v, 
+    json_value_type type
+    );
+extern json_value* json_lazy_build(
+    void *doc, 
+    unsigned int entry
+    );
+extern void json_lazy_release(
+    void *doc
+    );
+extern unsigned int json_grow_capacity(
+    json_alloc_func alloc_func, 
+    unsigned int capacity
+    );
 static double _NaN();
-static unsigned int _new_capacity(
+static unsigned int _string_capacity(
+    json_string *string
+    );
+static unsigned int _string_next_capacity(
+    unsigned int capacity, 
+    unsigned int len
+    );
+static int _string_grow(
+    json_string *string, 
+    unsigned int len
+    );
+static int _string_realloc(
+    json_string *string, 
+    unsigned int capacity
+    );
+static int _array_grow(
+    json_array *array, 
+    unsigned int size
+    );
+static int _array_realloc(
+    json_array *array, 
     unsigned int capacity
     );
+static int _object_realloc(
+    json_object *object, 
+    int capacity
+    );
 static int _object_item_init(
     const char *name_str, 
     unsigned int name_len, 
@@ -114,6 +316,13 @@ static void _object_item_cleanup(
     _json_object_item *item,
     json_alloc_func alloc_func
     );
+static void _object_remove(
+    json_object *object, 
+    int index
+    );
+static const char* _object_item_name(
+    const _json_object_item *item
+    );
 static int _object_item_index_lower_bound(
     _json_object_item *items,
     int count,
@@ -131,10 +340,154 @@ static int _name_to_index(
     unsigned int hash,
     int *lower_bound
     );
+static unsigned int _get_many(
+    json_object *object, 
+    const json_key *keys, 
+    unsigned int n, 
+    json_value **values
+    );
 static unsigned int _str_to_index(
     const char *str, 
     unsigned int len
     );
+static int _dot_segment(
+    json_value *v, 
+    const char *dotname, 
+    const char **next, 
+    unsigned int *index
+    );
+static uint64_t _mix64(
+    uint64_t x
+    );
+static uint64_t _siphash13(
+    const char *str, 
+    size_t len, 
+    uint64_t k0, 
+    uint64_t k1
+    );
+static void _hash_seed_init();
+static const uint64_t* _get_hash_seed();
+static int _retain(
+    json_value *v
+    );
+static int _release(
+    json_value *v
+    );
+static json_value* _share(
+    json_value *v
+    );
+static json_value* _clone_scalar(
+    json_value *v, 
+    json_alloc_func alloc_func
+    );
+static json_value* _alloc_container_like(
+    json_value *v, 
+    json_alloc_func alloc_func
+    );
+static int _copy_child(
+    json_value *copy, 
+    json_value *v, 
+    unsigned int index, 
+    json_value *child
+    );
+static json_value* _copy_container(
+    json_value *v, 
+    json_alloc_func alloc_func
+    );
+static json_value* _shallow_copy(
+    json_value *v
+    );
+static void _free_node(
+    json_value *v
+    );
+static void _free_recursive(
+    json_value *v
+    );
+static int _walk_push(
+    json_walker *w
+    );
+static json_value* _walk_container(
+    json_walk_frame *frame
+    );
+static void _walk_release(
+    json_walk_frame *frame
+    );
+static size_t _compact_size(
+    json_value *v
+    );
+static json_value* _compact_node(
+    json_value *v, 
+    char **cursor, 
+    json_alloc_func alloc_func
+    );
+static int _array_untype(
+    json_array *array
+    );
+static int _typed_realloc(
+    json_array *array, 
+    unsigned int capacity
+    );
+static int _typed_table(
+    json_array *array
+    );
+static void _typed_free(
+    json_array *array
+    );
+static json_value* _typed_node_at(
+    json_array *array, 
+    unsigned int index
+    );
+static json_value* _typed_node(
+    json_array *array, 
+    unsigned int index
+    );
+static json_value* _typed_item(
+    json_array *array, 
+    unsigned int index, 
+    json_number *scratch
+    );
+static const double* _typed_numbers(
+    json_array *array
+    );
+static int _typed_set(
+    json_array *array, 
+    unsigned int index, 
+    json_value *value
+    );
+static int _typed_freeze(
+    json_array *array
+    );
+static int _typed_append(
+    json_array *array, 
+    double dbl
+    );
+static json_value* _copy_typed(
+    json_value *v, 
+    json_alloc_func alloc_func
+    );
+static uint64_t _hash_number(
+    double dbl
+    );
+static uint64_t _hash_scalar(
+    json_value *v
+    );
+static int _hash_sums_grow(
+    uint64_t **sums, 
+    uint64_t *inline_sums, 
+    unsigned int *capacity, 
+    json_alloc_func alloc_func
+    );
+static int _scalar_equal(
+    json_value *a, 
+    json_value *b
+    );
+static double _reduce(
+    json_value *v, 
+    int op
+    );
+static int _lazy_expand(
+    json_value *v
+    );
 
 /*----------------------------------------------------------------------------*/
 
@@ -154,7 +507,7 @@ json_alloc_func json_get_alloc_func(json_value *v)
 
 /* count of bytes inside the json_string structure which can be used by trailing mode */
 const static unsigned int _json_string_builtin_string_cb = 
-    (unsigned int)(sizeof(json_string) - offsetof(json_string, trailing_str));
+    (unsigned int)(sizeof(json_string) - offsetof(json_string, trailing_str.str));
 
 json_value* json_string_alloc(const char *str, unsigned int len, json_alloc_func alloc_func)
 {
@@ -187,8 +540,9 @@ json_value* json_string_alloc(const char *str, unsigned int len, json_alloc_func
 
         string->alloc_func = alloc_func;
         string->type = json_type_string;
-        string->trailing = 1;
-        string->trailing_extra_cb = extra_cb;
+        string->flags = FLAG_TRAILING;
+        string->refcount = 1;
+        string->trailing_str.extra_cb = extra_cb;
         string->len = len;
 
     } else {
@@ -207,8 +561,9 @@ json_value* json_string_alloc(const char *str, unsigned int len, json_alloc_func
 
         string->alloc_func = alloc_func;
         string->type = json_type_string;
-        string->trailing = 0;
-        string->trailing_extra_cb = 0;
+        string->flags = 0;
+        string->refcount = 1;
+        string->str.extra_cb = 0;
         string->len = len;
         string->str.capacity = len;
     }
@@ -224,13 +579,12 @@ const char* json_string_get(json_value *v)
     if (v->type != json_type_string)
         return NULL;
 
-    return string->trailing ? string->trailing_str.str : string->str.ptr;
+    return (string->flags & FLAG_TRAILING) ? string->trailing_str.str : string->str.ptr;
 }
 
 json_value* json_string_set(json_value *v, const char *str, unsigned int len)
 {
     json_string *string = (json_string*)v;
-    unsigned int capacity;
     char *ptr;
     size_t osize;
 
@@ -240,35 +594,33 @@ json_value* json_string_set(json_value *v, const char *str, unsigned int len)
     if (v->type != json_type_string)
         return NULL;
 
+    if (v->refcount > 1 || (v->flags & FLAG_FROZEN))
+        return NULL;  /* shared or frozen, see json_clone_shared */
+
     if (len == (unsigned int)-1)
         len = (unsigned int)strlen(str);
     if (len == UINT_MAX)
         return NULL;
 
-    /* check if we have enough space to hold the new string */
-    if (string->trailing) {
-        capacity = _json_string_builtin_string_cb + string->trailing_extra_cb - 1;
-    } else {
-        capacity = string->str.capacity;
-    }
-    if (len > capacity) {
-        if (string->trailing) {
+    /* the old contents are not needed */
+    if (len > _string_capacity(string)) {
+        if (string->flags & FLAG_TRAILING) {
             ptr = NULL;
             osize = 0;
         } else {
             ptr = string->str.ptr;
-            osize = capacity + 1;
+            osize = string->str.capacity + 1;
         }
         ptr = string->alloc_func(ptr, osize, len + 1);  /* realloc */
         if (!ptr)
             return NULL;
         
-        string->trailing = 0;
+        string->flags &= ~FLAG_TRAILING;
         string->str.ptr = ptr;
         string->str.capacity = len;
     }
 
-    ptr = string->trailing ? string->trailing_str.str : string->str.ptr;
+    ptr = _STRING_PTR(string);
     memcpy(ptr, str, len);
     ptr[len] = '\0';
     string->len = len;
@@ -290,10 +642,7 @@ unsigned int json_string_len(json_value *v)
 json_value* json_string_resize(json_value *v, unsigned int len, char ch)
 {
     json_string *string = (json_string*)v;
-    unsigned int capacity;
     char *ptr;
-    size_t osize;
-    unsigned int i;
 
     assert(v);
 
@@ -301,34 +650,16 @@ json_value* json_string_resize(json_value *v, unsigned int len, char ch)
         return NULL;
     if (len == UINT_MAX)
         return NULL;
-    
-    /* check if we have enough space to hold the new string */
-    if (string->trailing) {
-        capacity = _json_string_builtin_string_cb + string->trailing_extra_cb - 1;
-    } else {
-        capacity = string->str.capacity;
-    }
-    if (len > capacity) {
-        if (string->trailing) {
-            ptr = NULL;
-            osize = 0;
-        } else {
-            ptr = string->str.ptr;
-            osize = capacity + 1;
-        }
-        ptr = string->alloc_func(ptr, osize, len + 1);  /* realloc */
-        if (!ptr)
-            return NULL;
 
-        string->trailing = 0;
-        string->str.ptr = ptr;
-        string->str.capacity = len;
-    }
+    if (v->refcount > 1 || (v->flags & FLAG_FROZEN))
+        return NULL;  /* shared or frozen, see json_clone_shared */
 
-    ptr = string->trailing ? string->trailing_str.str : string->str.ptr;
-    for (i = string->len; i < len; ++i) {
-        ptr[i] = ch;  /* new characters are filled with ch */
-    }
+    if (!_string_grow(string, len))
+        return NULL;
+
+    ptr = _STRING_PTR(string);
+    if (len > string->len)
+        memset(ptr + string->len, ch, len - string->len);  /* new characters are filled with ch */
     ptr[len] = '\0';
     string->len = len;
 
@@ -337,8 +668,9 @@ json_value* json_string_resize(json_value *v, unsigned int len, char ch)
 
 json_value* json_string_concat(json_value *v, const char *str, unsigned int len)
 {
-    unsigned int old_len;
+    json_string *string = (json_string*)v;
     char *ptr;
+    size_t offset;
 
     assert(v);
     assert(str);
@@ -348,17 +680,140 @@ json_value* json_string_concat(json_value *v, const char *str, unsigned int len)
 
     if (len == (unsigned int)-1)
         len = (unsigned int)strlen(str);
-    
-    if (len) {
-        old_len = json_string_len(v);
-        v = json_string_resize(v, old_len + len, ' ');
-        if (v) {
-            ptr = (char*)json_string_get(v);
-            assert(ptr);
-            memcpy(ptr + old_len, str, len);
-        }
+    if (!len)
+        return v;
+    if (len >= UINT_MAX - string->len)
+        return NULL;
+
+    if (v->refcount > 1 || (v->flags & FLAG_FROZEN))
+        return NULL;  /* shared or frozen, see json_clone_shared */
+
+    /* str may be a part of v itself */
+    ptr = _STRING_PTR(string);
+    offset = (size_t)(str - ptr);
+    if (str >= ptr && str <= ptr + string->len) {
+        if (!_string_grow(string, string->len + len))
+            return NULL;
+        str = _STRING_PTR(string) + offset;
+    } else if (!_string_grow(string, string->len + len)) {
+        return NULL;
+    }
+
+    ptr = _STRING_PTR(string);
+    memmove(ptr + string->len, str, len);
+    string->len += len;
+    ptr[string->len] = '\0';
+
+    return v;
+}
+
+json_value* json_string_reserve(json_value *v, unsigned int capacity)
+{
+    json_string *string = (json_string*)v;
+
+    assert(v);
+
+    if (v->type != json_type_string || capacity == UINT_MAX)
+        return NULL;
+
+    if (v->refcount > 1 || (v->flags & FLAG_FROZEN))
+        return NULL;  /* shared or frozen, see json_clone_shared */
+
+    if (capacity > _string_capacity(string) && !_string_realloc(string, capacity))
+        return NULL;
+    return v;
+}
+
+char* json_string_spare(json_value *v, unsigned int *count)
+{
+    json_string *string = (json_string*)v;
+
+    assert(v);
+    assert(count);
+
+    *count = 0;
+    if (v->type != json_type_string || v->refcount > 1 || (v->flags & FLAG_FROZEN))
+        return NULL;
+
+    *count = _string_capacity(string) - string->len;
+    return _STRING_PTR(string) + string->len;
+}
+
+json_value* json_string_commit(json_value *v, unsigned int count)
+{
+    json_string *string = (json_string*)v;
+
+    assert(v);
+
+    if (v->type != json_type_string || v->refcount > 1 || (v->flags & FLAG_FROZEN))
+        return NULL;
+    if (count > _string_capacity(string) - string->len)
+        return NULL;
+
+    string->len += count;
+    _STRING_PTR(string)[string->len] = '\0';
+    return v;
+}
+
+json_value* json_string_append_fmt(json_value *v, const char *fmt, ...)
+{
+    json_string *string = (json_string*)v;
+    va_list args;
+    char *spare;
+    unsigned int count, capacity;
+    int needed = -1;
+
+    assert(v);
+    assert(fmt);
+
+    if (v->type != json_type_string)
+        return NULL;
+
+    /* unlike concat the arguments can not be checked for aliasing v, the 
+       output goes straight into its spare bytes or grown buffer */
+#ifndef _MSC_VER
+    spare = json_string_spare(v, &count);
+    if (spare) {
+        /* format in place, if it does not fit this measures it */
+        va_start(args, fmt);
+        needed = vsnprintf(spare, (size_t)count + 1, fmt, args);
+        va_end(args);
+        if (needed >= 0 && (unsigned int)needed <= count)
+            return json_string_commit(v, (unsigned int)needed);
+        *spare = '\0';
+        if (needed < 0)
+            return NULL;
     }
+#endif
+    if (needed < 0) {
+        va_start(args, fmt);
+#ifdef _MSC_VER
+        needed = _vscprintf(fmt, args);
+#else
+        needed = vsnprintf(NULL, 0, fmt, args);
+#endif
+        va_end(args);
+        if (needed < 0)
+            return NULL;
+    }
+    if ((unsigned int)needed >= UINT_MAX - string->len)
+        return NULL;
 
+    /* grows the way concat does, copies on write before anything is written */
+    capacity = _string_capacity(string);
+    if ((unsigned int)needed > capacity - string->len)
+        capacity = _string_next_capacity(capacity, string->len + needed);
+    v = json_string_reserve(v, capacity);
+    if (!v)
+        return NULL;
+    string = (json_string*)v;
+
+    spare = _STRING_PTR(string) + string->len;
+    va_start(args, fmt);
+    _VSNPRINTF(spare, (size_t)needed + 1, fmt, args);
+    va_end(args);
+    string->len += needed;
+    spare[needed] = '\0';
     return v;
 }
 
@@ -377,6 +832,8 @@ json_value* json_number_alloc(double number, json_alloc_func alloc_func)
 
     v->alloc_func = alloc_func;
     v->type = json_type_number;
+    v->flags = 0;
+    v->refcount = 1;
     v->dbl = number;
 
     return (json_value*)v;
@@ -399,6 +856,8 @@ json_value* json_number_set(json_value *v, double dbl)
     assert(number);
 
     if (v->type == json_type_number) {
+        if (v->refcount > 1 || (v->flags & FLAG_FROZEN))
+            return NULL;  /* shared or frozen, see json_clone_shared */
         number->dbl = dbl;
         return v;
     } else {
@@ -421,6 +880,8 @@ json_value* json_boolean_alloc(int boolean, json_alloc_func alloc_func)
 
     v->alloc_func = alloc_func;
     v->type = boolean ? json_type_true : json_type_false;
+    v->flags = 0;
+    v->refcount = 1;
 
     return v;
 }
@@ -442,6 +903,8 @@ json_value* json_boolean_set(json_value *v, int boolean)
     assert(v);
 
     if (v->type == json_type_true || v->type == json_type_false) {
+        if (v->refcount > 1 || (v->flags & FLAG_FROZEN))
+            return NULL;  /* shared or frozen, see json_clone_shared */
         v->type = boolean ? json_type_true : json_type_false;
         return v;
     } else {
@@ -464,6 +927,8 @@ json_value* json_null_alloc(json_alloc_func alloc_func)
 
     v->alloc_func = alloc_func;
     v->type = json_type_null;
+    v->flags = 0;
+    v->refcount = 1;
 
     return v;
 }
@@ -483,9 +948,12 @@ json_value* json_object_alloc(json_alloc_func alloc_func)
 
     object->alloc_func = alloc_func;
     object->type = json_type_object;
+    object->flags = 0;
+    object->refcount = 1;
     object->capacity = 0;
     object->items = NULL;
     object->size = 0;
+    object->hash = 0;
 
     return (json_value*)object;
 }
@@ -496,7 +964,7 @@ unsigned int json_object_size(json_value *v)
     assert(object);
     
     if (v->type == json_type_object)
-        return object->size;
+        return _READY(v) ? (unsigned int)object->size : 0;  /* names may repeat in the text, empty if it can not be built */
     else
         return (unsigned int)-1;
 }
@@ -506,8 +974,8 @@ const char* json_object_name_by_index(json_value *v, unsigned int index)
     json_object *object = (json_object*)v;
     assert(object);
 
-    if (v->type == json_type_object && index < (unsigned int)object->size)
-        return object->items[index].name_str;
+    if (v->type == json_type_object && _READY(v) && index < (unsigned int)object->size)
+        return _object_item_name(object->items + index);
     else
         return NULL;
 }
@@ -517,7 +985,7 @@ json_value* json_object_value_by_index(json_value *v, unsigned int index)
     json_object *object = (json_object*)v;
     assert(object);
 
-    if (v->type == json_type_object && index < (unsigned int)object->size)
+    if (v->type == json_type_object && _READY(v) && index < (unsigned int)object->size)
         return object->items[index].value;
     else
         return NULL;
@@ -533,7 +1001,7 @@ json_value* _json_object_get(json_value *v, const char *name, unsigned int len)
     assert(object);
     assert(name);
 
-    if (v->type != json_type_object)
+    if (v->type != json_type_object || !_READY(v))
         return NULL;
 
     _hash_string(name, &len, &hash);
@@ -549,18 +1017,132 @@ json_value* json_object_get(json_value *v, const char *name)
     return _json_object_get(v, name, (unsigned int)-1);
 }
 
+json_key* json_key_init(json_key *key, const char *name, unsigned int len)
+{
+    assert(key);
+    assert(name);
+
+    key->name = name;
+    _hash_string(name, &len, &key->hash);
+    key->len = len;
+
+    return key;
+}
+
+/* used by snapshots, whose member name hashes do not depend on the process */
+unsigned int json_hash_keyed(const char *str, size_t len, uint64_t k0, uint64_t k1)
+{
+    uint64_t h = _siphash13(str, len, k0, k1);
+    return (unsigned int)(h ^ (h >> 32));
+}
+
+json_value* json_object_get_key(json_value *v, const json_key *key)
+{
+    json_object *object = (json_object*)v;
+    int index;
+
+    assert(object);
+    assert(key);
+
+    if (v->type != json_type_object || !_READY(v))
+        return NULL;
+
+    index = _name_to_index(object, key->name, key->len, key->hash, NULL);
+    if (index >= object->size)
+        return NULL;
+
+    return object->items[index].value;
+}
+
+unsigned int json_object_get_many(json_value *v, const char **names, unsigned int n, json_value **values)
+{
+    json_key keys[GET_MANY_BATCH];
+    unsigned int found = 0, count, i;
+
+    assert(v);
+    assert(names || !n);
+    assert(values || !n);
+
+    /* hashed up front, a batch at a time */
+    for (; n; n -= count, names += count, values += count) {
+        count = n < GET_MANY_BATCH ? n : GET_MANY_BATCH;
+        for (i = 0; i < count; ++i)
+            json_key_init(keys + i, names[i], (unsigned int)-1);
+        found += json_object_get_many_keys(v, keys, count, values);
+    }
+
+    return found;
+}
+
+unsigned int json_object_get_many_keys(json_value *v, const json_key *keys, unsigned int n, json_value **values)
+{
+    json_object *object = (json_object*)v;
+    unsigned int found = 0, count;
+
+    assert(object);
+    assert(keys || !n);
+    assert(values || !n);
+
+    if (v->type != json_type_object || !_READY(v)) {
+        for (count = 0; count < n; ++count)
+            values[count] = NULL;
+        return 0;
+    }
+
+    for (; n; n -= count, keys += count, values += count) {
+        count = n < GET_MANY_BATCH ? n : GET_MANY_BATCH;
+        found += _get_many(object, keys, count, values);
+    }
+
+    return found;
+}
+
+/* used by json_columnarize, tries the member at *hint before the lookup */
+json_value* json_object_get_hint(json_value *v, const json_key *key, unsigned int *hint)
+{
+    json_object *object = (json_object*)v;
+    _json_object_item *item;
+    int index;
+
+    if (v->type != json_type_object || !_READY(v))
+        return NULL;
+
+    if (*hint < (unsigned int)object->size) {
+        /* objects of the same shape keep their members at the same place */
+        item = object->items + *hint;
+        if (item->name_hash == key->hash && item->name_len == key->len && 
+            memcmp(_object_item_name(item), key->name, key->len) == 0)
+            return item->value;
+    }
+
+    index = _name_to_index(object, key->name, key->len, key->hash, NULL);
+    if (index >= object->size)
+        return NULL;
+    *hint = (unsigned int)index;
+    return object->items[index].value;
+}
+
 json_value* json_object_set(json_value *v, const char *name, json_value *value)
+{
+    return json_object_set_len(v, name, (unsigned int)-1, value);
+}
+
+/* used by the parser, which sets keys directly from the source text */
+json_value* json_object_set_len(json_value *v, const char *name, unsigned int len, json_value *value)
 {
     json_object *object = (json_object*)v;
-    unsigned int len = (unsigned int)-1, hash;
+    unsigned int hash;
     int index, lower_bound, i;
 
     assert(object);
     assert(name);
 
-    if (v->type != json_type_object || !value)
+    if (v->type != json_type_object || !value || !_READY(v))
         return NULL;
 
+    if (v->refcount > 1 || (v->flags & FLAG_FROZEN))
+        return NULL;  /* shared or frozen, see json_clone_shared */
+
     _hash_string(name, &len, &hash);
     index = _name_to_index(object, name, len, hash, &lower_bound);
     
@@ -576,21 +1158,9 @@ json_value* json_object_set(json_value *v, const char *name, json_value *value)
         assert(index == object->size);
         assert(lower_bound >= 0 && lower_bound <= object->size);
 
-        if (object->size == object->capacity) {
-            unsigned int capacity;
-            _json_object_item *items;
-            
-            capacity = _new_capacity(object->capacity);
-            items = (_json_object_item*)object->alloc_func(  /* realloc */
-                object->items, 
-                sizeof(_json_object_item) * object->capacity, 
-                sizeof(_json_object_item) * capacity
-                );
-            if (!items)
-                return NULL;
-
-            object->capacity = capacity;
-            object->items = items;
+        if (object->size == object->capacity && 
+            !_object_realloc(object, (int)json_grow_capacity(v->alloc_func, object->capacity))) {
+            return NULL;
         }
 
         /* add the new element to the end */
@@ -614,12 +1184,12 @@ json_value* json_object_erase(json_value *v, const char *name)
 {
     json_object *object = (json_object*)v;
     unsigned int len = (unsigned int)-1, hash;
-    int i, index;
+    int index;
 
     assert(object);
     assert(name);
 
-    if (v->type != json_type_object)
+    if (v->type != json_type_object || !_READY(v))
         return NULL;
 
     _hash_string(name, &len, &hash);
@@ -627,23 +1197,60 @@ json_value* json_object_erase(json_value *v, const char *name)
     if (index >= object->size)
         return NULL;
 
-    _object_item_cleanup(object->items + index, v->alloc_func);
-
-    for (i = index + 1; i < object->size; ++i)
-        object->items[i - 1] = object->items[i];
-    
-    object->size -= 1;
-    
-    /* fix sorted_index */
-    for (i = 0; i < object->size; ++i) {
-        if (object->items[i].sorted_index > index)
-            object->items[i].sorted_index -= 1;
-    }
+    if (v->refcount > 1 || (v->flags & FLAG_FROZEN))
+        return NULL;  /* shared or frozen, see json_clone_shared */
 
+    _object_remove(object, index);
     return v;
 }
 
-/*----------------------------------------------------------------------------*/
+json_value* json_object_reserve(json_value *v, unsigned int capacity)
+{
+    json_object *object = (json_object*)v;
+
+    assert(object);
+
+    if (v->type != json_type_object || capacity > INT_MAX || !_READY(v))
+        return NULL;
+
+    if (v->refcount > 1 || (v->flags & FLAG_FROZEN))
+        return NULL;  /* shared or frozen, see json_clone_shared */
+
+    if ((int)capacity > object->capacity && !_object_realloc(object, (int)capacity))
+        return NULL;
+    return v;
+}
+
+json_value* json_object_take(json_value *v, const char *name, json_value **value)
+{
+    json_object *object = (json_object*)v;
+    unsigned int len = (unsigned int)-1, hash;
+    int index;
+
+    assert(object);
+    assert(name);
+    assert(value);
+
+    *value = NULL;
+    if (v->type != json_type_object || !_READY(v))
+        return NULL;
+
+    _hash_string(name, &len, &hash);
+    index = _name_to_index(object, name, len, hash, NULL);
+    if (index >= object->size)
+        return NULL;
+
+    if (v->refcount > 1 || (v->flags & FLAG_FROZEN))
+        return NULL;  /* shared or frozen, see json_clone_shared */
+
+    /* detach the value so that removing the item leaves it alone */
+    *value = object->items[index].value;
+    object->items[index].value = NULL;
+    _object_remove(object, index);
+    return v;
+}
+
+/*----------------------------------------------------------------------------*/
 
 json_value* json_array_alloc(json_alloc_func alloc_func)
 {
@@ -658,9 +1265,12 @@ json_value* json_array_alloc(json_alloc_func alloc_func)
     
     array->alloc_func = alloc_func;
     array->type = json_type_array;
+    array->flags = 0;
+    array->refcount = 1;
     array->capacity = 0;
     array->values = NULL;
     array->size = 0;
+    array->hash = 0;
 
     return (json_value*)array;  
 }
@@ -681,10 +1291,11 @@ json_value* json_array_get(json_value *v, unsigned int index)
     json_array *array = (json_array*)v;
     assert(array);
     
-    if (v->type == json_type_array && index < array->size)
-        return array->values[index];
-    else
+    if (v->type != json_type_array || index >= array->size || !_READY(v))
         return NULL;
+    if (v->flags & FLAG_TYPED)
+        return _typed_node(array, index);
+    return array->values[index];
 }
 
 json_value* json_array_set(json_value *v, unsigned int index, json_value *value)
@@ -692,25 +1303,24 @@ json_value* json_array_set(json_value *v, unsigned int index, json_value *value)
     json_array *array = (json_array*)v;
     assert(array);
 
-    if (v->type != json_type_array || index > array->size || !value)
+    if (v->type != json_type_array || index > array->size || !value || !_READY(v))
         return NULL;
 
+    if (v->refcount > 1 || (v->flags & FLAG_FROZEN))
+        return NULL;  /* shared or frozen, see json_clone_shared */
+    if (v->flags & FLAG_TYPED) {
+        /* a number keeps the array typed */
+        if (value->type == json_type_number)
+            return _typed_set(array, index, value) ? v : NULL;
+        if (!_array_untype(array))
+            return NULL;
+    }
+
     if (index == array->size) {
         /* insert a new value */
-        if (array->size == array->capacity) {
-            unsigned int c;
-            json_value **p;
-
-            c = _new_capacity(array->capacity);
-            p = (json_value**)array->alloc_func(  /* realloc */
-                array->values, 
-                sizeof(json_value*) * array->capacity,
-                sizeof(json_value*) * c
-                );
-            if (!p)
-                return NULL;
-            array->values = p;
-            array->capacity = c;
+        if (array->size == array->capacity && 
+            !_array_realloc(array, json_grow_capacity(v->alloc_func, array->capacity))) {
+            return NULL;
         }
 
         array->values[index] = value;
@@ -727,16 +1337,61 @@ json_value* json_array_set(json_value *v, unsigned int index, json_value *value)
     }
 }
 
+json_value* json_array_insert(json_value *v, unsigned int index, json_value *value)
+{
+    /* internal, shifts the values from index on */
+    json_array *array = (json_array*)v;
+
+    assert(array);
+
+    if (v->type != json_type_array || index > array->size || !value || !_READY(v))
+        return NULL;
+    if (index == array->size)
+        return json_array_set(v, index, value);
+
+    if (v->refcount > 1 || (v->flags & FLAG_FROZEN))
+        return NULL;  /* shared or frozen, see json_clone_shared */
+    if ((v->flags & FLAG_TYPED) && !_array_untype(array))
+        return NULL;
+
+    /* append the last value again to grow the vector, then shift */
+    if (!json_array_set(v, array->size, array->values[array->size - 1]))
+        return NULL;
+    memmove(array->values + index + 1, array->values + index, 
+        sizeof(json_value*) * (array->size - 2 - index));
+    array->values[index] = value;
+
+    return v;
+}
+
 json_value* json_array_erase(json_value *v, unsigned int index)
 {
     json_array *array = (json_array*)v;
+    _typed_vector *vector;
     unsigned int i;
 
     assert(array);
 
-    if (v->type != json_type_array || index >= array->size)
+    if (v->type != json_type_array || index >= array->size || !_READY(v))
         return NULL;
 
+    if (v->refcount > 1 || (v->flags & FLAG_FROZEN))
+        return NULL;  /* shared or frozen, see json_clone_shared */
+
+    if (v->flags & FLAG_TYPED) {
+        vector = _TYPED_VECTOR(array);
+        memmove(vector->numbers + index, vector->numbers + index + 1, 
+            sizeof(double) * (array->size - index - 1));
+        if (vector->nodes) {
+            json_free(vector->nodes[index]);
+            memmove(vector->nodes + index, vector->nodes + index + 1, 
+                sizeof(json_value*) * (array->size - index - 1));
+            vector->nodes[array->size - 1] = NULL;
+        }
+        array->size -= 1;
+        return v;
+    }
+
     json_free(array->values[index]);
     
     for (i = index + 1; i < array->size; ++i)
@@ -747,402 +1402,2719 @@ json_value* json_array_erase(json_value *v, unsigned int index)
     return v;
 }
 
-/*----------------------------------------------------------------------------*/
-
-json_value* json_clone(json_value *v, json_alloc_func alloc_func)
+json_value* json_array_reserve(json_value *v, unsigned int capacity)
 {
-    json_value *clone = NULL;
-    json_string *string;
-    json_number *number;
-    json_object *object;
-    json_array  *array;
-    unsigned int i;
+    json_array *array = (json_array*)v;
 
-    assert(v);
+    assert(array);
 
-    switch (v->type)
-    {
-    case json_type_string:
-        string = (json_string*)v;
-        clone = json_string_alloc(
-            string->trailing ? string->trailing_str.str : string->str.ptr, 
-            string->len, 
-            alloc_func
-            );
-        break;
+    if (v->type != json_type_array || !_READY(v))
+        return NULL;
 
-    case json_type_number:
-        number = (json_number*)v;
-        clone = json_number_alloc(number->dbl, alloc_func);
-        break;
+    if (v->refcount > 1 || (v->flags & FLAG_FROZEN))
+        return NULL;  /* shared or frozen, see json_clone_shared */
 
-    case json_type_true:
-    case json_type_false:
-        clone = json_boolean_alloc(v->type == json_type_true, alloc_func);
-        break;
+    if (capacity > array->capacity && !_array_realloc(array, capacity))
+        return NULL;
+    return v;
+}
 
-    case json_type_null:
-        clone = json_null_alloc(alloc_func);
-        break;
+json_value* json_array_take(json_value *v, unsigned int index, json_value **value)
+{
+    json_array *array = (json_array*)v;
 
-    case json_type_object:
-        object = (json_object*)v;
-        clone = json_object_alloc(alloc_func);
-        if (clone) {
-            for (i = 0; i < (unsigned int)object->size; ++i) {
-                json_value *child_clone = json_clone(object->items[i].value, alloc_func);
-                if (!child_clone) {
-                    json_free(clone);
-                    clone = NULL;
-                    break;
-                }
-                if (!json_object_set(clone, object->items[i].name_str, child_clone)) {
-                    json_free(child_clone);
-                    json_free(clone);
-                    clone = NULL;
-                    break;
-                }
-            }
-        }
-        break;
+    assert(array);
+    assert(value);
 
-    case json_type_array:
-        array = (json_array*)v;
-        clone = json_array_alloc(alloc_func);
-        if (clone) {
-            for (i = 0; i < array->size; ++i) {
-                json_value *child_clone = json_clone(array->values[i], alloc_func);
-                if (!child_clone) {
-                    json_free(clone);
-                    clone = NULL;
-                    break;
-                }
-                if (!json_array_set(clone, i, child_clone)) {
-                    json_free(child_clone);
-                    json_free(clone);
-                    clone = NULL;
-                    break;
-                }
-            }
-        }
-        break;
+    *value = NULL;
+    if (v->type != json_type_array || index >= array->size || !_READY(v))
+        return NULL;
 
-    default:
-        assert(0);
+    if (v->refcount > 1 || (v->flags & FLAG_FROZEN))
+        return NULL;  /* shared or frozen, see json_clone_shared */
+    if (v->flags & FLAG_TYPED) {
+        /* the node leaves the table before the element is erased */
+        *value = _typed_node(array, index);
+        if (!*value)
+            return NULL;
+        _TYPED_VECTOR(array)->nodes[index] = NULL;
+        return json_array_erase(v, index);
     }
 
-    return clone;
+    *value = array->values[index];
+    memmove(array->values + index, array->values + index + 1, 
+        sizeof(json_value*) * (array->size - index - 1));
+    array->size -= 1;
+    return v;
 }
 
-/*----------------------------------------------------------------------------*/
-
-void json_free(json_value *v)
+json_value* json_array_splice(
+    json_value *v, 
+    unsigned int index, 
+    unsigned int count, 
+    json_value *items, 
+    json_value **removed
+    )
 {
-    json_string *string;
-    json_object *object;
-    json_array  *array;
-    unsigned int i;
+    json_array *array = (json_array*)v, *source = NULL, *out = NULL;
+    json_value *copy = NULL;
+    unsigned int n = 0, i;
 
-    if (!v)
-        return;
+    assert(array);
 
-    switch (v->type)
-    {
-    case json_type_string:
-        string = (json_string*)v;
-        if (!string->trailing)
-            v->alloc_func(string->str.ptr, string->str.capacity + 1, 0);
-        v->alloc_func(string, sizeof(json_string) + string->trailing_extra_cb, 0);
-        break;
+    if (removed)
+        *removed = NULL;
+    if (v->type != json_type_array || index > array->size || count > array->size - index)
+        return NULL;
+    if (items && (items->type != json_type_array || items == v))
+        return NULL;
+    if (!_READY(v) || (items && !_READY(items)))
+        return NULL;
 
-    case json_type_number:
-        v->alloc_func(v, sizeof(json_number), 0);
-        break;
+    if (v->refcount > 1 || (v->flags & FLAG_FROZEN))
+        return NULL;  /* shared or frozen, see json_clone_shared */
+    if ((v->flags & FLAG_TYPED) && !_array_untype(array))
+        return NULL;
 
-    case json_type_true:
-    case json_type_false:
-    case json_type_null:
-        v->alloc_func(v, sizeof(json_value), 0);
-        break;
+    if (items) {
+        /* the values of items are moved over, from a private copy if it has 
+           other owners */
+        copy = json_is_shared(items) ? _shallow_copy(items) : items;
+        if (!copy)
+            return NULL;
+        source = (json_array*)copy;
+        if ((copy->flags & FLAG_TYPED) && !_array_untype(source))
+            goto error;
+        n = source->size;
+    }
+    if (removed) {
+        out = (json_array*)json_array_alloc(v->alloc_func);
+        if (!out || !_array_grow(out, count))
+            goto error;
+    }
+    if (!_array_grow(array, array->size - count + n))
+        goto error;
+
+    /* nothing can fail from here on */
+    if (out) {
+        if (count)
+            memcpy(out->values, array->values + index, sizeof(json_value*) * count);
+        out->size = count;
+        *removed = (json_value*)out;
+    } else {
+        for (i = 0; i < count; ++i)
+            json_free(array->values[index + i]);
+    }
+    if (index + count < array->size) {
+        memmove(array->values + index + n, array->values + index + count, 
+            sizeof(json_value*) * (array->size - index - count));
+    }
+    if (n)
+        memcpy(array->values + index, source->values, sizeof(json_value*) * n);
+    array->size = array->size - count + n;
+
+    if (items) {
+        source->size = 0;
+        json_free(copy);
+        if (copy != items)
+            json_free(items);
+    }
+    return v;
 
-    case json_type_object:
-        object = (json_object*)v;
-        for (i = 0; i < (unsigned int)object->size; ++i)
-            _object_item_cleanup(object->items + i, v->alloc_func);
-        v->alloc_func(object->items, sizeof(_json_object_item) * object->capacity, 0);
-        v->alloc_func(object, sizeof(json_object), 0);
-        break;
+error:
+    json_free((json_value*)out);
+    if (copy && copy != items)
+        json_free(copy);
+    return NULL;
+}
 
-    case json_type_array:
-        array = (json_array*)v;
-        for (i = 0; i < array->size; ++i)
-            json_free(array->values[i]);
-        v->alloc_func(array->values, sizeof(json_value*) * array->capacity, 0);
-        v->alloc_func(array, sizeof(json_array), 0);
-        break;
+json_value* json_array_alloc_doubles(const double *numbers, unsigned int count, json_alloc_func alloc_func)
+{
+    json_value *v;
+    json_array *array;
+    unsigned int i;
 
-    default:
-        assert(0);
+    assert(numbers || !count);
+
+    v = json_array_alloc(alloc_func);
+    if (!v)
+        return NULL;
+    array = (json_array*)v;
+    v->flags |= FLAG_TYPED;
+    if (count && !_array_realloc(array, count)) {
+        json_free(v);
+        return NULL;
     }
-}
+    for (i = 0; i < count; ++i)
+        _typed_append(array, numbers[i]);  /* in place, it has the room */
 
-/*----------------------------------------------------------------------------*/
+    return v;
+}
 
-json_value* json_dotget(json_value *v, const char *dotname)
+int json_array_is_typed(json_value *v)
 {
-    const char *p = dotname;
-    char c;
-    json_value *child;
-    unsigned int index;
+    assert(v);
+    return v->type == json_type_array && _READY(v) && (v->flags & FLAG_TYPED) != 0;
+}
 
+const double* json_array_doubles(json_value *v)
+{
     assert(v);
-    assert(dotname);
 
-    if (v->type != json_type_array && v->type != json_type_object)
+    if (v->type != json_type_array || !_READY(v) || !(v->flags & FLAG_TYPED))
         return NULL;
+    return _typed_numbers((json_array*)v);
+}
 
-    while ((c = *p)) {
-        if (c == '.')
-            break;
-        p++;
+unsigned int json_array_get_doubles(json_value *v, unsigned int index, double *numbers, unsigned int count)
+{
+    json_array *array = (json_array*)v;
+    unsigned int i;
+
+    assert(array);
+    assert(numbers || !count);
+
+    if (v->type != json_type_array || index >= array->size || !_READY(v))
+        return 0;
+    if (count > array->size - index)
+        count = array->size - index;
+
+    if (v->flags & FLAG_TYPED) {
+        memcpy(numbers, _typed_numbers(array) + index, sizeof(double) * count);
+    } else {
+        for (i = 0; i < count; ++i)
+            numbers[i] = json_number_get(array->values[index + i]);
     }
+    return count;
+}
 
-    if (v->type == json_type_array) {
-        /* 0 1 2 3 4 5
-           [ x ] . y
-           ^     ^
-           |     |
-        dotname  p  */
-        if (p - 3 < dotname)
-            return NULL;
-        if (*dotname != '[' || *(p - 1) != ']')
-            return NULL;
-        index = _str_to_index(dotname + 1, (unsigned int)(p - dotname - 2));
-        child = json_array_get(v, index);
-        if (!child)
-            return NULL;
+json_value* json_array_pack(json_value *v)
+{
+    json_array *array = (json_array*)v;
+    _typed_vector *vector;
+    json_value **values;
+    unsigned int size, capacity, i;
 
-        if (c == '.')
-            return json_dotget(child, p + 1);
-        else  /* c == '\0' */
-            return child;
+    assert(array);
 
-    } else {          /* json_type_object */
-        /* 0 1 2 3 4 5 6
-           f o o . b a r
-           ^     ^
-           |     |
-        dotname  p  */
-        if (p - 1 < dotname)
-            return NULL;
-        child = _json_object_get(v, dotname, (unsigned int)(p - dotname));
-        if (!child)
+    if (v->type != json_type_array || !_READY(v))
+        return NULL;
+    if (v->flags & FLAG_TYPED)
+        return v;
+    for (i = 0; i < array->size; ++i) {
+        if (array->values[i]->type != json_type_number)
             return NULL;
+    }
 
-        if (c == '.')
-            return json_dotget(child, p + 1);
-        else  /* c == '\0' */
-            return child;
+    if (v->refcount > 1 || (v->flags & FLAG_FROZEN))
+        return NULL;  /* shared or frozen, see json_clone_shared */
+
+    /* the numbers go into a new vector, the old one becomes its node table 
+       so the nodes stay where they are */
+    values = array->values;
+    size = array->size;
+    capacity = array->capacity;
+    if (!size) {
+        if (values)
+            array->alloc_func(values, sizeof(json_value*) * capacity, 0);
+        array->values = NULL;
+        array->capacity = 0;
+        v->flags |= FLAG_TYPED;
+        return v;
     }
-}
 
-const char* json_dotget_string(json_value *v, const char *dotname)
-{
-    json_value *p = json_dotget(v, dotname);
-    return p ? json_string_get(p) : NULL;
+    vector = (_typed_vector*)array->alloc_func(NULL, 0, _TYPED_VECTOR_SIZE(size));
+    if (!vector)
+        return NULL;
+    for (i = 0; i < size; ++i)
+        vector->numbers[i] = ((json_number*)values[i])->dbl;
+    vector->nodes = values;
+    vector->nodes_size = capacity;
+    array->values = (json_value**)vector;
+    array->capacity = size;
+    v->flags |= FLAG_TYPED;
+
+    return v;
 }
 
-double json_dotget_number(json_value *v, const char *dotname)
+double json_array_sum(json_value *v)
 {
-    json_value *p = json_dotget(v, dotname);
-    return p ? json_number_get(p) : _NaN();
+    return _reduce(v, 0);
 }
 
-int json_dotget_boolean(json_value *v, const char *dotname)
+double json_array_min(json_value *v)
 {
-    json_value *p = json_dotget(v, dotname);
-    return p ? json_boolean_get(p) : -1;
+    return _reduce(v, -1);
 }
 
-json_value* json_dotget_object(json_value *v, const char *dotname)
+double json_array_max(json_value *v)
 {
-    json_value *p = json_dotget(v, dotname);
-    return (p && json_type(p) == json_type_object) ? p : NULL;
+    return _reduce(v, 1);
 }
 
-json_value* json_dotget_array(json_value *v, const char *dotname)
+/* used by the decoders, an array stays typed while only numbers are appended */
+json_value* json_array_append_number(json_value *v, double dbl)
 {
-    json_value *p = json_dotget(v, dotname);
-    return (p && json_type(p) == json_type_array) ? p : NULL;
-}
+    json_array *array = (json_array*)v;
+    json_value *number, *res;
 
-/*----------------------------------------------------------------------------*/
+    assert(array && v->type == json_type_array);
 
-static double _NaN()
-{
-    /* assuming sizeof(unsigned)=4 && sizeof(double)=8 and Little-Endian */
-    unsigned int nan[2] = { 0xffffffff, 0x7fffffff };
-    return *(double*)nan;
+    if ((v->refcount > 1) || (v->flags & FLAG_FROZEN) || (array->size && !(v->flags & FLAG_TYPED))) {
+        number = json_number_alloc(dbl, array->alloc_func);
+        if (!number)
+            return NULL;
+        res = json_array_set(v, array->size, number);
+        if (!res)
+            json_free(number);
+        return res;
+    }
+
+    if (!(v->flags & FLAG_TYPED)) {
+        /* empty, the vector can change its kind */
+        if (array->values)
+            array->alloc_func(array->values, sizeof(json_value*) * array->capacity, 0);
+        array->values = NULL;
+        array->capacity = 0;
+        v->flags |= FLAG_TYPED;
+    }
+
+    return _typed_append(array, dbl) ? v : NULL;
 }
 
-static unsigned int _new_capacity(unsigned int capacity)
+/*----------------------------------------------------------------------------*/
+
+int json_iter_begin(json_iter *it, json_value *v)
 {
-    if (capacity == 0)
-        capacity = 4;
-    else if (capacity < 1024)
-        capacity *= 2;
-    else
-        capacity += 1024;
+    assert(it);
+    assert(v);
 
-    return capacity;
-}
+    it->name = NULL;
+    it->name_len = 0;
+    it->hash = 0;
+    it->index = 0;
+    it->value = NULL;
+    it->container = v;
+    it->next = 0;
 
-static int _object_item_init(
-    const char *name_str, 
-    unsigned int name_len, 
-    unsigned int name_hash, 
-    json_value *value, 
-    _json_object_item *item,
-    json_alloc_func alloc_func
-    )
+    if (!_READY(v)) {
+        it->size = 0;
+        return 0;
+    }
+    if (v->type == json_type_object) {
+        it->size = (unsigned int)((json_object*)v)->size;
+        if (it->size)
+            _PREFETCH(((json_object*)v)->items[0].value);
+    } else if (v->type == json_type_array) {
+        it->size = ((json_array*)v)->size;
+        if (it->size && !(v->flags & FLAG_TYPED))
+            _PREFETCH(((json_array*)v)->values[0]);
+    } else {
+        it->size = 0;
+        return 0;
+    }
+
+    return 1;
+}
+
+int json_iter_next(json_iter *it)
 {
-    assert(name_str);
-    assert(name_len);
-    assert(value);
-    assert(item);
-    assert(alloc_func);
+    _json_object_item *item;
+    json_value **values;
+    unsigned int i;
 
-    item->sorted_index = -1;
+    assert(it);
 
-    item->name_str = alloc_func(NULL, 0, name_len + 1);
-    if (!item->name_str)
+    if (it->next >= it->size)
         return 0;
-    item->name_len = name_len;
-    item->name_hash = name_hash;
-    memcpy((void*)item->name_str, name_str, name_len);
-    *(char*)(item->name_str + name_len) = '\0';
-
-    item->value = value;
+    i = it->index = it->next++;
+
+    /* the children are scattered, bring the next one in while this one is used */
+    if (it->container->type == json_type_object) {
+        item = ((json_object*)it->container)->items + i;
+        if (it->next < it->size)
+            _PREFETCH(item[1].value);
+        it->name = _object_item_name(item);
+        it->name_len = item->name_len;
+        it->hash = item->name_hash;
+        it->value = item->value;
+    } else if (it->container->flags & FLAG_TYPED) {
+        /* the numbers are inline, a node is made the first time */
+        it->value = _typed_node((json_array*)it->container, i);
+        if (!it->value)
+            return 0;
+    } else {
+        values = ((json_array*)it->container)->values;
+        if (it->next < it->size)
+            _PREFETCH(values[i + 1]);
+        it->value = values[i];
+    }
 
     return 1;
 }
 
-static void _object_item_cleanup(_json_object_item *item, json_alloc_func alloc_func)
+/*----------------------------------------------------------------------------*/
+
+json_value* json_clone(json_value *v, json_alloc_func alloc_func)
 {
-    assert(item);
-    assert(alloc_func);
+    json_walker w;
+    json_walk_event event;
+    json_value *clone = NULL, *copy, *parent;
+    int failed = 0;
 
-    alloc_func((void*)item->name_str, item->name_len + 1, 0);
-    item->name_str = NULL;
-    item->name_len = 0;
-    item->name_hash = 0;
-    
-    json_free(item->value);
-    item->value = NULL;
+    assert(v);
+
+    if (v->type != json_type_object && v->type != json_type_array)
+        return _clone_scalar(v, alloc_func);
+    if (v->flags & FLAG_TYPED)
+        return _copy_typed(v, alloc_func);
+
+    /* containers are allocated at their exact size on enter, then filled by 
+       their children in order, lazy ones read from what the walker built */
+    json_walk_begin(&w, v, alloc_func);
+    while ((event = json_walk_next(&w)) != json_walk_done) {
+        if (event == json_walk_leave)
+            continue;
+        if (event == json_walk_error) {
+            failed = 1;
+            break;
+        }
+
+        if (event == json_walk_enter && (w.value->flags & FLAG_TYPED)) {
+            /* no children to visit */
+            json_walk_skip(&w);
+            event = json_walk_scalar;
+            copy = _copy_typed(w.value, alloc_func);
+        } else if (event == json_walk_enter)
+            copy = _alloc_container_like(json_walk_container(&w), alloc_func);
+        else
+            copy = _clone_scalar(w.value, alloc_func);
+        if (!copy) {
+            failed = 1;
+            break;
+        }
+
+        parent = (json_value*)json_walk_parent_data(&w);
+        if (!parent) {
+            clone = copy;
+        } else if (!_copy_child(parent, _walk_container(w.stack + w.depth - 1), w.index, copy)) {
+            json_free(copy);
+            failed = 1;
+            break;
+        }
+        if (event == json_walk_enter)
+            json_walk_set_data(&w, copy);
+    }
+    json_walk_end(&w);
+
+    if (failed) {
+        json_free(clone);
+        return NULL;
+    }
+    return clone;
 }
 
-static int _object_item_index_lower_bound(
-    _json_object_item *items,
-    int count,
-    unsigned int hash
-    )
+json_value* json_clone_shared(json_value *v)
 {
-    _json_object_item *first, *middle;
-    int len, half;
+    assert(v);
 
-    first = items;
-    len = count;
+    /* a handle of its own over shared children, which the mutators refuse: 
+       only json_dotset can replace them, in the parent it copies on the way */
+    if (v->flags & FLAG_FROZEN)
+        return _share(v);
+    return _shallow_copy(v);
+}
 
-    while (len > 0) {
-        half = len >> 1;
-        middle = first + half;
-        assert(middle->sorted_index >= 0 && middle->sorted_index < count);
-        if (items[middle->sorted_index].name_hash < hash) {
-            first = middle + 1;
-            len = len - half - 1;
-        } else {
-            len = half;
+json_value* json_compact(json_value *v, json_alloc_func alloc_func)
+{
+    json_walker w;
+    json_walk_event event;
+    _json_block *block;
+    json_value *root = NULL, *copy, *parent, *source;
+    char *cursor;
+    size_t size = 0, node_size;
+
+    assert(v);
+
+    if (!alloc_func)
+        alloc_func = json_default_alloc_func;
+
+    /* first pass, the size of everything */
+    json_walk_begin(&w, v, alloc_func);
+    while ((event = json_walk_next(&w)) != json_walk_done) {
+        if (event == json_walk_error) {
+            json_walk_end(&w);
+            return NULL;
+        }
+        if (event == json_walk_leave)
+            continue;
+        source = event == json_walk_enter ? json_walk_container(&w) : w.value;
+        if (!source) {
+            json_walk_end(&w);
+            return NULL;
         }
+        if (source->flags & FLAG_TYPED)
+            json_walk_skip(&w);  /* its numbers are part of it */
+        size += _compact_size(source);
     }
+    json_walk_end(&w);
 
-    assert(first >= items && first <= items + count);
-    return (int)(first - items);
+    size += _BLOCK_ALIGN(sizeof(_json_block));
+    block = (_json_block*)alloc_func(NULL, 0, size);
+    if (!block)
+        return NULL;
+    block->size = size;
+    cursor = (char*)block + _BLOCK_ALIGN(sizeof(_json_block));
+
+    /* second pass, the nodes in traversal order, each container followed by 
+       its item/value vector and its long names */
+    json_walk_begin(&w, v, alloc_func);
+    while ((event = json_walk_next(&w)) != json_walk_done) {
+        if (event == json_walk_error)
+            break;
+        if (event == json_walk_leave) {
+            /* the children are hashed already */
+            copy = (json_value*)json_walk_data(&w);
+            if (copy->type == json_type_object)
+                ((json_object*)copy)->hash = json_hash(copy);
+            else
+                ((json_array*)copy)->hash = json_hash(copy);
+            copy->flags |= FLAG_HASHED;
+            continue;
+        }
+
+        source = event == json_walk_enter ? json_walk_container(&w) : w.value;
+        if (!source) {
+            event = json_walk_error;
+            break;
+        }
+        node_size = _compact_size(source);
+        copy = _compact_node(source, &cursor, alloc_func);
+        assert((size_t)(cursor - (char*)copy) == node_size);
+        if (copy->flags & FLAG_TYPED) {
+            /* no children to visit and no leave */
+            json_walk_skip(&w);
+            event = json_walk_scalar;
+            ((json_array*)copy)->hash = json_hash(copy);
+            copy->flags |= FLAG_HASHED;
+        }
+
+        parent = (json_value*)json_walk_parent_data(&w);
+        if (!parent)
+            root = copy;
+        else if (parent->type == json_type_object)
+            ((json_object*)parent)->items[w.index].value = copy;
+        else
+            ((json_array*)parent)->values[w.index] = copy;
+        if (event == json_walk_enter)
+            json_walk_set_data(&w, copy);
+    }
+    json_walk_end(&w);
+
+    if (event == json_walk_error) {
+        alloc_func(block, size, 0);
+        return NULL;
+    }
+    assert(cursor == (char*)block + size);
+    root->flags |= FLAG_BLOCK_ROOT;
+    return root;
 }
 
-static void _hash_string(const char *str, unsigned int *len, unsigned int *hash)
+/*----------------------------------------------------------------------------*/
+
+json_value* json_freeze(json_value *v)
 {
-    const char *p;
-    char c;
-    unsigned int i;
-    
-    assert(str);
-    assert(len);
-    assert(hash);
-    
-    /* djb2 hash */
-    *hash = 5381;
-    p = str;
-    if (*len != (unsigned int)-1) {
-        for (i = 0; i < *len; ++i) {
-            c = *p++;
-            *hash = ((*hash << 5) + *hash) + c;
+    json_walker w;
+    json_walk_event event;
+    int failed = 0;
+
+    assert(v);
+
+    /* lazy containers are built in place first, so that readers of the 
+       frozen tree never build anything; typed ones are frozen as they are */
+    json_walk_begin(&w, v, v->alloc_func);
+    while ((event = json_walk_next(&w)) != json_walk_done) {
+        switch (event)
+        {
+        case json_walk_enter:
+            if (w.value->flags & FLAG_FROZEN) {
+                json_walk_skip(&w);
+                break;
+            }
+            if (!_READY(w.value)) {
+                failed = 1;
+                break;
+            }
+            if (w.value->flags & FLAG_TYPED) {
+                /* its nodes are frozen by the array, which makes the rest */
+                json_walk_skip(&w);
+                if (!_typed_freeze((json_array*)w.value)) {
+                    failed = 1;
+                    break;
+                }
+                ((json_array*)w.value)->hash = json_hash(w.value);
+                w.value->flags |= FLAG_HASHED | FLAG_FROZEN;
+            }
+            break;
+
+        case json_walk_leave:
+            /* the children have theirs cached already */
+            if (w.value->type == json_type_object)
+                ((json_object*)w.value)->hash = json_hash(w.value);
+            else
+                ((json_array*)w.value)->hash = json_hash(w.value);
+            w.value->flags |= FLAG_HASHED | FLAG_FROZEN;
+            break;
+
+        case json_walk_scalar:
+            w.value->flags |= FLAG_FROZEN;
+            break;
+
+        default:
+            failed = 1;
         }
-    } else {
-        while ((c = *p++)) {
-            *hash = ((*hash << 5) + *hash) + c;
+        if (failed)
+            break;
+    }
+    json_walk_end(&w);
+
+    return failed ? NULL : v;
+}
+
+void json_shrink_to_fit(json_value *v)
+{
+    json_walker w;
+    json_walk_event event;
+    json_string *string;
+
+    assert(v);
+
+    /* shrinking fails safe, the old capacity is kept */
+    json_walk_begin(&w, v, v->alloc_func);
+    while ((event = json_walk_next(&w)) != json_walk_done && event != json_walk_error) {
+        if (w.value->flags & (FLAG_FROZEN | FLAG_LAZY)) {
+            if (event == json_walk_enter)
+                json_walk_skip(&w);
+            continue;
+        }
+
+        switch (event)
+        {
+        case json_walk_enter:
+            if (w.value->type == json_type_object) {
+                _object_realloc((json_object*)w.value, ((json_object*)w.value)->size);
+            } else {
+                _array_realloc((json_array*)w.value, ((json_array*)w.value)->size);
+                if (w.value->flags & FLAG_TYPED)
+                    json_walk_skip(&w);  /* the numbers are inline, nothing more to trim */
+            }
+            break;
+
+        case json_walk_scalar:
+            string = (json_string*)w.value;
+            if (w.value->type == json_type_string && !(w.value->flags & FLAG_TRAILING) && 
+                string->str.capacity > string->len) {
+                char *ptr = (char*)string->alloc_func(string->str.ptr, string->str.capacity + 1, string->len + 1);  /* realloc */
+                if (ptr) {
+                    string->str.ptr = ptr;
+                    string->str.capacity = string->len;
+                }
+            }
+            break;
+
+        default:
+            break;
         }
-        *len = (unsigned int)(p - str - 1);  /* return the length */
     }
+    json_walk_end(&w);
 }
 
-static int _name_to_index(
-    json_object *object, 
-    const char *name, 
-    unsigned int len, 
-    unsigned int hash,
-    int *lower_bound
-    )
+int json_is_frozen(json_value *v)
 {
-    int index, i, n;
-    
-    assert(object);
-    assert(name);
+    assert(v);
+    return (v->flags & FLAG_FROZEN) != 0;
+}
 
-    if (!lower_bound)
-        lower_bound = &n;
-    *lower_bound = _object_item_index_lower_bound(object->items, object->size, hash);
-    assert(*lower_bound >= 0 && *lower_bound <= object->size);
+int json_is_shared(json_value *v)
+{
+    /* internal, true if v can not be modified in place by its owner */
+    assert(v);
+    return v->refcount > 1 || (v->flags & FLAG_FROZEN);
+}
 
-    for (i = *lower_bound; i < object->size; ++i) {
-        index = object->items[i].sorted_index;
-        if (object->items[index].name_hash != hash)
+json_value* json_shallow_copy(json_value *v)
+{
+    /* internal, a private copy of v with the children shared */
+    assert(v);
+    return _shallow_copy(v);
+}
+
+json_value* json_share(json_value *v)
+{
+    /* internal, v itself with one more owner, or a copy */
+    assert(v);
+    return _share(v);
+}
+
+json_value* json_lazy_node(json_value_type type, void *doc, unsigned int entry, unsigned int size, json_alloc_func alloc_func)
+{
+    /* internal, a container of size children still to be built from doc */
+    json_value *v;
+
+    assert(size > 0);
+
+    if (type == json_type_object) {
+        v = json_object_alloc(alloc_func);
+        if (!v)
+            return NULL;
+        ((json_object*)v)->capacity = (int)entry;
+        ((json_object*)v)->items = (_json_object_item*)doc;
+        ((json_object*)v)->size = (int)size;
+    } else {
+        v = json_array_alloc(alloc_func);
+        if (!v)
+            return NULL;
+        ((json_array*)v)->capacity = entry;
+        ((json_array*)v)->values = (json_value**)doc;
+        ((json_array*)v)->size = size;
+    }
+    v->flags |= FLAG_LAZY;
+    return v;
+}
+
+/*----------------------------------------------------------------------------*/
+
+uint64_t json_hash(json_value *v)
+{
+    json_walker w;
+    json_walk_event event;
+    json_value *container;
+    _json_object_item *item;
+    uint64_t inline_sums[JSON_WALK_INLINE_DEPTH], *sums = inline_sums, h = 0;
+    unsigned int capacity = JSON_WALK_INLINE_DEPTH;
+    int failed = 0;
+
+    assert(v);
+
+    if (v->type != json_type_object && v->type != json_type_array)
+        return _hash_scalar(v);
+
+    /* post-order, sums[depth] gathers the children of the container at that 
+       depth; a hashed container is not entered. Objects sum one term per 
+       member so that their order does not matter */
+    json_walk_begin(&w, v, v->alloc_func);
+    while (!failed && (event = json_walk_next(&w)) != json_walk_done) {
+        switch (event)
+        {
+        case json_walk_enter:
+            if (w.value->flags & FLAG_HASHED) {
+                json_walk_skip(&w);
+                h = w.value->type == json_type_object ? ((json_object*)w.value)->hash : ((json_array*)w.value)->hash;
+                break;
+            }
+            container = json_walk_container(&w);
+            if (!container || (w.depth == capacity && !_hash_sums_grow(&sums, inline_sums, &capacity, w.alloc_func))) {
+                failed = 1;  /* no memory to look at the children */
+                continue;
+            }
+            sums[w.depth] = container->type == json_type_object ? 
+                (uint64_t)((json_object*)container)->size : (uint64_t)((json_array*)container)->size;
+            continue;
+
+        case json_walk_leave:
+            h = _mix64(sums[w.depth] ^ w.value->type);
             break;
-        if (object->items[index].name_len == len && memcmp(object->items[index].name_str, name, len) == 0)
-            return index;
+
+        case json_walk_scalar:
+            h = _hash_scalar(w.value);
+            break;
+
+        default:
+            failed = 1;
+            continue;
+        }
+
+        if (w.depth == 0)
+            continue;
+        container = _walk_container(w.stack + w.depth - 1);
+        if (container->type == json_type_object) {
+            item = ((json_object*)container)->items + w.index;
+            sums[w.depth - 1] += _mix64(h ^ (((uint64_t)item->name_hash << 32) | item->name_len));
+        } else {
+            sums[w.depth - 1] = _mix64(sums[w.depth - 1] + h);
+        }
     }
+    json_walk_end(&w);
+    if (sums != inline_sums)
+        v->alloc_func(sums, sizeof(uint64_t) * capacity, 0);
 
-    return object->size;
+    return failed ? 0 : h;
 }
 
-static unsigned int _str_to_index(const char *str, unsigned int len)
+int json_equal(json_value *a, json_value *b)
 {
-    unsigned int i, num = (unsigned int)-1;
-    char c;
+    json_walker w, other_w;
+    json_walk_event event;
+    json_value *container, *other;
+    _json_object_item *item;
+    json_number number;
+    int index, res = 1;
+
+    assert(a);
+    assert(b);
+
+    /* shared subtrees */
+    if (a == b)
+        return 1;
+    if (a->type != b->type)
+        return 0;
+    if (a->type != json_type_object && a->type != json_type_array)
+        return _scalar_equal(a, b);
+
+    /* w walks a, the frames of other_w hold the matching containers of b, 
+       lazy ones built aside as for a; other_w is never stepped */
+    json_walk_begin(&w, a, a->alloc_func);
+    json_walk_begin(&other_w, b, b->alloc_func);
+    other_w.name = NULL;
+    other_w.name_len = 0;
+    other_w.index = 0;
+    while (res && (event = json_walk_next(&w)) != json_walk_done) {
+        if (event == json_walk_error) {
+            res = 0;
+            break;
+        }
+        if (event == json_walk_leave) {
+            _walk_release(other_w.stack + --other_w.top);
+            continue;
+        }
 
-    assert(str);
-    assert(len);
+        /* the counterpart in b, looked up with the stored hashes */
+        if (w.depth == 0) {
+            other = b;
+        } else {
+            container = _walk_container(other_w.stack + w.depth - 1);
+            if (container->type == json_type_object) {
+                item = ((json_object*)_walk_container(w.stack + w.depth - 1))->items + w.index;
+                index = _name_to_index((json_object*)container, w.name, w.name_len, item->name_hash, NULL);
+                if (index >= ((json_object*)container)->size) {
+                    res = 0;
+                    break;
+                }
+                other = ((json_object*)container)->items[index].value;
+            } else if (container->flags & FLAG_TYPED) {
+                other = _typed_item((json_array*)container, w.index, &number);
+            } else {
+                other = ((json_array*)container)->values[w.index];
+            }
+        }
 
-    for (i = 0; i < len; ++i) {
-        c = str[i];
-        if (c < '0' || c > '9')
-            return (unsigned int)-1;
-        
-        if (i == 0)
-            num = 0;
+        if (event == json_walk_scalar) {
+            res = _scalar_equal(w.value, other);
+            continue;
+        }
+        if (w.value == other) {
+            json_walk_skip(&w);
+            continue;
+        }
+        if (w.value->type != other->type || 
+            ((w.value->flags & other->flags & FLAG_HASHED) && json_hash(w.value) != json_hash(other))) {
+            res = 0;
+            break;
+        }
+        other_w.value = other;
+        if (!_walk_push(&other_w)) {
+            res = 0;
+            break;
+        }
+        container = json_walk_container(&w);
+        other = _walk_container(other_w.stack + other_w.top - 1);
+        if (!container || !other)
+            res = 0;
+        else if (container->type == json_type_object)
+            res = ((json_object*)container)->size == ((json_object*)other)->size;
         else
-            num *= 10;
-        num += c - '0';
+            res = ((json_array*)container)->size == ((json_array*)other)->size;
     }
+    json_walk_end(&w);
+    json_walk_end(&other_w);
 
-    return num;
+    return res;
+}
+
+/*----------------------------------------------------------------------------*/
+
+void json_free(json_value *v)
+{
+    json_walker w;
+    json_walk_event event;
+
+    if (!v)
+        return;
+
+    if (!_release(v))
+        return;  /* still owned by others */
+
+    if (v->type != json_type_object && v->type != json_type_array) {
+        _free_node(v);
+        return;
+    }
+
+    /* post-order, a container goes after its children */
+    json_walk_begin(&w, v, v->alloc_func);
+    while ((event = json_walk_next(&w)) != json_walk_done) {
+        switch (event)
+        {
+        case json_walk_enter:
+            if (!_release(w.value)) {
+                json_walk_skip(&w);
+            } else if (w.value->flags & (FLAG_BLOCK | FLAG_TYPED | FLAG_LAZY)) {
+                /* a compacted tree inside this one, or children it frees itself */
+                json_walk_skip(&w);
+                _free_node(w.value);
+            }
+            break;
+
+        case json_walk_leave:
+        case json_walk_scalar:
+            if (_release(w.value))
+                _free_node(w.value);
+            break;
+
+        case json_walk_error:
+            /* no memory for a deeper stack, fall back to recursion */
+            _free_recursive(w.value);
+            break;
+
+        default:
+            assert(0);
+        }
+    }
+    json_walk_end(&w);
+}
+
+/*----------------------------------------------------------------------------*/
+
+void json_walk_begin(json_walker *w, json_value *root, json_alloc_func alloc_func)
+{
+    assert(w);
+    assert(root);
+
+    w->value = NULL;
+    w->name = NULL;
+    w->name_len = 0;
+    w->index = 0;
+    w->depth = 0;
+    w->root = root;
+    w->alloc_func = alloc_func ? alloc_func : json_default_alloc_func;
+    w->stack = w->inline_stack;
+    w->frame = NULL;
+    w->top = 0;
+    w->capacity = JSON_WALK_INLINE_DEPTH;
+}
+
+json_walk_event json_walk_next(json_walker *w)
+{
+    json_walk_frame *frame;
+    _json_object_item *item;
+    json_value *v, *container;
+
+    assert(w);
+
+    if (w->frame && w->frame == w->stack + w->top) {
+        /* the container left or skipped last step, done with what was built for it */
+        _walk_release(w->frame);
+    }
+    w->frame = NULL;
+
+    if (w->root) {
+        v = w->root;
+        w->root = NULL;
+        w->name = NULL;
+        w->name_len = 0;
+        w->index = 0;
+
+    } else if (w->top == 0) {
+        w->value = NULL;
+        return json_walk_done;
+
+    } else {
+        frame = w->stack + w->top - 1;
+        container = _walk_container(frame);
+        if (!container) {
+            /* no memory for the children, the container is given up */
+            w->top -= 1;
+            w->value = frame->value;
+            w->name = frame->name;
+            w->name_len = frame->name_len;
+            w->index = frame->index;
+            w->depth = w->top;
+            w->frame = frame;
+            return json_walk_error;
+        }
+        /* a lazy object counted its names with their duplicates when pushed */
+        frame->size = container->type == json_type_object ? 
+            (unsigned int)((json_object*)container)->size : ((json_array*)container)->size;
+        if (frame->next == frame->size) {
+            /* all children are done */
+            w->top -= 1;
+            w->value = frame->value;
+            w->name = frame->name;
+            w->name_len = frame->name_len;
+            w->index = frame->index;
+            w->depth = w->top;
+            w->frame = frame;
+            return json_walk_leave;
+        }
+
+        w->index = frame->next++;
+        if (container->type == json_type_object) {
+            item = ((json_object*)container)->items + w->index;
+            v = item->value;
+            w->name = _object_item_name(item);
+            w->name_len = item->name_len;
+        } else if (container->flags & FLAG_TYPED) {
+            v = _typed_item((json_array*)container, w->index, (json_number*)&w->number);
+            w->name = NULL;
+            w->name_len = 0;
+        } else {
+            v = ((json_array*)container)->values[w->index];
+            w->name = NULL;
+            w->name_len = 0;
+        }
+    }
+
+    w->value = v;
+    w->depth = w->top;
+    if (v->type != json_type_object && v->type != json_type_array)
+        return json_walk_scalar;
+    if (!_walk_push(w))
+        return json_walk_error;
+    w->frame = w->stack + w->top - 1;
+    return json_walk_enter;
+}
+
+void json_walk_skip(json_walker *w)
+{
+    assert(w);
+    assert(w->top == w->depth + 1);
+    w->top -= 1;
+}
+
+void json_walk_set_data(json_walker *w, void *data)
+{
+    assert(w);
+    assert(w->top == w->depth + 1);
+    w->stack[w->depth].data = data;
+}
+
+void* json_walk_data(json_walker *w)
+{
+    assert(w);
+    assert(w->value->type == json_type_object || w->value->type == json_type_array);
+    return w->frame ? w->frame->data : NULL;  /* a left frame is kept until the next step */
+}
+
+json_value* json_walk_container(json_walker *w)
+{
+    assert(w);
+    return w->frame ? _walk_container(w->frame) : NULL;
+}
+
+void* json_walk_parent_data(json_walker *w)
+{
+    assert(w);
+    return w->depth > 0 ? w->stack[w->depth - 1].data : NULL;
+}
+
+void json_walk_end(json_walker *w)
+{
+    unsigned int i;
+
+    assert(w);
+    for (i = 0; i < w->top; ++i)
+        _walk_release(w->stack + i);
+    if (w->frame && w->frame == w->stack + w->top)
+        _walk_release(w->frame);
+    if (w->stack != w->inline_stack)
+        w->alloc_func(w->stack, sizeof(json_walk_frame) * w->capacity, 0);
+    w->stack = w->inline_stack;
+    w->frame = NULL;
+    w->top = 0;
+}
+
+/*----------------------------------------------------------------------------*/
+
+json_value* json_dotget(json_value *v, const char *dotname)
+{
+    const char *p;
+    json_value *child;
+    unsigned int index;
+
+    assert(v);
+    assert(dotname);
+
+    if (!_dot_segment(v, dotname, &p, &index))
+        return NULL;
+
+    if (v->type == json_type_array)
+        child = json_array_get(v, index);
+    else
+        child = _json_object_get(v, dotname, (unsigned int)(p - dotname));
+    if (!child)
+        return NULL;
+
+    if (*p == '.')
+        return json_dotget(child, p + 1);
+    else  /* *p == '\0' */
+        return child;
+}
+
+const char* json_dotget_string(json_value *v, const char *dotname)
+{
+    return json_as_string(json_dotget(v, dotname));
+}
+
+double json_dotget_number(json_value *v, const char *dotname)
+{
+    return json_as_number(json_dotget(v, dotname));
+}
+
+int json_dotget_boolean(json_value *v, const char *dotname)
+{
+    return json_as_boolean(json_dotget(v, dotname));
+}
+
+json_value* json_dotget_object(json_value *v, const char *dotname)
+{
+    return json_as_type(json_dotget(v, dotname), json_type_object);
+}
+
+json_value* json_dotget_array(json_value *v, const char *dotname)
+{
+    return json_as_type(json_dotget(v, dotname), json_type_array);
+}
+
+/* used by json_path.c, the conversions of the typed getters above, a NULL 
+   v stands for a missing value */
+const char* json_as_string(json_value *v)
+{
+    return v ? json_string_get(v) : NULL;
+}
+
+double json_as_number(json_value *v)
+{
+    return v ? json_number_get(v) : _NaN();
+}
+
+int json_as_boolean(json_value *v)
+{
+    return v ? json_boolean_get(v) : -1;
+}
+
+json_value* json_as_type(json_value *v, json_value_type type)
+{
+    return (v && v->type == type) ? v : NULL;
+}
+
+/* used by json_path.c and json_snapshot.c, a "[n]" segment of a dotname, 
+   (unsigned int)-1 if it is not one */
+unsigned int json_segment_to_index(const char *str, unsigned int len)
+{
+    if (len < 3 || str[0] != '[' || str[len - 1] != ']')
+        return (unsigned int)-1;
+    return _str_to_index(str + 1, len - 2);
+}
+
+/* used by json_snapshot.c */
+double json_nan()
+{
+    return _NaN();
+}
+
+static json_value* _dotset(json_value *v, const char *dotname, json_value *value)
+{
+    const char *p;
+    json_value *child, *copy;
+    unsigned int index = 0;
+
+    assert(v->refcount == 1);
+
+    if ((v->flags & FLAG_FROZEN) || !_dot_segment(v, dotname, &p, &index))
+        return NULL;
+
+    if (*p == '\0') {
+        if (v->type == json_type_array)
+            return json_array_set(v, index, value);
+        else
+            return json_object_set_len(v, dotname, (unsigned int)(p - dotname), value);
+    }
+
+    if (v->type == json_type_array)
+        child = json_array_get(v, index);
+    else
+        child = _json_object_get(v, dotname, (unsigned int)(p - dotname));
+    if (!child)
+        return NULL;
+
+    if (child->refcount == 1 && !(child->flags & FLAG_FROZEN))
+        return _dotset(child, p + 1, value) ? v : NULL;
+
+    /* the child is shared or frozen, modify a private copy of it and put the copy in place */
+    copy = _shallow_copy(child);
+    if (!copy)
+        return NULL;
+    if (!_dotset(copy, p + 1, value)) {
+        json_free(copy);
+        return NULL;
+    }
+    if (v->type == json_type_array)
+        v = json_array_set(v, index, copy);  /* never fails, index exists */
+    else
+        v = json_object_set_len(v, dotname, (unsigned int)(p - dotname), copy);
+    assert(v);
+
+    return v;
+}
+
+static json_value* _pointer_child(json_value *v, const char *token, unsigned int *index)
+{
+    const char *p;
+
+    if (v->type == json_type_object)
+        return json_object_get(v, token);
+
+    /* array index, without leading zeros */
+    if (v->type != json_type_array || !*token || (token[0] == '0' && token[1]))
+        return NULL;
+    *index = 0;
+    for (p = token; *p; ++p) {
+        if (*p < '0' || *p > '9' || *index > (UINT_MAX - 9) / 10)
+            return NULL;
+        *index = *index * 10 + (*p - '0');
+    }
+    return json_array_get(v, *index);
+}
+
+static json_value* _pointer_update(
+    json_value *v, 
+    const char *tokens, 
+    unsigned int count, 
+    json_value* (*func)(json_value *parent, const char *token, void *ctx), 
+    void *ctx
+    )
+{
+    const char *next;
+    json_value *child, *copy;
+    unsigned int index = 0;
+
+    assert(v->refcount == 1);
+
+    if (v->flags & FLAG_FROZEN)
+        return NULL;
+    if (count == 1)
+        return func(v, tokens, ctx);
+
+    child = _pointer_child(v, tokens, &index);
+    if (!child)
+        return NULL;
+    next = tokens + strlen(tokens) + 1;
+
+    if (child->refcount == 1 && !(child->flags & FLAG_FROZEN))
+        return _pointer_update(child, next, count - 1, func, ctx) ? v : NULL;
+
+    /* the child is shared or frozen, as in _dotset */
+    copy = _shallow_copy(child);
+    if (!copy)
+        return NULL;
+    if (!_pointer_update(copy, next, count - 1, func, ctx)) {
+        json_free(copy);
+        return NULL;
+    }
+    if (v->type == json_type_array)
+        v = json_array_set(v, index, copy);  /* never fails, index exists */
+    else
+        v = json_object_set(v, tokens, copy);
+    assert(v);
+
+    return v;
+}
+
+json_value* json_pointer_update(
+    json_value *v, 
+    const char *tokens, 
+    unsigned int count, 
+    json_value* (*func)(json_value *parent, const char *token, void *ctx), 
+    void *ctx
+    )
+{
+    /* Internal, see json_patch.c. Calls func on the container addressed by 
+       the first count - 1 of the NUL separated, unescaped JSON Pointer tokens, 
+       with the last token. Shared nodes on the way are copied on write. */
+    assert(v);
+    assert(tokens);
+    assert(count > 0);
+
+    if (v->refcount > 1)
+        return NULL;  /* see json_clone_shared */
+    return _pointer_update(v, tokens, count, func, ctx);
+}
+
+json_value* json_dotset(json_value *v, const char *dotname, json_value *value)
+{
+    assert(v);
+    assert(dotname);
+
+    /* copy on write, only the shared nodes along the path are copied, v 
+       itself must not be shared */
+    if (!value || v->refcount > 1)
+        return NULL;
+    return _dotset(v, dotname, value);
+}
+
+/*----------------------------------------------------------------------------*/
+
+static double _NaN()
+{
+    /* assuming sizeof(unsigned)=4 && sizeof(double)=8 and Little-Endian */
+    unsigned int nan[2] = { 0xffffffff, 0x7fffffff };
+    return *(double*)nan;
+}
+
+static unsigned int _string_capacity(json_string *string)
+{
+    if (string->flags & FLAG_TRAILING)
+        return _json_string_builtin_string_cb + string->trailing_str.extra_cb - 1;
+    else
+        return string->str.capacity;
+}
+
+static unsigned int _string_next_capacity(unsigned int capacity, unsigned int len)
+{
+    /* at least doubles, so that a loop of appends copies each byte O(1) times */
+    capacity = capacity < UINT_MAX / 2 ? capacity * 2 : UINT_MAX - 1;
+    return capacity < len ? len : capacity;
+}
+
+static int _string_grow(json_string *string, unsigned int len)
+{
+    unsigned int capacity = _string_capacity(string);
+
+    if (len <= capacity)
+        return 1;
+    return _string_realloc(string, _string_next_capacity(capacity, len));
+}
+
+static int _string_realloc(json_string *string, unsigned int capacity)
+{
+    /* move to a buffer for capacity characters, out of trailing mode */
+    char *ptr;
+
+    assert(capacity >= string->len);
+
+    if (string->flags & FLAG_TRAILING) {
+        ptr = (char*)string->alloc_func(NULL, 0, (size_t)capacity + 1);
+        if (!ptr)
+            return 0;
+        memcpy(ptr, string->trailing_str.str, string->len + 1);  /* overlaps str.ptr */
+    } else {
+        ptr = (char*)string->alloc_func(string->str.ptr, (size_t)string->str.capacity + 1, (size_t)capacity + 1);  /* realloc */
+        if (!ptr)
+            return 0;
+    }
+
+    string->flags &= ~FLAG_TRAILING;
+    string->str.ptr = ptr;
+    string->str.capacity = capacity;
+    return 1;
+}
+
+static int _array_grow(json_array *array, unsigned int size)
+{
+    /* make room for size values, growing the way appending one by one would */
+    unsigned int c = array->capacity;
+
+    if (size <= c)
+        return 1;
+    while (c < size)
+        c = json_grow_capacity(array->alloc_func, c);
+    return _array_realloc(array, c);
+}
+
+static int _array_realloc(json_array *array, unsigned int capacity)
+{
+    /* capacity is at least the size */
+    size_t cb = sizeof(json_value*);
+    json_value **p;
+
+    assert(capacity >= array->size);
+
+    if (array->flags & FLAG_TYPED)
+        return _typed_realloc(array, capacity);
+
+    if (!capacity) {
+        if (array->values)
+            array->alloc_func(array->values, cb * array->capacity, 0);
+        p = NULL;
+    } else {
+        p = (json_value**)array->alloc_func(array->values, cb * array->capacity, cb * capacity);  /* realloc */
+        if (!p)
+            return 0;
+    }
+    array->values = p;
+    array->capacity = capacity;
+    return 1;
+}
+
+static int _object_realloc(json_object *object, int capacity)
+{
+    _json_object_item *items;
+
+    assert(capacity >= object->size);
+
+    if (!capacity) {
+        if (object->items)
+            object->alloc_func(object->items, sizeof(_json_object_item) * object->capacity, 0);
+        items = NULL;
+    } else {
+        items = (_json_object_item*)object->alloc_func(  /* realloc */
+            object->items, 
+            sizeof(_json_object_item) * object->capacity, 
+            sizeof(_json_object_item) * capacity
+            );
+        if (!items)
+            return 0;
+    }
+    object->items = items;
+    object->capacity = capacity;
+    return 1;
+}
+
+static int _object_item_init(
+    const char *name_str, 
+    unsigned int name_len, 
+    unsigned int name_hash, 
+    json_value *value, 
+    _json_object_item *item,
+    json_alloc_func alloc_func
+    )
+{
+    char *str;
+
+    assert(name_str);
+    assert(name_len);
+    assert(value);
+    assert(item);
+    assert(alloc_func);
+
+    item->sorted_index = -1;
+
+    if (name_len < INLINE_NAME_CB) {
+        str = item->name.str;
+    } else {
+        str = (char*)alloc_func(NULL, 0, name_len + 1);
+        if (!str)
+            return 0;
+        item->name.ptr = str;
+    }
+    item->name_len = name_len;
+    item->name_hash = name_hash;
+    memcpy(str, name_str, name_len);
+    str[name_len] = '\0';
+
+    item->value = value;
+
+    return 1;
+}
+
+static void _object_item_cleanup(_json_object_item *item, json_alloc_func alloc_func)
+{
+    assert(item);
+    assert(alloc_func);
+
+    if (item->name_len >= INLINE_NAME_CB)
+        alloc_func(item->name.ptr, item->name_len + 1, 0);
+    item->name.ptr = NULL;
+    item->name_len = 0;
+    item->name_hash = 0;
+    
+    json_free(item->value);
+    item->value = NULL;
+}
+
+static void _object_remove(json_object *object, int index)
+{
+    /* drop the item at index, along with its value if still attached */
+    int i, sorted_index;
+
+    _object_item_cleanup(object->items + index, object->alloc_func);
+
+    /* the sorted_index fields form a separate array, remove the entry 
+       referring to index from it before moving the items */
+    for (i = 0; object->items[i].sorted_index != index; ++i)
+        ;
+    for (; i < object->size - 1; ++i)
+        object->items[i].sorted_index = object->items[i + 1].sorted_index;
+
+    for (i = index + 1; i < object->size; ++i) {
+        sorted_index = object->items[i - 1].sorted_index;
+        object->items[i - 1] = object->items[i];
+        object->items[i - 1].sorted_index = sorted_index;
+    }
+    
+    object->size -= 1;
+    
+    /* fix sorted_index */
+    for (i = 0; i < object->size; ++i) {
+        if (object->items[i].sorted_index > index)
+            object->items[i].sorted_index -= 1;
+    }
+}
+
+static const char* _object_item_name(const _json_object_item *item)
+{
+    return item->name_len < INLINE_NAME_CB ? item->name.str : item->name.ptr;
+}
+
+static int _object_item_index_lower_bound(
+    _json_object_item *items,
+    int count,
+    unsigned int hash
+    )
+{
+    _json_object_item *first, *middle;
+    int len, half;
+
+    first = items;
+    len = count;
+
+    while (len > 0) {
+        half = len >> 1;
+        middle = first + half;
+        assert(middle->sorted_index >= 0 && middle->sorted_index < count);
+        if (items[middle->sorted_index].name_hash < hash) {
+            first = middle + 1;
+            len = len - half - 1;
+        } else {
+            len = half;
+        }
+    }
+
+    assert(first >= items && first <= items + count);
+    return (int)(first - items);
+}
+
+/* SipHash-1-3, keyed with a per-process random seed so that colliding keys 
+   can not be crafted from outside. Input is consumed 8 bytes at a time. */
+#define _ROTL64(x, b)  (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+#define _SIPROUND                                                           \
+    do {                                                                    \
+        v0 += v1; v1 = _ROTL64(v1, 13); v1 ^= v0; v0 = _ROTL64(v0, 32);    \
+        v2 += v3; v3 = _ROTL64(v3, 16); v3 ^= v2;                           \
+        v0 += v3; v3 = _ROTL64(v3, 21); v3 ^= v0;                           \
+        v2 += v1; v1 = _ROTL64(v1, 17); v1 ^= v2; v2 = _ROTL64(v2, 32);    \
+    } while (0)
+
+static uint64_t _siphash13(const char *str, size_t len, uint64_t k0, uint64_t k1)
+{
+    const unsigned char *p = (const unsigned char*)str;
+    const unsigned char *end = p + (len & ~(size_t)7);
+    uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = k1 ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+    uint64_t m, b = (uint64_t)len << 56;
+
+    for (; p != end; p += 8) {
+        memcpy(&m, p, 8);  /* assuming Little-Endian */
+        v3 ^= m;
+        _SIPROUND;
+        v0 ^= m;
+    }
+
+    switch (len & 7) {
+    case 7: b |= (uint64_t)p[6] << 48;  /* fall through */
+    case 6: b |= (uint64_t)p[5] << 40;  /* fall through */
+    case 5: b |= (uint64_t)p[4] << 32;  /* fall through */
+    case 4: b |= (uint64_t)p[3] << 24;  /* fall through */
+    case 3: b |= (uint64_t)p[2] << 16;  /* fall through */
+    case 2: b |= (uint64_t)p[1] << 8;  /* fall through */
+    case 1: b |= (uint64_t)p[0];
+    }
+
+    v3 ^= b;
+    _SIPROUND;
+    v0 ^= b;
+    v2 ^= 0xff;
+    _SIPROUND;
+    _SIPROUND;
+    _SIPROUND;
+
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+static uint64_t _mix64(uint64_t x)
+{
+    /* splitmix64 finalizer */
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static uint64_t _hash_seed[2];
+
+#ifdef _MSC_VER
+static INIT_ONCE _hash_seed_once = INIT_ONCE_STATIC_INIT;
+#else
+static pthread_once_t _hash_seed_once = PTHREAD_ONCE_INIT;
+#endif
+
+static void _hash_seed_init()
+{
+    /* ASLR'd addresses plus the clock, good enough to keep the seed 
+       unpredictable from the outside. */
+    uint64_t entropy;
+    int local;
+
+    entropy = (uint64_t)(size_t)&local;
+    entropy = _mix64(entropy ^ (uint64_t)(size_t)&_hash_seed);
+    entropy = _mix64(entropy ^ (uint64_t)(size_t)&_get_hash_seed);
+    entropy = _mix64(entropy ^ (uint64_t)time(NULL));
+    entropy = _mix64(entropy ^ (uint64_t)clock());
+    _hash_seed[0] = entropy;
+    _hash_seed[1] = _mix64(entropy ^ 0x9e3779b97f4a7c15ULL);
+}
+
+#ifdef _MSC_VER
+static BOOL CALLBACK _hash_seed_init_once(PINIT_ONCE once, PVOID param, PVOID *context)
+{
+    (void)once;
+    (void)param;
+    (void)context;
+    _hash_seed_init();
+    return TRUE;
+}
+#endif
+
+static const uint64_t* _get_hash_seed()
+{
+    /* other threads block until the seed is made, instead of spinning */
+#ifdef _MSC_VER
+    InitOnceExecuteOnce(&_hash_seed_once, _hash_seed_init_once, NULL, NULL);
+#else
+    pthread_once(&_hash_seed_once, _hash_seed_init);
+#endif
+    return _hash_seed;
+}
+
+static void _hash_string(const char *str, unsigned int *len, unsigned int *hash)
+{
+    const uint64_t *seed;
+    uint64_t h;
+
+    assert(str);
+    assert(len);
+    assert(hash);
+
+    if (*len == (unsigned int)-1)
+        *len = (unsigned int)strlen(str);  /* return the length */
+
+    seed = _get_hash_seed();
+    h = _siphash13(str, *len, seed[0], seed[1]);
+    *hash = (unsigned int)(h ^ (h >> 32));
+}
+
+static int _name_to_index(
+    json_object *object, 
+    const char *name, 
+    unsigned int len, 
+    unsigned int hash,
+    int *lower_bound
+    )
+{
+    int index, i, n;
+    
+    assert(object);
+    assert(name);
+
+    if (!lower_bound)
+        lower_bound = &n;
+    *lower_bound = _object_item_index_lower_bound(object->items, object->size, hash);
+    assert(*lower_bound >= 0 && *lower_bound <= object->size);
+
+    for (i = *lower_bound; i < object->size; ++i) {
+        index = object->items[i].sorted_index;
+        if (object->items[index].name_hash != hash)
+            break;
+        if (object->items[index].name_len == len && memcmp(_object_item_name(object->items + index), name, len) == 0)
+            return index;
+    }
+
+    return object->size;
+}
+
+static unsigned int _get_many(json_object *object, const json_key *keys, unsigned int n, json_value **values)
+{
+    /* _name_to_index for up to GET_MANY_BATCH keys, the binary searches advance 
+       one step each in turn so that their cache misses overlap */
+    _json_object_item *items = object->items, *item;
+    int first[GET_MANY_BATCH], len[GET_MANY_BATCH];
+    int half, middle, active, i, index;
+    unsigned int k, found = 0;
+
+    assert(n <= GET_MANY_BATCH);
+
+    for (k = 0; k < n; ++k) {
+        first[k] = 0;
+        len[k] = object->size;
+    }
+
+    do {
+        active = 0;
+        for (k = 0; k < n; ++k) {
+            if (len[k] <= 0)
+                continue;
+            half = len[k] >> 1;
+            middle = first[k] + half;
+            if (items[items[middle].sorted_index].name_hash < keys[k].hash) {
+                first[k] = middle + 1;
+                len[k] -= half + 1;
+            } else {
+                len[k] = half;
+            }
+            if (len[k] > 0) {
+                _PREFETCH(items + first[k] + (len[k] >> 1));
+                active = 1;
+            }
+        }
+    } while (active);
+
+    for (k = 0; k < n; ++k) {
+        values[k] = NULL;
+        for (i = first[k]; i < object->size; ++i) {
+            index = items[i].sorted_index;
+            item = items + index;
+            if (item->name_hash != keys[k].hash)
+                break;
+            if (item->name_len == keys[k].len && memcmp(_object_item_name(item), keys[k].name, keys[k].len) == 0) {
+                values[k] = item->value;
+                found++;
+                break;
+            }
+        }
+    }
+
+    return found;
+}
+
+static unsigned int _str_to_index(const char *str, unsigned int len)
+{
+    unsigned int i, num = (unsigned int)-1;
+    char c;
+
+    assert(str);
+    assert(len);
+
+    for (i = 0; i < len; ++i) {
+        c = str[i];
+        if (c < '0' || c > '9')
+            return (unsigned int)-1;
+        if (i > 0 && num > (UINT_MAX - 9) / 10)
+            return (unsigned int)-1;  /* too long for an index */
+        
+        if (i == 0)
+            num = 0;
+        else
+            num *= 10;
+        num += c - '0';
+    }
+
+    return num;
+}
+
+static int _dot_segment(json_value *v, const char *dotname, const char **next, unsigned int *index)
+{
+    const char *p = dotname;
+    char c;
+
+    while ((c = *p)) {
+        if (c == '.')
+            break;
+        p++;
+    }
+    *next = p;
+
+    if (v->type == json_type_array) {
+        /* 0 1 2 3 4 5
+           [ x ] . y
+           ^     ^
+           |     |
+        dotname  p  */
+        if (p - dotname < 3)
+            return 0;
+        if (*dotname != '[' || *(p - 1) != ']')
+            return 0;
+        *index = _str_to_index(dotname + 1, (unsigned int)(p - dotname - 2));
+        return 1;
+
+    } else if (v->type == json_type_object) {
+        /* 0 1 2 3 4 5 6
+           f o o . b a r
+           ^     ^
+           |     |
+        dotname  p  */
+        return p - dotname >= 1;
+    }
+
+    return 0;
+}
+
+static int _retain(json_value *v)
+{
+    /* one more owner, 0 when there are too many */
+    unsigned short n;
+
+    do {
+        n = *(volatile unsigned short*)&v->refcount;
+        if (n == USHRT_MAX)
+            return 0;
+    } while (!_REFCOUNT_CAS(v, n, n + 1));
+    return 1;
+}
+
+static int _release(json_value *v)
+{
+    /* one owner less, 1 when it was the last one and v is to be freed */
+    unsigned short n;
+
+    do {
+        n = *(volatile unsigned short*)&v->refcount;
+        if (n == 1)
+            return 1;
+    } while (!_REFCOUNT_CAS(v, n, n - 1));
+    return 0;
+}
+
+static json_value* _share(json_value *v)
+{
+    if ((v->flags & FLAG_BLOCK) && !(v->flags & FLAG_BLOCK_ROOT))
+        return json_clone(v, v->alloc_func);  /* would not outlive its block */
+    if (!_retain(v))
+        return json_clone(v, v->alloc_func);  /* too many owners, fall back to a real copy */
+    return v;
+}
+
+static json_value* _clone_scalar(json_value *v, json_alloc_func alloc_func)
+{
+    json_string *string;
+
+    switch (v->type)
+    {
+    case json_type_string:
+        string = (json_string*)v;
+        return json_string_alloc(
+            (string->flags & FLAG_TRAILING) ? string->trailing_str.str : string->str.ptr, 
+            string->len, 
+            alloc_func
+            );
+
+    case json_type_number:
+        return json_number_alloc(((json_number*)v)->dbl, alloc_func);
+
+    case json_type_true:
+    case json_type_false:
+        return json_boolean_alloc(v->type == json_type_true, alloc_func);
+
+    case json_type_null:
+        return json_null_alloc(alloc_func);
+
+    default:
+        assert(0);
+        return NULL;
+    }
+}
+
+static json_value* _alloc_container_like(json_value *v, json_alloc_func alloc_func)
+{
+    /* an empty container with the item/value vector allocated at the exact 
+       size of v, see _copy_child */
+    json_value *copy;
+    json_object *object_copy;
+    json_array *array_copy;
+    unsigned int size;
+
+    if (!alloc_func)
+        alloc_func = json_default_alloc_func;
+
+    if (v->type == json_type_object) {
+        size = (unsigned int)((json_object*)v)->size;
+        copy = json_object_alloc(alloc_func);
+        if (!copy || !size)
+            return copy;
+        object_copy = (json_object*)copy;
+        object_copy->items = (_json_object_item*)alloc_func(
+            NULL, 0, sizeof(_json_object_item) * size);
+        if (!object_copy->items) {
+            json_free(copy);
+            return NULL;
+        }
+        object_copy->capacity = (int)size;
+
+    } else {
+        assert(v->type == json_type_array);
+        size = ((json_array*)v)->size;
+        copy = json_array_alloc(alloc_func);
+        if (!copy || !size)
+            return copy;
+        array_copy = (json_array*)copy;
+        array_copy->values = (json_value**)alloc_func(
+            NULL, 0, sizeof(json_value*) * size);
+        if (!array_copy->values) {
+            json_free(copy);
+            return NULL;
+        }
+        array_copy->capacity = size;
+    }
+
+    return copy;
+}
+
+static int _copy_child(json_value *copy, json_value *v, unsigned int index, json_value *child)
+{
+    /* Appends child to copy as the counterpart of the index-th child of v. 
+       The name hash and the sorted index are copied as is, nothing is rehashed 
+       or resorted. On failure child is not taken. */
+    json_object *object, *object_copy;
+    json_array *array_copy;
+    _json_object_item *item, *item_copy;
+
+    if (copy->type == json_type_object) {
+        object = (json_object*)v;
+        object_copy = (json_object*)copy;
+        assert(index == (unsigned int)object_copy->size && object_copy->size < object_copy->capacity);
+        item = object->items + index;
+        item_copy = object_copy->items + index;
+        *item_copy = *item;
+        item_copy->value = child;
+        if (item->name_len >= INLINE_NAME_CB) {
+            if (!_object_item_init(item->name.ptr, item->name_len, item->name_hash, 
+                    child, item_copy, copy->alloc_func))
+                return 0;
+            item_copy->sorted_index = item->sorted_index;
+        }
+        object_copy->size += 1;
+
+    } else {
+        array_copy = (json_array*)copy;
+        assert(index == array_copy->size && array_copy->size < array_copy->capacity);
+        array_copy->values[index] = child;
+        array_copy->size += 1;
+    }
+
+    return 1;
+}
+
+static json_value* _copy_container(json_value *v, json_alloc_func alloc_func)
+{
+    /* a structural copy with the children shared with v */
+    json_value *copy, *child;
+    unsigned int size, i;
+
+    if (!_READY(v))
+        return NULL;
+    if (v->flags & FLAG_TYPED)
+        return _copy_typed(v, alloc_func);
+
+    copy = _alloc_container_like(v, alloc_func);
+    if (!copy)
+        return NULL;
+
+    size = v->type == json_type_object ? (unsigned int)((json_object*)v)->size : ((json_array*)v)->size;
+    for (i = 0; i < size; ++i) {
+        if (v->type == json_type_object)
+            child = _share(((json_object*)v)->items[i].value);
+        else
+            child = _share(((json_array*)v)->values[i]);
+        if (!child || !_copy_child(copy, v, i, child)) {
+            json_free(child);
+            json_free(copy);
+            return NULL;
+        }
+    }
+
+    return copy;
+}
+
+static json_value* _shallow_copy(json_value *v)
+{
+    if (v->type == json_type_object || v->type == json_type_array)
+        return _copy_container(v, v->alloc_func);
+    else
+        return json_clone(v, v->alloc_func);
+}
+
+static void _free_node(json_value *v)
+{
+    /* free v alone, its children are already released */
+    json_string *string;
+    json_object *object;
+    json_array  *array;
+    _json_block *block;
+    int i;
+
+    if (v->flags & FLAG_BLOCK) {
+        /* all at once, with the root */
+        if (v->flags & FLAG_BLOCK_ROOT) {
+            block = (_json_block*)((char*)v - _BLOCK_ALIGN(sizeof(_json_block)));
+            v->alloc_func(block, block->size, 0);
+        }
+        return;
+    }
+    if (v->flags & FLAG_LAZY) {
+        /* the children were never made */
+        if (v->type == json_type_object) {
+            json_lazy_release(((json_object*)v)->items);
+            v->alloc_func(v, sizeof(json_object), 0);
+        } else {
+            json_lazy_release(((json_array*)v)->values);
+            v->alloc_func(v, sizeof(json_array), 0);
+        }
+        return;
+    }
+
+    switch (v->type)
+    {
+    case json_type_string:
+        string = (json_string*)v;
+        if (!(string->flags & FLAG_TRAILING))
+            v->alloc_func(string->str.ptr, string->str.capacity + 1, 0);
+        v->alloc_func(string, sizeof(json_string) + string->str.extra_cb, 0);
+        break;
+
+    case json_type_number:
+        v->alloc_func(v, sizeof(json_number), 0);
+        break;
+
+    case json_type_true:
+    case json_type_false:
+    case json_type_null:
+        v->alloc_func(v, sizeof(json_value), 0);
+        break;
+
+    case json_type_object:
+        object = (json_object*)v;
+        for (i = 0; i < object->size; ++i) {
+            if (object->items[i].name_len >= INLINE_NAME_CB)
+                v->alloc_func(object->items[i].name.ptr, object->items[i].name_len + 1, 0);
+        }
+        v->alloc_func(object->items, sizeof(_json_object_item) * object->capacity, 0);
+        v->alloc_func(object, sizeof(json_object), 0);
+        break;
+
+    case json_type_array:
+        array = (json_array*)v;
+        if (v->flags & FLAG_TYPED)
+            _typed_free(array);
+        else
+            v->alloc_func(array->values, sizeof(json_value*) * array->capacity, 0);
+        v->alloc_func(array, sizeof(json_array), 0);
+        break;
+
+    default:
+        assert(0);
+    }
+}
+
+static void _free_recursive(json_value *v)
+{
+    unsigned int i;
+
+    if (!_release(v))
+        return;
+    if (v->flags & (FLAG_BLOCK | FLAG_LAZY)) {
+        _free_node(v);
+        return;
+    }
+
+    if (v->type == json_type_object) {
+        for (i = 0; i < (unsigned int)((json_object*)v)->size; ++i)
+            _free_recursive(((json_object*)v)->items[i].value);
+    } else if (v->type == json_type_array && !(v->flags & FLAG_TYPED)) {
+        for (i = 0; i < ((json_array*)v)->size; ++i)
+            _free_recursive(((json_array*)v)->values[i]);
+    }
+    _free_node(v);
+}
+
+static int _walk_push(json_walker *w)
+{
+    json_walk_frame *stack, *frame;
+    unsigned int capacity;
+
+    if (w->top == w->capacity) {
+        capacity = w->capacity * 2;
+        if (w->stack == w->inline_stack) {
+            stack = (json_walk_frame*)w->alloc_func(NULL, 0, sizeof(json_walk_frame) * capacity);
+            if (stack)
+                memcpy(stack, w->inline_stack, sizeof(json_walk_frame) * w->top);
+        } else {
+            stack = (json_walk_frame*)w->alloc_func(w->stack, 
+                sizeof(json_walk_frame) * w->capacity, sizeof(json_walk_frame) * capacity);  /* realloc */
+        }
+        if (!stack)
+            return 0;
+        w->stack = stack;
+        w->capacity = capacity;
+    }
+
+    frame = w->stack + w->top++;
+    frame->value = w->value;
+    frame->name = w->name;
+    frame->name_len = w->name_len;
+    frame->index = w->index;
+    frame->next = 0;
+    frame->size = w->value->type == json_type_object ? 
+        (unsigned int)((json_object*)w->value)->size : ((json_array*)w->value)->size;
+    frame->data = NULL;
+    frame->built = NULL;
+    return 1;
+}
+
+static json_value* _walk_container(json_walk_frame *frame)
+{
+    /* the container whose children are walked, the children of a lazy one 
+       are built aside so that the walk leaves it as it is */
+    json_value *v = frame->value;
+
+    if (frame->built || !(v->flags & FLAG_LAZY))
+        return frame->built ? frame->built : v;
+    if (v->type == json_type_object)
+        frame->built = json_lazy_build(((json_object*)v)->items, (unsigned int)((json_object*)v)->capacity);
+    else
+        frame->built = json_lazy_build(((json_array*)v)->values, ((json_array*)v)->capacity);
+    return frame->built;
+}
+
+static void _walk_release(json_walk_frame *frame)
+{
+    if (frame->built) {
+        json_free(frame->built);
+        frame->built = NULL;
+    }
+}
+
+static size_t _compact_size(json_value *v)
+{
+    /* the bytes taken by v in a block, not counting its children */
+    json_object *object;
+    size_t size;
+    unsigned int len;
+    int i;
+
+    switch (v->type)
+    {
+    case json_type_string:
+        len = ((json_string*)v)->len;
+        if (len >= USHRT_MAX)
+            return _BLOCK_ALIGN(sizeof(json_string)) + _BLOCK_ALIGN(len + 1);
+        if (len < _json_string_builtin_string_cb)
+            return _BLOCK_ALIGN(sizeof(json_string));
+        return _BLOCK_ALIGN(sizeof(json_string) + len - _json_string_builtin_string_cb + 1);
+
+    case json_type_number:
+        return _BLOCK_ALIGN(sizeof(json_number));
+
+    case json_type_object:
+        object = (json_object*)v;
+        size = _BLOCK_ALIGN(sizeof(json_object)) + _BLOCK_ALIGN(sizeof(_json_object_item) * object->size);
+        for (i = 0; i < object->size; ++i) {
+            if (object->items[i].name_len >= INLINE_NAME_CB)
+                size += _BLOCK_ALIGN(object->items[i].name_len + 1);
+        }
+        return size;
+
+    case json_type_array:
+        len = ((json_array*)v)->size;
+        if ((v->flags & FLAG_TYPED) && len)  /* the vector, its table and all the nodes */
+            return _BLOCK_ALIGN(sizeof(json_array)) + _BLOCK_ALIGN(_TYPED_VECTOR_SIZE(len)) + 
+                _BLOCK_ALIGN(sizeof(json_value*) * len) + _BLOCK_ALIGN(sizeof(json_number) * len);
+        if (v->flags & FLAG_TYPED)
+            return _BLOCK_ALIGN(sizeof(json_array));
+        return _BLOCK_ALIGN(sizeof(json_array)) + _BLOCK_ALIGN(sizeof(json_value*) * ((json_array*)v)->size);
+
+    default:
+        return _BLOCK_ALIGN(sizeof(json_value));
+    }
+}
+
+static json_value* _compact_node(json_value *v, char **cursor, json_alloc_func alloc_func)
+{
+    /* place a frozen copy of v at the cursor, the values of the children are 
+       filled in later */
+    json_value *copy = (json_value*)*cursor;
+    json_string *string, *string_copy;
+    json_object *object, *object_copy;
+    json_array  *array, *array_copy;
+    _typed_vector *vector;
+    json_number *node;
+    const char *str;
+    char *name;
+    unsigned int len;
+    int i;
+
+    switch (v->type)
+    {
+    case json_type_string:
+        string = (json_string*)v;
+        string_copy = (json_string*)copy;
+        str = (string->flags & FLAG_TRAILING) ? string->trailing_str.str : string->str.ptr;
+        len = string->len;
+        string_copy->len = len;
+        if (len >= USHRT_MAX) {
+            string_copy->flags = 0;
+            string_copy->str.extra_cb = 0;
+            string_copy->str.capacity = len;
+            string_copy->str.ptr = *cursor + _BLOCK_ALIGN(sizeof(json_string));
+            memcpy(string_copy->str.ptr, str, len + 1);
+        } else {
+            string_copy->flags = FLAG_TRAILING;
+            string_copy->trailing_str.extra_cb = len < _json_string_builtin_string_cb ? 
+                0 : (unsigned short)(len - _json_string_builtin_string_cb + 1);
+            memcpy(string_copy->trailing_str.str, str, len + 1);
+        }
+        break;
+
+    case json_type_number:
+        ((json_number*)copy)->dbl = ((json_number*)v)->dbl;
+        copy->flags = 0;
+        break;
+
+    case json_type_object:
+        object = (json_object*)v;
+        object_copy = (json_object*)copy;
+        object_copy->capacity = object->size;
+        object_copy->size = object->size;
+        object_copy->hash = 0;
+        object_copy->items = object->size ? 
+            (_json_object_item*)(*cursor + _BLOCK_ALIGN(sizeof(json_object))) : NULL;
+        name = *cursor + _BLOCK_ALIGN(sizeof(json_object)) + _BLOCK_ALIGN(sizeof(_json_object_item) * object->size);
+        for (i = 0; i < object->size; ++i) {
+            /* the hash and the sorted index are kept as is */
+            object_copy->items[i] = object->items[i];
+            object_copy->items[i].value = NULL;
+            len = object->items[i].name_len;
+            if (len >= INLINE_NAME_CB) {
+                memcpy(name, object->items[i].name.ptr, len + 1);
+                object_copy->items[i].name.ptr = name;
+                name += _BLOCK_ALIGN(len + 1);
+            }
+        }
+        copy->flags = 0;
+        break;
+
+    case json_type_array:
+        array = (json_array*)v;
+        array_copy = (json_array*)copy;
+        array_copy->capacity = array->size;
+        array_copy->size = array->size;
+        array_copy->hash = 0;
+        array_copy->values = array->size ? 
+            (json_value**)(*cursor + _BLOCK_ALIGN(sizeof(json_array))) : NULL;
+        copy->flags = 0;
+        if ((array->flags & FLAG_TYPED) && array->size) {
+            /* stays typed, with all the nodes made in the block */
+            vector = (_typed_vector*)array_copy->values;
+            vector->nodes = (json_value**)((char*)vector + _BLOCK_ALIGN(_TYPED_VECTOR_SIZE(array->size)));
+            vector->nodes_size = array->size;
+            node = (json_number*)((char*)vector->nodes + _BLOCK_ALIGN(sizeof(json_value*) * array->size));
+            memcpy(vector->numbers, _typed_numbers(array), sizeof(double) * array->size);
+            for (i = 0; i < (int)array->size; ++i) {
+                node[i].alloc_func = alloc_func;
+                node[i].type = json_type_number;
+                node[i].flags = FLAG_BLOCK | FLAG_FROZEN;
+                node[i].refcount = 1;
+                node[i].dbl = vector->numbers[i];
+                vector->nodes[i] = (json_value*)(node + i);
+            }
+        }
+        if (array->flags & FLAG_TYPED)
+            copy->flags = FLAG_TYPED;
+        break;
+
+    default:
+        copy->flags = 0;
+        break;
+    }
+
+    copy->alloc_func = alloc_func;
+    copy->type = v->type;
+    copy->flags |= FLAG_BLOCK | FLAG_FROZEN;
+    copy->refcount = 1;
+
+    *cursor += _compact_size(v);
+    return copy;
+}
+
+static int _array_untype(json_array *array)
+{
+    /* replace the vector of a typed array with pointers to nodes, the nodes 
+       made so far are kept */
+    _typed_vector *vector = _TYPED_VECTOR(array);
+    json_value **values = NULL;
+    unsigned int i;
+
+    if (!(array->flags & FLAG_TYPED))
+        return 1;
+    assert(!(array->flags & FLAG_FROZEN));
+
+    if (array->size) {
+        values = (json_value**)array->alloc_func(NULL, 0, sizeof(json_value*) * array->size);
+        if (!values)
+            return 0;
+        for (i = 0; i < array->size; ++i) {
+            values[i] = _typed_node_at(array, i);
+            if (!values[i])
+                values[i] = json_number_alloc(vector->numbers[i], array->alloc_func);
+            if (!values[i]) {
+                while (i--) {
+                    if (!_typed_node_at(array, i))
+                        json_free(values[i]);
+                }
+                array->alloc_func(values, sizeof(json_value*) * array->size, 0);
+                return 0;
+            }
+        }
+    }
+    if (vector) {
+        if (vector->nodes)
+            array->alloc_func(vector->nodes, sizeof(json_value*) * vector->nodes_size, 0);
+        array->alloc_func(vector, _TYPED_VECTOR_SIZE(array->capacity), 0);
+    }
+
+    array->values = values;
+    array->capacity = array->size;
+    array->flags &= ~FLAG_TYPED;
+    return 1;
+}
+
+static int _typed_realloc(json_array *array, unsigned int capacity)
+{
+    /* the vector moves, the nodes in its table stay where they are */
+    _typed_vector *vector = _TYPED_VECTOR(array);
+    json_value **nodes;
+
+    assert(capacity >= array->size);
+
+    if (!capacity) {
+        _typed_free(array);
+        array->values = NULL;
+        array->capacity = 0;
+        return 1;
+    }
+
+    if (vector && vector->nodes && vector->nodes_size < capacity) {
+        nodes = (json_value**)array->alloc_func(vector->nodes, 
+            sizeof(json_value*) * vector->nodes_size, sizeof(json_value*) * capacity);  /* realloc */
+        if (!nodes)
+            return 0;
+        memset(nodes + vector->nodes_size, 0, sizeof(json_value*) * (capacity - vector->nodes_size));
+        vector->nodes = nodes;
+        vector->nodes_size = capacity;
+    }
+
+    vector = (_typed_vector*)array->alloc_func(vector, 
+        vector ? _TYPED_VECTOR_SIZE(array->capacity) : 0, _TYPED_VECTOR_SIZE(capacity));  /* realloc */
+    if (!vector)
+        return 0;
+    if (!array->values) {
+        vector->nodes = NULL;
+        vector->nodes_size = 0;
+    }
+    array->values = (json_value**)vector;
+    array->capacity = capacity;
+    return 1;
+}
+
+static int _typed_table(json_array *array)
+{
+    /* the node table, empty */
+    _typed_vector *vector = _TYPED_VECTOR(array);
+    json_value **nodes;
+
+    assert(vector && !vector->nodes);
+
+    nodes = (json_value**)array->alloc_func(NULL, 0, sizeof(json_value*) * array->capacity);
+    if (!nodes)
+        return 0;
+    memset(nodes, 0, sizeof(json_value*) * array->capacity);
+    vector->nodes = nodes;
+    vector->nodes_size = array->capacity;
+    return 1;
+}
+
+static void _typed_free(json_array *array)
+{
+    /* the vector and the table, the nodes are released like children */
+    _typed_vector *vector = _TYPED_VECTOR(array);
+    unsigned int i;
+
+    if (!vector)
+        return;
+    if (vector->nodes) {
+        for (i = 0; i < array->size; ++i)
+            json_free(vector->nodes[i]);
+        array->alloc_func(vector->nodes, sizeof(json_value*) * vector->nodes_size, 0);
+    }
+    array->alloc_func(vector, _TYPED_VECTOR_SIZE(array->capacity), 0);
+}
+
+static json_value* _typed_node_at(json_array *array, unsigned int index)
+{
+    /* the node of an element if it has one, read once: concurrent readers 
+       of a frozen array may be making it */
+    _typed_vector *vector = _TYPED_VECTOR(array);
+
+    if (!vector->nodes)
+        return NULL;
+    return *(json_value* volatile*)(vector->nodes + index);
+}
+
+static json_value* _typed_node(json_array *array, unsigned int index)
+{
+    /* the node of an element, made on first use and kept in the table; in a 
+       frozen array, which has its table from json_freeze on, it is frozen and 
+       published atomically, the readers that lose the race drop theirs */
+    _typed_vector *vector = _TYPED_VECTOR(array);
+    json_value *node = _typed_node_at(array, index);
+
+    if (node)
+        return node;
+    if (!vector->nodes && !_typed_table(array))
+        return NULL;
+
+    node = json_number_alloc(vector->numbers[index], array->alloc_func);
+    if (!node)
+        return NULL;
+    if (!(array->flags & FLAG_FROZEN)) {
+        vector->nodes[index] = node;
+        return node;
+    }
+    node->flags |= FLAG_FROZEN;
+    if (!_NODE_CAS(vector->nodes + index, (json_value*)NULL, node)) {
+        json_free(node);
+        node = _typed_node_at(array, index);
+    }
+    return node;
+}
+
+static json_value* _typed_item(json_array *array, unsigned int index, json_number *scratch)
+{
+    /* the node of an element, or scratch holding it when it has none */
+    json_value *node = _typed_node_at(array, index);
+
+    if (node)
+        return node;
+    scratch->alloc_func = array->alloc_func;
+    scratch->type = json_type_number;
+    scratch->flags = array->flags & FLAG_FROZEN;
+    scratch->refcount = 1;
+    scratch->dbl = _TYPED_VECTOR(array)->numbers[index];
+    return (json_value*)scratch;
+}
+
+static const double* _typed_numbers(json_array *array)
+{
+    /* the vector, brought up to date with the nodes that were changed; those 
+       of a frozen array can not change and were brought in by json_freeze */
+    _typed_vector *vector = _TYPED_VECTOR(array);
+    unsigned int i;
+
+    if (!vector)
+        return NULL;
+    if (vector->nodes && !(array->flags & FLAG_FROZEN)) {
+        for (i = 0; i < array->size; ++i) {
+            if (vector->nodes[i])
+                vector->numbers[i] = ((json_number*)vector->nodes[i])->dbl;
+        }
+    }
+    return vector->numbers;
+}
+
+static int _typed_set(json_array *array, unsigned int index, json_value *value)
+{
+    /* the number node value becomes the node of an element, or of a new one 
+       at the end; the node it replaces is released */
+    _typed_vector *vector;
+    json_value *old;
+
+    assert(value->type == json_type_number && index <= array->size);
+
+    if (index == array->size && !_typed_append(array, ((json_number*)value)->dbl))
+        return 0;
+    vector = _TYPED_VECTOR(array);
+    if (!vector->nodes && !_typed_table(array)) {
+        if (index == array->size - 1)
+            array->size -= 1;
+        return 0;
+    }
+
+    old = vector->nodes[index];
+    vector->nodes[index] = value;
+    vector->numbers[index] = ((json_number*)value)->dbl;
+    json_free(old);
+    return 1;
+}
+
+static int _typed_freeze(json_array *array)
+{
+    /* the vector is brought up to date and the nodes frozen, the table is 
+       made now so that readers only have to fill it in */
+    _typed_vector *vector = _TYPED_VECTOR(array);
+    unsigned int i;
+
+    if (!vector)
+        return 1;
+    _typed_numbers(array);
+    if (!vector->nodes)
+        return _typed_table(array);
+    for (i = 0; i < array->size; ++i) {
+        if (vector->nodes[i])
+            json_freeze(vector->nodes[i]);
+    }
+    return 1;
+}
+
+static int _typed_append(json_array *array, double dbl)
+{
+    _typed_vector *vector;
+
+    if (array->size == array->capacity && 
+        !_array_realloc(array, json_grow_capacity(array->alloc_func, array->capacity))) {
+        return 0;
+    }
+
+    vector = _TYPED_VECTOR(array);
+    vector->numbers[array->size] = dbl;
+    if (vector->nodes)
+        vector->nodes[array->size] = NULL;
+    array->size += 1;
+    return 1;
+}
+
+static json_value* _copy_typed(json_value *v, json_alloc_func alloc_func)
+{
+    /* the numbers only, the copy makes nodes of its own */
+    json_array *array = (json_array*)v, *copy;
+    json_value *res;
+
+    res = json_array_alloc(alloc_func);
+    if (!res)
+        return NULL;
+    copy = (json_array*)res;
+    res->flags |= FLAG_TYPED;
+    if (array->size && !_array_realloc(copy, array->size)) {
+        json_free(res);
+        return NULL;
+    }
+    if (array->size)
+        memcpy(_TYPED_VECTOR(copy)->numbers, _typed_numbers(array), sizeof(double) * array->size);
+    copy->size = array->size;
+    return res;
+}
+
+static uint64_t _hash_number(double dbl)
+{
+    /* json_hash of a number node */
+    uint64_t bits;
+
+    if (dbl == 0)
+        dbl = 0;  /* -0 == 0 */
+    memcpy(&bits, &dbl, sizeof(bits));
+    return _mix64(_mix64(bits ^ _get_hash_seed()[0]) ^ json_type_number);
+}
+
+static uint64_t _hash_scalar(json_value *v)
+{
+    /* json_hash of a node without children */
+    const uint64_t *seed = _get_hash_seed();
+    json_string *string;
+
+    switch (v->type)
+    {
+    case json_type_string:
+        string = (json_string*)v;
+        return _mix64(_siphash13(
+            (string->flags & FLAG_TRAILING) ? string->trailing_str.str : string->str.ptr, 
+            string->len, seed[0], seed[1]) ^ v->type);
+
+    case json_type_number:
+        return _hash_number(((json_number*)v)->dbl);
+
+    default:
+        return _mix64(seed[1] ^ v->type);
+    }
+}
+
+static int _hash_sums_grow(uint64_t **sums, uint64_t *inline_sums, unsigned int *capacity, json_alloc_func alloc_func)
+{
+    /* twice the room, *sums is left as it was on failure */
+    uint64_t *p;
+
+    if (*sums == inline_sums) {
+        p = (uint64_t*)alloc_func(NULL, 0, sizeof(uint64_t) * *capacity * 2);
+        if (p)
+            memcpy(p, inline_sums, sizeof(uint64_t) * *capacity);
+    } else {
+        p = (uint64_t*)alloc_func(*sums, sizeof(uint64_t) * *capacity, sizeof(uint64_t) * *capacity * 2);  /* realloc */
+    }
+    if (!p)
+        return 0;
+    *sums = p;
+    *capacity *= 2;
+    return 1;
+}
+
+static int _scalar_equal(json_value *a, json_value *b)
+{
+    if (a == b)
+        return 1;
+    if (a->type != b->type)
+        return 0;
+
+    switch (a->type)
+    {
+    case json_type_string:
+        return json_string_len(a) == json_string_len(b) && 
+            memcmp(json_string_get(a), json_string_get(b), json_string_len(a)) == 0;
+
+    case json_type_number:
+        return ((json_number*)a)->dbl == ((json_number*)b)->dbl;
+
+    default:
+        return 1;
+    }
+}
+
+static double _reduce(json_value *v, int op)
+{
+    /* op: 0 sum, -1 min, 1 max; four independent lanes so that the loops 
+       pipeline */
+    json_array *array = (json_array*)v;
+    const double *p;
+    double r0, r1, r2, r3, x;
+    unsigned int n, i;
+
+    assert(array);
+
+    if (v->type != json_type_array || !_READY(v))
+        return _NaN();
+    n = array->size;
+    if (!(v->flags & FLAG_TYPED)) {
+        for (i = 0; i < n; ++i) {
+            if (array->values[i]->type != json_type_number)
+                return _NaN();
+        }
+    }
+    if (!n)
+        return op ? _NaN() : 0;
+
+    if (!(v->flags & FLAG_TYPED)) {
+        r0 = op ? ((json_number*)array->values[0])->dbl : 0;
+        for (i = 0; i < n; ++i) {
+            x = ((json_number*)array->values[i])->dbl;
+            if (op == 0)
+                r0 += x;
+            else if (op < 0 ? x < r0 : x > r0)
+                r0 = x;
+        }
+        return r0;
+    }
+
+    p = _typed_numbers(array);
+    if (op == 0) {
+        r0 = r1 = r2 = r3 = 0;
+        for (i = 0; i + 4 <= n; i += 4) {
+            r0 += p[i];
+            r1 += p[i + 1];
+            r2 += p[i + 2];
+            r3 += p[i + 3];
+        }
+        for (; i < n; ++i)
+            r0 += p[i];
+        return (r0 + r1) + (r2 + r3);
+    }
+
+    r0 = r1 = r2 = r3 = p[0];
+    if (op < 0) {
+        for (i = 0; i + 4 <= n; i += 4) {
+            r0 = p[i] < r0 ? p[i] : r0;
+            r1 = p[i + 1] < r1 ? p[i + 1] : r1;
+            r2 = p[i + 2] < r2 ? p[i + 2] : r2;
+            r3 = p[i + 3] < r3 ? p[i + 3] : r3;
+        }
+        for (; i < n; ++i)
+            r0 = p[i] < r0 ? p[i] : r0;
+        r0 = r1 < r0 ? r1 : r0;
+        r2 = r3 < r2 ? r3 : r2;
+        return r2 < r0 ? r2 : r0;
+    }
+    for (i = 0; i + 4 <= n; i += 4) {
+        r0 = p[i] > r0 ? p[i] : r0;
+        r1 = p[i + 1] > r1 ? p[i + 1] : r1;
+        r2 = p[i + 2] > r2 ? p[i + 2] : r2;
+        r3 = p[i + 3] > r3 ? p[i + 3] : r3;
+    }
+    for (; i < n; ++i)
+        r0 = p[i] > r0 ? p[i] : r0;
+    r0 = r1 > r0 ? r1 : r0;
+    r2 = r3 > r2 ? r3 : r2;
+    return r2 > r0 ? r2 : r0;
+}
+
+static int _lazy_expand(json_value *v)
+{
+    /* build the children of a lazy container and take them over in place */
+    json_object *object, *full_object;
+    json_array *array, *full_array;
+    json_value *full;
+    void *doc;
+
+    assert(v->flags & FLAG_LAZY);
+
+    if (v->type == json_type_object) {
+        object = (json_object*)v;
+        doc = object->items;
+        full = json_lazy_build(doc, (unsigned int)object->capacity);
+        if (!full)
+            return 0;
+        full_object = (json_object*)full;
+        object->capacity = full_object->capacity;
+        object->items = full_object->items;
+        object->size = full_object->size;
+        full_object->capacity = 0;
+        full_object->items = NULL;
+        full_object->size = 0;
+    } else {
+        array = (json_array*)v;
+        doc = array->values;
+        full = json_lazy_build(doc, array->capacity);
+        if (!full)
+            return 0;
+        full_array = (json_array*)full;
+        array->capacity = full_array->capacity;
+        array->values = full_array->values;
+        array->size = full_array->size;
+        v->flags |= full->flags & FLAG_TYPED;
+        full->flags &= ~FLAG_TYPED;
+        full_array->capacity = 0;
+        full_array->values = NULL;
+        full_array->size = 0;
+    }
+
+    json_free(full);
+    v->flags &= ~FLAG_LAZY;
+    json_lazy_release(doc);
+    return 1;
 }
@@ -34,6 +34,7 @@
 #define _JSONKIT_JSON_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
 /*----------------------------------------------------------------------------*/
 
@@ -52,6 +53,11 @@ typedef enum json_value_type {
 } json_value_type;
 
 typedef void* (*json_alloc_func)(void *ptr, size_t osize, size_t nsize);
+void* json_pool_alloc_func(void *ptr, size_t osize, size_t nsize);  /* size classes and per-thread caches, osize must be exact */
+typedef unsigned int (*json_growth_func)(unsigned int capacity);  /* the next capacity of a full container */
+/* for containers made by alloc_func, NULL restores the default. The table is global and not locked: 
+   set it up before other threads use the library, and do not change it while they do */
+int   json_set_growth_func(json_alloc_func alloc_func, json_growth_func growth_func);
 
 struct json_value;
 typedef struct json_value json_value;
@@ -59,12 +65,18 @@ typedef struct json_value json_value;
 json_value_type json_type(json_value *v);
 json_alloc_func json_get_alloc_func(json_value *v);
 
+/* the mutators (json_*_set, erase, reserve, ...) return v, or NULL on failure: a value shared with another 
+   tree by json_clone_shared, or frozen, is left as it is and NULL returned */
 json_value*  json_string_alloc(const char *str, unsigned int len, json_alloc_func alloc_func);
 const char*  json_string_get(json_value *v);
 json_value*  json_string_set(json_value *v, const char *str, unsigned int len);
 unsigned int json_string_len(json_value *v);
 json_value*  json_string_resize(json_value *v, unsigned int len, char ch);
 json_value*  json_string_concat(json_value *v, const char *str, unsigned int len);
+json_value*  json_string_reserve(json_value *v, unsigned int capacity);  /* room for capacity characters */
+char*        json_string_spare(json_value *v, unsigned int *count);  /* count writable bytes past the end, NULL if v is shared */
+json_value*  json_string_commit(json_value *v, unsigned int count);  /* appends count bytes written at json_string_spare */
+json_value*  json_string_append_fmt(json_value *v, const char *fmt, ...);  /* printf-style concat, formatted in place: no argument may point into v */
 
 json_value*  json_number_alloc(double number, json_alloc_func alloc_func);
 double       json_number_get(json_value *v);
@@ -79,11 +91,25 @@ json_value*  json_null_alloc(json_alloc_func alloc_func);
 
 json_value*  json_object_alloc(json_alloc_func alloc_func);
 unsigned int json_object_size(json_value *v);
-const char*  json_object_name_by_index(json_value *v, unsigned int index);
+const char*  json_object_name_by_index(json_value *v, unsigned int index);  /* valid until the object is next changed, short names move with its items */
 json_value*  json_object_value_by_index(json_value *v, unsigned int index);
 json_value*  json_object_get(json_value *v, const char *name);
 json_value*  json_object_set(json_value *v, const char *name, json_value *value);
 json_value*  json_object_erase(json_value *v, const char *name);
+json_value*  json_object_reserve(json_value *v, unsigned int capacity);  /* room for capacity members */
+json_value*  json_object_take(json_value *v, const char *name, json_value **value);  /* erase without freeing, *value is then owned by the caller */
+
+/* a prehashed key, valid in the current process only */
+typedef struct json_key {
+    const char *name;
+    unsigned int len;
+    unsigned int hash;
+} json_key;
+
+json_key*    json_key_init(json_key *key, const char *name, unsigned int len);
+json_value*  json_object_get_key(json_value *v, const json_key *key);
+unsigned int json_object_get_many(json_value *v, const char **names, unsigned int n, json_value **values);  /* NULL for missing names, returns the number found */
+unsigned int json_object_get_many_keys(json_value *v, const json_key *keys, unsigned int n, json_value **values);
 
 json_value*  json_array_alloc(json_alloc_func alloc_func);
 unsigned int json_array_size(json_value *v);
@@ -91,8 +117,51 @@ json_value*  json_array_get(json_value *v, unsigned int index);
 json_value*  json_array_set(json_value *v, unsigned int index, json_value *value);
 #define      json_array_append(array, value)    json_array_set(array, json_array_size(array), value)
 json_value*  json_array_erase(json_value *v, unsigned int index);
+json_value*  json_array_reserve(json_value *v, unsigned int capacity);
+json_value*  json_array_take(json_value *v, unsigned int index, json_value **value);
+json_value*  json_array_splice(json_value *v, unsigned int index, unsigned int count, json_value *items, json_value **removed);  /* moves the values of items in, and the replaced ones out to *removed */
+#define      json_array_concat(array, items)    json_array_splice(array, json_array_size(array), 0, items, NULL)
+
+/* typed arrays keep their numbers in a flat vector of doubles, the parser makes one of every array 
+   holding numbers only; an element node is made when it is first asked for and never moves after */
+json_value*  json_array_alloc_doubles(const double *numbers, unsigned int count, json_alloc_func alloc_func);
+int          json_array_is_typed(json_value *v);
+const double* json_array_doubles(json_value *v);  /* the vector of a typed array, valid until it changes; NULL if not typed, and may be when empty */
+unsigned int json_array_get_doubles(json_value *v, unsigned int index, double *numbers, unsigned int count);  /* any array, returns the count copied */
+json_value*  json_array_pack(json_value *v);  /* makes an array of numbers typed, its nodes stay; NULL if there are others */
+double       json_array_sum(json_value *v);  /* NaN if an element is not a number */
+double       json_array_min(json_value *v);  /* NaN if empty too */
+double       json_array_max(json_value *v);
+
+/* iterates the members of an object or the elements of an array */
+typedef struct json_iter {
+    const char *name;       /* member name, NULL in arrays, as from json_object_name_by_index */
+    unsigned int name_len;
+    unsigned int hash;      /* member name hash as in json_key, 0 in arrays */
+    unsigned int index;
+    json_value *value;
+    /* private */
+    json_value *container;
+    unsigned int next, size;
+} json_iter;
+
+int          json_iter_begin(json_iter *it, json_value *v);  /* false if v is not an object or array */
+int          json_iter_next(json_iter *it);  /* false at the end, or with no memory for the node of a typed element; otherwise the fields are set */
 
 json_value*  json_clone(json_value *v, json_alloc_func alloc_func);
+/* copy on write: a container gets a handle of its own over shared children, O(its size), scalars are 
+   copied and frozen values shared. Change the shared children and the nodes below them with json_dotset */
+json_value*  json_clone_shared(json_value *v);
+json_value*  json_compact(json_value *v, json_alloc_func alloc_func);  /* a frozen copy in one memory block, freed at once */
+
+/* read-only from now on, safe for concurrent readers and for sharing across threads (refcounts are atomic); 
+   typed arrays stay typed, lazy containers are built first. NULL if out of memory */
+json_value*  json_freeze(json_value *v);
+int          json_is_frozen(json_value *v);
+void         json_shrink_to_fit(json_value *v);  /* frees the spare capacity of the whole tree, frozen parts aside */
+
+uint64_t     json_hash(json_value *v);  /* content hash, valid in the current process only, cached by json_freeze */
+int          json_equal(json_value *a, json_value *b);  /* deep, member order does not matter */
 
 void         json_free(json_value *v);
 
@@ -102,16 +171,170 @@ double       json_dotget_number(json_value *v, const char *dotname);
 int          json_dotget_boolean(json_value *v, const char *dotname);
 json_value*  json_dotget_object(json_value *v, const char *dotname);
 json_value*  json_dotget_array(json_value *v, const char *dotname);
-
+json_value*  json_dotset(json_value *v, const char *dotname, json_value *value);  /* copies shared nodes on the path, v itself must not be shared */
+
+
+/* pre/post-order traversal with an explicit stack, the tree must not change during the walk; 
+   the walk itself changes nothing: lazy containers are built aside, and an element of a typed array 
+   without a node is handed out from the walker, valid until the next step */
+typedef enum json_walk_event {
+    json_walk_error = -1,  /* no memory for the object or array in value, the rest of it is skipped */
+    json_walk_done = 0,
+    json_walk_enter,       /* an object or array, before its children */
+    json_walk_leave,       /* an object or array, after its children */
+    json_walk_scalar
+} json_walk_event;
+
+typedef struct json_walk_frame {
+    json_value *value;
+    const char *name;
+    unsigned int name_len;
+    unsigned int index;
+    unsigned int next, size;
+    void *data;
+    json_value *built;  /* the children of a lazy container, built for the walk */
+} json_walk_frame;
+
+#define JSON_WALK_INLINE_DEPTH 32
+
+typedef struct json_walker {
+    json_value *value;      /* the current value */
+    const char *name;       /* its member name, NULL in arrays and for the root */
+    unsigned int name_len;
+    unsigned int index;     /* its position in the parent */
+    unsigned int depth;     /* the root is 0 */
+    /* private */
+    json_value *root;
+    json_alloc_func alloc_func;
+    json_walk_frame *stack;
+    json_walk_frame *frame;  /* of the current container, NULL at a scalar or when entering it failed */
+    unsigned int top, capacity;
+    json_walk_frame inline_stack[JSON_WALK_INLINE_DEPTH];
+    struct {                /* the element of a typed array in value, unless it has a node of its own */
+        json_alloc_func alloc_func;
+        unsigned char type, flags;
+        unsigned short refcount;
+        double dbl;
+    } number;
+} json_walker;
+
+void            json_walk_begin(json_walker *w, json_value *root, json_alloc_func alloc_func);  /* alloc_func grows the stack */
+json_walk_event json_walk_next(json_walker *w);
+void            json_walk_skip(json_walker *w);  /* after json_walk_enter, no children and no json_walk_leave */
+void            json_walk_set_data(json_walker *w, void *data);  /* after json_walk_enter, attach data to the current value */
+void*           json_walk_data(json_walker *w);  /* at json_walk_enter, json_walk_leave or json_walk_error, data of the current value */
+json_value*     json_walk_container(json_walker *w);  /* at json_walk_enter, json_walk_leave or json_walk_error, value as walked, NULL if it can not be built */
+void*           json_walk_parent_data(json_walker *w);  /* data of the container of the current value */
+void            json_walk_end(json_walker *w);
+
+
+/* a compiled dotname, see json_dotget */
+struct json_path;
+typedef struct json_path json_path;
+
+json_path*   json_path_compile(const char *dotname, json_alloc_func alloc_func);
+json_value*  json_path_eval(json_value *v, const json_path *path);
+const char*  json_path_eval_string(json_value *v, const json_path *path);
+double       json_path_eval_number(json_value *v, const json_path *path);
+int          json_path_eval_boolean(json_value *v, const json_path *path);
+json_value*  json_path_eval_object(json_value *v, const json_path *path);
+json_value*  json_path_eval_array(json_value *v, const json_path *path);
+void         json_path_free(json_path *path);
+
+/* columns for json_columnarize */
+typedef enum json_column_type {
+    json_column_double = 1,  /* data is a double[rows] */
+    json_column_int64,       /* int64_t[rows], integral numbers only */
+    json_column_string,      /* json_slice[rows], pointing into the tree */
+    json_column_boolean      /* unsigned char[rows] */
+} json_column_type;
+
+typedef struct json_slice {
+    const char *str;
+    unsigned int len;
+} json_slice;
+
+typedef struct json_column {
+    const char *path;        /* a dotname in each object, see json_dotget */
+    json_column_type type;
+    void *data;
+    unsigned char *valid;    /* a bit per row, set if the field is there with the type, may be NULL */
+} json_column;
+
+unsigned int json_columnarize(json_value *array, json_column *columns, unsigned int n);  /* one pass over an array of objects, returns the rows or (unsigned int)-1 */
+
+
+/* a compiled JSONPath expression, see json_query.c for the supported subset */
+struct json_query;
+typedef struct json_query json_query;
+
+json_query*  json_query_compile(const char *expr, json_alloc_func alloc_func);
+unsigned int json_query_eval(const json_query *query, json_value *v, json_value **results, unsigned int capacity);  /* returns the number of matches */
+void         json_query_free(json_query *query);
+
+/* evaluates a query while scanning the text without building a DOM, the steps after a negative 
+   index or a filter scan that array or candidate again, a negative index in an @ path parses it */
+typedef struct json_query_stream_config {
+    json_alloc_func alloc_func;
+    int materialize;  /* also parse each match into a json_value, owned by the callback */
+    int depth;        /* maximum nesting */
+    void *ctx;
+    int (*match)(void *ctx, const char *str, size_t len, json_value *value);  /* return false to stop */
+} json_query_stream_config;
+
+int          json_query_stream(const json_query *query, const char *json, size_t len, json_query_stream_config config);  /* returns the number of matches or -1 */
+
+
+/* RFC 6902 JSON Patch, json_diff copies the values of b, applying copies those of the patch into doc */
+json_value*  json_diff(json_value *a, json_value *b, json_alloc_func alloc_func);  /* a patch that turns a into b, equal subtrees are skipped unwalked only when shared or both frozen */
+json_value*  json_patch_apply(json_value *doc, json_value *patch);  /* takes doc over, NULL and doc freed if an operation fails */
+json_value*  json_merge_patch(json_value *target, json_value *patch);  /* RFC 7386, takes both over */
+
+
+/* a tree written with offsets instead of pointers, read in place from a mapped file */
+struct json_snapshot;
+typedef struct json_snapshot json_snapshot;
+struct json_snode;
+typedef struct json_snode json_snode;  /* a value in a snapshot, valid until it is closed */
+
+int              json_snapshot_write(json_value *v, const char *path, json_alloc_func alloc_func);  /* false on failure */
+json_snapshot*   json_snapshot_open(const char *path, json_alloc_func alloc_func);  /* NULL if it is not a snapshot of this byte order or it is damaged, every node is checked */
+const json_snode* json_snapshot_root(const json_snapshot *snapshot);
+void             json_snapshot_close(json_snapshot *snapshot);
+
+json_value_type  json_snode_type(const json_snode *n);
+const char*      json_snode_string_get(const json_snode *n);
+unsigned int     json_snode_string_len(const json_snode *n);
+double           json_snode_number_get(const json_snode *n);
+int              json_snode_boolean_get(const json_snode *n);
+unsigned int     json_snode_size(const json_snode *n);  /* members of an object or elements of an array */
+const char*      json_snode_name_by_index(const json_snode *n, unsigned int index);
+const json_snode* json_snode_value_by_index(const json_snode *n, unsigned int index);  /* objects and arrays */
+const json_snode* json_snode_object_get(const json_snode *n, const char *name);  /* hashed, O(1) */
+const json_snode* json_snode_array_get(const json_snode *n, unsigned int index);
+const json_snode* json_snode_dotget(const json_snode *n, const char *dotname);  /* see json_dotget */
+
+typedef int (*json_write_func)(void *ctx, const char *buf, int len);  /* returns len on success */
 
 typedef struct json_write_config {
     int compact;    /* compact mode */
     int indent;     /* indent levels(number of spaces) */
     int crlf;       /* \r\n or \n */
-    int (*write)(const char *buf, int len);
+    json_write_func write;
+    void *ctx;      /* passed to write */
 } json_write_config;
 
-int json_write(json_value *v, json_write_config config);
+int    json_write(json_value *v, json_write_config config);
+/* the functions below ignore config.write and config.ctx, and return 0 on failure */
+size_t json_write_to_buffer(json_value *v, json_write_config config, char *out, size_t cap);  /* no copy through the staging buffer; returns the full length, only the first cap bytes are stored */
+char*  json_write_alloc(json_value *v, json_write_config config, size_t *len, json_alloc_func alloc_func);  /* NUL terminated, free with alloc_func(p, *len + 1, 0), or free() for NULL */
+size_t json_write_measure(json_value *v, json_write_config config);  /* the exact length, nothing is written */
+
+/* MessagePack and CBOR, write is called like json_write_config.write */
+int          json_msgpack_write(json_value *v, json_write_func write, void *ctx);  /* returns the bytes written, 0 on failure */
+json_value*  json_msgpack_read(const char *data, size_t len, int depth, json_alloc_func alloc_func);  /* exactly one value, NULL if malformed */
+int          json_cbor_write(json_value *v, json_write_func write, void *ctx);
+json_value*  json_cbor_read(const char *data, size_t len, int depth, json_alloc_func alloc_func);
 
 
 struct json_parser;
@@ -126,8 +349,24 @@ typedef struct json_parser_config {
 json_parser* json_parser_alloc(int depth, json_parser_config config);
 int          json_parser_char(json_parser *parser, int next_char);
 json_value*  json_parser_done(json_parser *parser);
+int          json_parser_complete(json_parser *parser);
 void         json_parser_free(json_parser *parser);
 
+/* event mode, offsets count from the first character and a false return stops the parser */
+typedef struct json_parser_events {
+    void *ctx;
+    int (*begin)(void *ctx, json_value_type type, size_t index);               /* '{' or '[' */
+    int (*end)(void *ctx, json_value_type type, size_t index, size_t len);     /* the whole object or array */
+    int (*key)(void *ctx, size_t index, size_t len);                           /* a member name, without quotes */
+    int (*scalar)(void *ctx, json_value_type type, size_t index, size_t len);  /* strings with quotes */
+} json_parser_events;
+
+json_parser* json_parser_alloc_events(int depth, const json_parser_events *events);
+
+/* lazy mode, the text is validated up front and containers are built from it on first access, 
+   so even reads change the document: use it from one thread at a time until it is fully built */
+json_value*  json_parse_lazy(const char *json_str, size_t len, int depth, json_alloc_func alloc_func);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,783 @@
+/*
+ jsonkit ( https://github.com/zhuyie/jsonkit )
+
+ Copyright (c) 2014, zhuyie
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "json.h"
+#include <string.h>
+#include <assert.h>
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ MessagePack and CBOR. Numbers are written as integers when they are 
+ integral and fit in 64 bits, otherwise as single floats when that is 
+ exact, otherwise as doubles. Lengths are always definite on output.
+
+ The readers also take binary strings as strings and skip CBOR tags; CBOR 
+ arrays and maps may be indefinite, CBOR strings may not. Extension types, 
+ non-string keys and trailing bytes are errors.
+*/
+
+#define BUF_LEN 4096
+
+typedef struct _binary_writer {
+    json_write_func write;
+    void *ctx;
+    int cbor;
+    int written;
+    unsigned int buf_size;
+    unsigned char buf[BUF_LEN];
+} _binary_writer;
+
+/* one head decoded */
+typedef struct _binary_item {
+    int type;         /* a json_value_type, 0 for a CBOR break */
+    double number;
+    const char *str;
+    uint64_t size;    /* string length, element or member count, INDEFINITE */
+} _binary_item;
+
+#define INDEFINITE  ((uint64_t)-1)
+
+typedef struct _binary_frame {
+    json_value *container;
+    uint64_t remaining;  /* elements or members still to come */
+    const char *name;    /* the member name just read, NULL before it */
+    unsigned int name_len;
+} _binary_frame;
+
+typedef struct _binary_reader {
+    const unsigned char *p, *end;
+    json_alloc_func alloc_func;
+    int (*next_item)(struct _binary_reader *r, _binary_item *item);
+    _binary_frame *stack;
+    int depth, top;
+} _binary_reader;
+
+extern void* json_default_alloc_func(
+    void *ptr, 
+    size_t osize, 
+    size_t nsize
+    );
+extern json_value* json_object_set_len(
+    json_value *v, 
+    const char *name, 
+    unsigned int len, 
+    json_value *value
+    );
+extern json_value* json_array_append_number(
+    json_value *v, 
+    double dbl
+    );
+static int _binary_write(
+    json_value *v, 
+    json_write_func write, 
+    void *ctx, 
+    int cbor
+    );
+static int _write_value(
+    _binary_writer *writer, 
+    json_value *v
+    );
+static int _write_length(
+    _binary_writer *writer, 
+    json_value_type type, 
+    uint64_t n
+    );
+static int _write_number(
+    _binary_writer *writer, 
+    double dbl
+    );
+static int _put(
+    _binary_writer *writer, 
+    unsigned char byte, 
+    uint64_t value, 
+    int count
+    );
+static int _write_bytes(
+    _binary_writer *writer, 
+    const void *data, 
+    unsigned int len
+    );
+static int _flush(
+    _binary_writer *writer
+    );
+static json_value* _binary_read(
+    const char *data, 
+    size_t len, 
+    int depth, 
+    json_alloc_func alloc_func, 
+    int (*next_item)(_binary_reader *r, _binary_item *item)
+    );
+static json_value* _read_tree(
+    _binary_reader *r
+    );
+static int _msgpack_item(
+    _binary_reader *r, 
+    _binary_item *item
+    );
+static int _cbor_item(
+    _binary_reader *r, 
+    _binary_item *item
+    );
+static int _get(
+    _binary_reader *r, 
+    int count, 
+    uint64_t *value
+    );
+static int _get_string(
+    _binary_reader *r, 
+    uint64_t len, 
+    _binary_item *item
+    );
+static double _float_bits(
+    uint32_t bits
+    );
+static double _half_bits(
+    uint32_t bits
+    );
+
+/*----------------------------------------------------------------------------*/
+
+int json_msgpack_write(json_value *v, json_write_func write, void *ctx)
+{
+    return _binary_write(v, write, ctx, 0);
+}
+
+json_value* json_msgpack_read(const char *data, size_t len, int depth, json_alloc_func alloc_func)
+{
+    return _binary_read(data, len, depth, alloc_func, _msgpack_item);
+}
+
+int json_cbor_write(json_value *v, json_write_func write, void *ctx)
+{
+    return _binary_write(v, write, ctx, 1);
+}
+
+json_value* json_cbor_read(const char *data, size_t len, int depth, json_alloc_func alloc_func)
+{
+    return _binary_read(data, len, depth, alloc_func, _cbor_item);
+}
+
+/*----------------------------------------------------------------------------*/
+
+static int _binary_write(json_value *v, json_write_func write, void *ctx, int cbor)
+{
+    _binary_writer writer;
+    json_walker w;
+    json_walk_event event;
+    json_value *container;
+    int res = 1;
+
+    assert(v);
+    assert(write);
+
+    writer.write = write;
+    writer.ctx = ctx;
+    writer.cbor = cbor;
+    writer.written = 0;
+    writer.buf_size = 0;
+
+    json_walk_begin(&w, v, json_get_alloc_func(v));
+    while (res && (event = json_walk_next(&w)) != json_walk_done) {
+        if (event == json_walk_error) {
+            res = 0;
+        } else if (event != json_walk_leave) {  /* lengths are known up front */
+            if (w.name) {
+                res = _write_length(&writer, json_type_string, w.name_len) && 
+                      _write_bytes(&writer, w.name, w.name_len);
+            }
+            container = event == json_walk_enter ? json_walk_container(&w) : w.value;
+            res = res && container && _write_value(&writer, container);
+        }
+    }
+    json_walk_end(&w);
+
+    if (!res || !_flush(&writer))
+        return 0;
+    return writer.written;
+}
+
+static int _write_value(_binary_writer *writer, json_value *v)
+{
+    unsigned int len;
+
+    switch (json_type(v))
+    {
+    case json_type_string:
+        len = json_string_len(v);
+        return _write_length(writer, json_type_string, len) && 
+               _write_bytes(writer, json_string_get(v), len);
+
+    case json_type_number:
+        return _write_number(writer, json_number_get(v));
+
+    case json_type_true:
+        return _put(writer, writer->cbor ? 0xf5 : 0xc3, 0, 0);
+
+    case json_type_false:
+        return _put(writer, writer->cbor ? 0xf4 : 0xc2, 0, 0);
+
+    case json_type_null:
+        return _put(writer, writer->cbor ? 0xf6 : 0xc0, 0, 0);
+
+    case json_type_object:
+        return _write_length(writer, json_type_object, json_object_size(v));
+
+    case json_type_array:
+        return _write_length(writer, json_type_array, json_array_size(v));
+    }
+
+    return 0;
+}
+
+static int _write_length(_binary_writer *writer, json_value_type type, uint64_t n)
+{
+    /* the head of a string, array or map */
+    unsigned char major;
+
+    if (writer->cbor) {
+        major = type == json_type_string ? 0x60 : type == json_type_array ? 0x80 : 0xa0;
+        if (n < 24)
+            return _put(writer, (unsigned char)(major | n), 0, 0);
+        else if (n < 0x100)
+            return _put(writer, major | 24, n, 1);
+        else if (n < 0x10000)
+            return _put(writer, major | 25, n, 2);
+        else
+            return _put(writer, major | 26, n, 4);
+    }
+
+    switch (type)
+    {
+    case json_type_string:
+        if (n < 32)
+            return _put(writer, (unsigned char)(0xa0 | n), 0, 0);
+        else if (n < 0x100)
+            return _put(writer, 0xd9, n, 1);
+        else if (n < 0x10000)
+            return _put(writer, 0xda, n, 2);
+        else
+            return _put(writer, 0xdb, n, 4);
+
+    case json_type_array:
+        if (n < 16)
+            return _put(writer, (unsigned char)(0x90 | n), 0, 0);
+        else if (n < 0x10000)
+            return _put(writer, 0xdc, n, 2);
+        else
+            return _put(writer, 0xdd, n, 4);
+
+    default:
+        if (n < 16)
+            return _put(writer, (unsigned char)(0x80 | n), 0, 0);
+        else if (n < 0x10000)
+            return _put(writer, 0xde, n, 2);
+        else
+            return _put(writer, 0xdf, n, 4);
+    }
+}
+
+static int _write_number(_binary_writer *writer, double dbl)
+{
+    uint64_t u, bits;
+    int64_t i;
+    uint32_t bits32;
+    float flt;
+
+    if (dbl >= 0 && dbl < 18446744073709551616.0 && (double)(u = (uint64_t)dbl) == dbl) {
+        if (writer->cbor) {
+            if (u < 24)
+                return _put(writer, (unsigned char)u, 0, 0);
+            return u < 0x100 ? _put(writer, 24, u, 1) : 
+                   u < 0x10000 ? _put(writer, 25, u, 2) : 
+                   u < 0x100000000ULL ? _put(writer, 26, u, 4) : _put(writer, 27, u, 8);
+        }
+        if (u < 0x80)
+            return _put(writer, (unsigned char)u, 0, 0);
+        return u < 0x100 ? _put(writer, 0xcc, u, 1) : 
+               u < 0x10000 ? _put(writer, 0xcd, u, 2) : 
+               u < 0x100000000ULL ? _put(writer, 0xce, u, 4) : _put(writer, 0xcf, u, 8);
+    }
+
+    if (dbl < 0 && dbl >= -9223372036854775808.0 && (double)(i = (int64_t)dbl) == dbl) {
+        if (writer->cbor) {
+            u = (uint64_t)(-1 - i);
+            if (u < 24)
+                return _put(writer, (unsigned char)(0x20 | u), 0, 0);
+            return u < 0x100 ? _put(writer, 0x38, u, 1) : 
+                   u < 0x10000 ? _put(writer, 0x39, u, 2) : 
+                   u < 0x100000000ULL ? _put(writer, 0x3a, u, 4) : _put(writer, 0x3b, u, 8);
+        }
+        if (i >= -32)
+            return _put(writer, (unsigned char)(i & 0xff), 0, 0);
+        return i >= -128 ? _put(writer, 0xd0, (uint64_t)i, 1) : 
+               i >= -32768 ? _put(writer, 0xd1, (uint64_t)i, 2) : 
+               i >= -2147483647 - 1 ? _put(writer, 0xd2, (uint64_t)i, 4) : _put(writer, 0xd3, (uint64_t)i, 8);
+    }
+
+    flt = (float)dbl;
+    if ((double)flt == dbl) {
+        memcpy(&bits32, &flt, 4);
+        return _put(writer, writer->cbor ? 0xfa : 0xca, bits32, 4);
+    }
+    memcpy(&bits, &dbl, 8);
+    return _put(writer, writer->cbor ? 0xfb : 0xcb, bits, 8);
+}
+
+static int _put(_binary_writer *writer, unsigned char byte, uint64_t value, int count)
+{
+    /* a byte followed by the low count bytes of value, big-endian */
+    unsigned char buf[9];
+    int i;
+
+    buf[0] = byte;
+    for (i = count; i > 0; --i) {
+        buf[i] = (unsigned char)(value & 0xff);
+        value >>= 8;
+    }
+    return _write_bytes(writer, buf, count + 1);
+}
+
+static int _write_bytes(_binary_writer *writer, const void *data, unsigned int len)
+{
+    const unsigned char *p = (const unsigned char*)data;
+    unsigned int n;
+
+    while (len) {
+        n = BUF_LEN - writer->buf_size;
+        if (!n) {
+            if (writer->write(writer->ctx, (const char*)writer->buf, BUF_LEN) != BUF_LEN)
+                return 0;
+            writer->buf_size = 0;
+            n = BUF_LEN;
+        }
+        if (n > len)
+            n = len;
+
+        memcpy(writer->buf + writer->buf_size, p, n);
+        p += n;
+        len -= n;
+        writer->buf_size += n;
+        writer->written += n;
+    }
+
+    return 1;
+}
+
+static int _flush(_binary_writer *writer)
+{
+    if (writer->buf_size) {
+        if (writer->write(writer->ctx, (const char*)writer->buf, writer->buf_size) != (int)writer->buf_size)
+            return 0;
+        writer->buf_size = 0;
+    }
+    return 1;
+}
+
+static json_value* _binary_read(
+    const char *data, 
+    size_t len, 
+    int depth, 
+    json_alloc_func alloc_func, 
+    int (*next_item)(_binary_reader *r, _binary_item *item)
+    )
+{
+    _binary_reader r;
+    json_value *v;
+
+    assert(data);
+
+    if (depth <= 0)
+        return NULL;
+    if (!alloc_func)
+        alloc_func = json_default_alloc_func;
+
+    r.stack = (_binary_frame*)alloc_func(NULL, 0, sizeof(_binary_frame) * depth);
+    if (!r.stack)
+        return NULL;
+    r.p = (const unsigned char*)data;
+    r.end = r.p + len;
+    r.alloc_func = alloc_func;
+    r.next_item = next_item;
+    r.depth = depth;
+    r.top = 0;
+
+    v = _read_tree(&r);
+
+    alloc_func(r.stack, sizeof(_binary_frame) * depth, 0);
+    return v;
+}
+
+static json_value* _read_tree(_binary_reader *r)
+{
+    _binary_item item;
+    _binary_frame *frame;
+    json_value *root = NULL, *v, *res;
+
+    do {
+        frame = r->top ? r->stack + r->top - 1 : NULL;
+        if (frame && frame->remaining == 0) {
+            r->top -= 1;
+            continue;
+        }
+
+        if (!r->next_item(r, &item))
+            goto failed;
+
+        if (!item.type) {
+            /* a CBOR break, allowed between the members of an indefinite container */
+            if (!frame || frame->remaining != INDEFINITE || frame->name)
+                goto failed;
+            frame->remaining = 0;
+            continue;
+        }
+
+        if (frame && json_type(frame->container) == json_type_object && !frame->name) {
+            if (item.type != json_type_string || !item.size)
+                goto failed;  /* objects take no empty names, as with the text parser */
+            frame->name = item.str;
+            frame->name_len = (unsigned int)item.size;
+            continue;
+        }
+
+        if (item.type == json_type_number && frame && json_type(frame->container) == json_type_array) {
+            /* no node, see json_array_append_number */
+            if (!json_array_append_number(frame->container, item.number))
+                goto failed;
+            if (frame->remaining != INDEFINITE)
+                frame->remaining -= 1;
+            continue;
+        }
+
+        switch (item.type)
+        {
+        case json_type_string:
+            v = json_string_alloc(item.str, (unsigned int)item.size, r->alloc_func);
+            break;
+        case json_type_number:
+            v = json_number_alloc(item.number, r->alloc_func);
+            break;
+        case json_type_true:
+        case json_type_false:
+            v = json_boolean_alloc(item.type == json_type_true, r->alloc_func);
+            break;
+        case json_type_null:
+            v = json_null_alloc(r->alloc_func);
+            break;
+        case json_type_object:
+            v = json_object_alloc(r->alloc_func);
+            break;
+        default:
+            v = json_array_alloc(r->alloc_func);
+            break;
+        }
+        if (!v)
+            goto failed;
+
+        /* attached right away, so freeing the root releases everything */
+        if (!frame) {
+            root = v;
+        } else {
+            if (json_type(frame->container) == json_type_object)
+                res = json_object_set_len(frame->container, frame->name, frame->name_len, v);
+            else
+                res = json_array_set(frame->container, json_array_size(frame->container), v);
+            if (!res) {
+                json_free(v);
+                goto failed;
+            }
+            frame->name = NULL;
+            if (frame->remaining != INDEFINITE)
+                frame->remaining -= 1;
+        }
+
+        if ((item.type == json_type_object || item.type == json_type_array) && item.size) {
+            if (r->top == r->depth)
+                goto failed;
+            frame = r->stack + r->top++;
+            frame->container = v;
+            frame->remaining = item.size;
+            frame->name = NULL;
+        }
+    } while (r->top);
+
+    if (r->p != r->end)
+        goto failed;
+    return root;
+
+failed:
+    if (root)
+        json_free(root);
+    return NULL;
+}
+
+static int _msgpack_item(_binary_reader *r, _binary_item *item)
+{
+    uint64_t n;
+    unsigned char b;
+
+    if (r->p == r->end)
+        return 0;
+    b = *r->p++;
+
+    if (b <= 0x7f) {
+        item->type = json_type_number;
+        item->number = b;
+        return 1;
+    } else if (b <= 0x8f) {
+        item->type = json_type_object;
+        item->size = b & 0x0f;
+        return 1;
+    } else if (b <= 0x9f) {
+        item->type = json_type_array;
+        item->size = b & 0x0f;
+        return 1;
+    } else if (b <= 0xbf) {
+        return _get_string(r, b & 0x1f, item);
+    } else if (b >= 0xe0) {
+        item->type = json_type_number;
+        item->number = (signed char)b;
+        return 1;
+    }
+
+    switch (b)
+    {
+    case 0xc0:
+        item->type = json_type_null;
+        return 1;
+    case 0xc2:
+        item->type = json_type_false;
+        return 1;
+    case 0xc3:
+        item->type = json_type_true;
+        return 1;
+
+    case 0xc4: case 0xd9:
+        return _get(r, 1, &n) && _get_string(r, n, item);
+    case 0xc5: case 0xda:
+        return _get(r, 2, &n) && _get_string(r, n, item);
+    case 0xc6: case 0xdb:
+        return _get(r, 4, &n) && _get_string(r, n, item);
+
+    case 0xca:
+        if (!_get(r, 4, &n))
+            return 0;
+        item->type = json_type_number;
+        item->number = _float_bits((uint32_t)n);
+        return 1;
+    case 0xcb:
+        if (!_get(r, 8, &n))
+            return 0;
+        item->type = json_type_number;
+        memcpy(&item->number, &n, 8);
+        return 1;
+
+    case 0xcc: case 0xcd: case 0xce: case 0xcf:
+        if (!_get(r, 1 << (b - 0xcc), &n))
+            return 0;
+        item->type = json_type_number;
+        item->number = (double)n;
+        return 1;
+
+    case 0xd0:
+        if (!_get(r, 1, &n))
+            return 0;
+        item->type = json_type_number;
+        item->number = (signed char)n;
+        return 1;
+    case 0xd1:
+        if (!_get(r, 2, &n))
+            return 0;
+        item->type = json_type_number;
+        item->number = (short)n;
+        return 1;
+    case 0xd2:
+        if (!_get(r, 4, &n))
+            return 0;
+        item->type = json_type_number;
+        item->number = (int32_t)n;
+        return 1;
+    case 0xd3:
+        if (!_get(r, 8, &n))
+            return 0;
+        item->type = json_type_number;
+        item->number = (double)(int64_t)n;
+        return 1;
+
+    case 0xdc: case 0xdd:
+        if (!_get(r, b == 0xdc ? 2 : 4, &n))
+            return 0;
+        item->type = json_type_array;
+        item->size = n;
+        return n <= (uint64_t)(r->end - r->p);
+    case 0xde: case 0xdf:
+        if (!_get(r, b == 0xde ? 2 : 4, &n))
+            return 0;
+        item->type = json_type_object;
+        item->size = n;
+        return n <= (uint64_t)(r->end - r->p) / 2;
+    }
+
+    return 0;  /* 0xc1 and the extension types */
+}
+
+static int _cbor_item(_binary_reader *r, _binary_item *item)
+{
+    uint64_t n;
+    unsigned char b, major, info;
+
+    for (;;) {
+        if (r->p == r->end)
+            return 0;
+        b = *r->p++;
+        major = b >> 5;
+        info = b & 0x1f;
+
+        if (major == 7) {
+            switch (info)
+            {
+            case 20:
+                item->type = json_type_false;
+                return 1;
+            case 21:
+                item->type = json_type_true;
+                return 1;
+            case 22: case 23:  /* null and undefined */
+                item->type = json_type_null;
+                return 1;
+            case 25:
+                if (!_get(r, 2, &n))
+                    return 0;
+                item->type = json_type_number;
+                item->number = _half_bits((uint32_t)n);
+                return 1;
+            case 26:
+                if (!_get(r, 4, &n))
+                    return 0;
+                item->type = json_type_number;
+                item->number = _float_bits((uint32_t)n);
+                return 1;
+            case 27:
+                if (!_get(r, 8, &n))
+                    return 0;
+                item->type = json_type_number;
+                memcpy(&item->number, &n, 8);
+                return 1;
+            case 31:
+                item->type = 0;
+                return 1;
+            }
+            return 0;
+        }
+
+        if (info < 24)
+            n = info;
+        else if (info <= 27) {
+            if (!_get(r, 1 << (info - 24), &n))
+                return 0;
+        } else if (info == 31 && (major == 4 || major == 5))
+            n = INDEFINITE;
+        else
+            return 0;
+
+        switch (major)
+        {
+        case 0:
+            item->type = json_type_number;
+            item->number = (double)n;
+            return 1;
+        case 1:
+            item->type = json_type_number;
+            item->number = -1.0 - (double)n;
+            return 1;
+        case 2: case 3:
+            return _get_string(r, n, item);
+        case 4:
+            item->type = json_type_array;
+            item->size = n;
+            return n == INDEFINITE || n <= (uint64_t)(r->end - r->p);
+        case 5:
+            item->type = json_type_object;
+            item->size = n;
+            return n == INDEFINITE || n <= (uint64_t)(r->end - r->p) / 2;
+        }
+        /* major 6, a tag, the tagged item follows */
+    }
+}
+
+static int _get(_binary_reader *r, int count, uint64_t *value)
+{
+    /* count bytes, big-endian */
+    uint64_t n = 0;
+    int i;
+
+    if ((size_t)(r->end - r->p) < (size_t)count)
+        return 0;
+    for (i = 0; i < count; ++i)
+        n = (n << 8) | r->p[i];
+    r->p += count;
+    *value = n;
+    return 1;
+}
+
+static int _get_string(_binary_reader *r, uint64_t len, _binary_item *item)
+{
+    if (len > (uint64_t)(r->end - r->p) || len >= (unsigned int)-1)
+        return 0;
+    item->type = json_type_string;
+    item->str = (const char*)r->p;
+    item->size = len;
+    r->p += len;
+    return 1;
+}
+
+static double _float_bits(uint32_t bits)
+{
+    float flt;
+    memcpy(&flt, &bits, 4);
+    return flt;
+}
+
+static double _half_bits(uint32_t bits)
+{
+    /* IEEE 754 half precision, widened through the single precision layout */
+    uint32_t sign = (bits & 0x8000) << 16, exp = (bits >> 10) & 0x1f, mant = bits & 0x3ff;
+    double dbl;
+
+    if (exp == 0) {
+        dbl = mant / 16777216.0;  /* subnormal, mant * 2^-24 */
+        return sign ? -dbl : dbl;
+    }
+    if (exp == 31)
+        return _float_bits(sign | 0x7f800000 | (mant << 13));
+    return _float_bits(sign | ((exp + 112) << 23) | (mant << 13));
+}
@@ -0,0 +1,412 @@
+/*
+ jsonkit ( https://github.com/zhuyie/jsonkit )
+
+ Copyright (c) 2014, zhuyie
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "json.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ json_parse_lazy copies the text and runs the event parser over it, which 
+ validates it and records one entry per container: its byte range, its 
+ child count and where its subtree ends in the entry list (entries are in 
+ document order). Containers start out as lazy nodes pointing at their 
+ entry. The first access builds their children from the text, scalars as 
+ nodes and containers as further lazy nodes, skipping nested ranges at once.
+
+ The text and the entries are shared by all lazy nodes of a document and 
+ freed with the last one.
+*/
+
+#define MAX_NAME_LEN    256  /* as in json_parser.c */
+#define MAX_NUMBER_LEN  50
+
+typedef struct _lazy_entry {
+    size_t begin;       /* the opening bracket */
+    size_t end;         /* past the closing bracket */
+    unsigned int size;  /* children, names are counted with their duplicates */
+    unsigned int next;  /* the first entry after this subtree */
+} _lazy_entry;
+
+typedef struct _lazy_doc {
+    json_alloc_func alloc_func;
+    unsigned int refcount;  /* lazy nodes pointing here */
+    unsigned int count;
+    unsigned int capacity;
+    _lazy_entry *entries;
+    size_t len;
+    char text[1];
+} _lazy_doc;
+
+typedef struct _lazy_scan {
+    _lazy_doc *doc;
+    unsigned int *stack;  /* the open containers */
+    int top;
+} _lazy_scan;
+
+extern void* json_default_alloc_func(
+    void *ptr, 
+    size_t osize, 
+    size_t nsize
+    );
+extern json_value* json_object_set_len(
+    json_value *v, 
+    const char *name, 
+    unsigned int len, 
+    json_value *value
+    );
+extern json_value* json_array_append_number(
+    json_value *v, 
+    double dbl
+    );
+extern json_value* json_lazy_node(
+    json_value_type type, 
+    void *doc, 
+    unsigned int entry, 
+    unsigned int size, 
+    json_alloc_func alloc_func
+    );
+json_value* json_lazy_build(
+    void *doc, 
+    unsigned int entry
+    );
+void json_lazy_release(
+    void *doc
+    );
+static int _on_begin(
+    void *ctx, 
+    json_value_type type, 
+    size_t index
+    );
+static int _on_end(
+    void *ctx, 
+    json_value_type type, 
+    size_t index, 
+    size_t len
+    );
+static int _on_key(
+    void *ctx, 
+    size_t index, 
+    size_t len
+    );
+static int _on_scalar(
+    void *ctx, 
+    json_value_type type, 
+    size_t index, 
+    size_t len
+    );
+static json_value* _lazy_child(
+    _lazy_doc *doc, 
+    unsigned int entry
+    );
+static const char* _skip(
+    const char *p, 
+    const char *end
+    );
+static const char* _string_end(
+    const char *p
+    );
+
+/*----------------------------------------------------------------------------*/
+
+json_value* json_parse_lazy(const char *json_str, size_t len, int depth, json_alloc_func alloc_func)
+{
+    json_parser_events events;
+    json_parser *parser;
+    _lazy_scan scan;
+    _lazy_doc *doc;
+    json_value *root = NULL;
+    size_t i;
+    int ok = 1;
+
+    assert(json_str);
+    assert(depth > 1);
+
+    if (!alloc_func)
+        alloc_func = json_default_alloc_func;
+
+    doc = (_lazy_doc*)alloc_func(NULL, 0, sizeof(_lazy_doc) + len);
+    if (!doc)
+        return NULL;
+    doc->alloc_func = alloc_func;
+    doc->refcount = 1;
+    doc->count = 0;
+    doc->capacity = 0;
+    doc->entries = NULL;
+    doc->len = len;
+    memcpy(doc->text, json_str, len);
+    doc->text[len] = '\0';
+
+    scan.doc = doc;
+    scan.top = -1;
+    scan.stack = (unsigned int*)alloc_func(NULL, 0, sizeof(unsigned int) * depth);
+    events.ctx = &scan;
+    events.begin = _on_begin;
+    events.end = _on_end;
+    events.key = _on_key;
+    events.scalar = _on_scalar;
+    parser = scan.stack ? json_parser_alloc_events(depth, &events) : NULL;
+    if (!parser)
+        ok = 0;
+
+    for (i = 0; ok && i < len; ++i)
+        ok = json_parser_char(parser, (unsigned char)doc->text[i]);
+    if (ok)
+        ok = json_parser_complete(parser);
+    json_parser_free(parser);
+    if (scan.stack)
+        alloc_func(scan.stack, sizeof(unsigned int) * depth, 0);
+
+    if (ok) {
+        /* the root is an object or an array */
+        assert(doc->count > 0);
+        root = _lazy_child(doc, 0);
+    }
+    json_lazy_release(doc);
+    return root;
+}
+
+/*----------------------------------------------------------------------------*/
+
+/* used by json.c, the children of a lazy container */
+json_value* json_lazy_build(void *data, unsigned int index)
+{
+    _lazy_doc *doc = (_lazy_doc*)data;
+    const _lazy_entry *entry = doc->entries + index;
+    const char *p = doc->text + entry->begin + 1, *end = doc->text + entry->end - 1, *q;
+    const char *name = NULL;
+    unsigned int name_len = 0, child = index + 1;
+    int is_object = doc->text[entry->begin] == '{';
+    json_value *v, *value, *res;
+    char tmp[MAX_NUMBER_LEN];
+    double dbl;
+
+    v = is_object ? json_object_alloc(doc->alloc_func) : json_array_alloc(doc->alloc_func);
+    if (!v)
+        return NULL;
+    if (is_object && entry->size && !json_object_reserve(v, entry->size)) {
+        json_free(v);
+        return NULL;
+    }
+
+    /* the text is valid, only the shape of each value needs to be seen */
+    while ((p = _skip(p, end)) < end) {
+        if (is_object) {
+            name = p + 1;
+            p = _string_end(name);
+            name_len = (unsigned int)(p - name);
+            p = _skip(p + 1, end);
+        }
+
+        switch (*p) {
+        case '{':
+        case '[':
+            value = _lazy_child(doc, child);
+            p = doc->text + doc->entries[child].end;
+            child = doc->entries[child].next;
+            break;
+
+        case '"':
+            q = _string_end(p + 1);
+            value = json_string_alloc(p + 1, (unsigned int)(q - p - 1), doc->alloc_func);
+            p = q + 1;
+            break;
+
+        case 't':
+        case 'f':
+            value = json_boolean_alloc(*p == 't', doc->alloc_func);
+            p += *p == 't' ? 4 : 5;
+            break;
+
+        case 'n':
+            value = json_null_alloc(doc->alloc_func);
+            p += 4;
+            break;
+
+        default:
+            for (q = p; q < end && (*q == '-' || *q == '+' || *q == '.' || *q == 'e' || *q == 'E' || 
+                    (*q >= '0' && *q <= '9')); ++q)
+                ;
+            assert(q - p < MAX_NUMBER_LEN);
+            memcpy(tmp, p, q - p);
+            tmp[q - p] = '\0';
+            dbl = atof(tmp);
+            p = q;
+            if (!is_object) {
+                /* the array stays typed while it holds numbers only, as when parsed */
+                if (!json_array_append_number(v, dbl))
+                    goto error;
+                continue;
+            }
+            value = json_number_alloc(dbl, doc->alloc_func);
+            break;
+        }
+        if (!value)
+            goto error;
+
+        if (is_object)
+            res = json_object_set_len(v, name, name_len, value);
+        else
+            res = json_array_set(v, json_array_size(v), value);
+        if (!res) {
+            json_free(value);
+            goto error;
+        }
+    }
+
+    return v;
+
+error:
+    json_free(v);
+    return NULL;
+}
+
+/* used by json.c, a lazy node is gone or built */
+void json_lazy_release(void *data)
+{
+    _lazy_doc *doc = (_lazy_doc*)data;
+
+    assert(doc->refcount > 0);
+    if (--doc->refcount)
+        return;
+    if (doc->entries)
+        doc->alloc_func(doc->entries, sizeof(_lazy_entry) * doc->capacity, 0);
+    doc->alloc_func(doc, sizeof(_lazy_doc) + doc->len, 0);
+}
+
+/*----------------------------------------------------------------------------*/
+
+static int _on_begin(void *ctx, json_value_type type, size_t index)
+{
+    _lazy_scan *scan = (_lazy_scan*)ctx;
+    _lazy_doc *doc = scan->doc;
+    _lazy_entry *entries;
+    unsigned int capacity;
+
+    (void)type;
+
+    if (scan->top >= 0 && doc->text[doc->entries[scan->stack[scan->top]].begin] == '[')
+        doc->entries[scan->stack[scan->top]].size += 1;
+
+    if (doc->count == doc->capacity) {
+        capacity = doc->capacity ? doc->capacity * 2 : 8;
+        entries = (_lazy_entry*)doc->alloc_func(doc->entries, 
+            sizeof(_lazy_entry) * doc->capacity, sizeof(_lazy_entry) * capacity);  /* realloc */
+        if (!entries)
+            return 0;
+        doc->entries = entries;
+        doc->capacity = capacity;
+    }
+
+    /* the parser bounds the depth, the stack has as many slots */
+    doc->entries[doc->count].begin = index;
+    doc->entries[doc->count].end = index;
+    doc->entries[doc->count].size = 0;
+    doc->entries[doc->count].next = 0;
+    scan->stack[++scan->top] = doc->count++;
+    return 1;
+}
+
+static int _on_end(void *ctx, json_value_type type, size_t index, size_t len)
+{
+    _lazy_scan *scan = (_lazy_scan*)ctx;
+    _lazy_entry *entry = scan->doc->entries + scan->stack[scan->top--];
+
+    (void)type;
+
+    entry->end = index + len;  /* just past the current character */
+    entry->next = scan->doc->count;
+    return 1;
+}
+
+static int _on_key(void *ctx, size_t index, size_t len)
+{
+    _lazy_scan *scan = (_lazy_scan*)ctx;
+
+    (void)index;
+
+    /* the parser takes the same names only */
+    if (!len || len >= MAX_NAME_LEN)
+        return 0;
+    scan->doc->entries[scan->stack[scan->top]].size += 1;
+    return 1;
+}
+
+static int _on_scalar(void *ctx, json_value_type type, size_t index, size_t len)
+{
+    _lazy_scan *scan = (_lazy_scan*)ctx;
+    _lazy_doc *doc = scan->doc;
+
+    (void)index;
+
+    if (type == json_type_number && len >= MAX_NUMBER_LEN)
+        return 0;  /* the parser takes the same numbers only */
+    if (doc->text[doc->entries[scan->stack[scan->top]].begin] == '[')
+        doc->entries[scan->stack[scan->top]].size += 1;
+    return 1;
+}
+
+static json_value* _lazy_child(_lazy_doc *doc, unsigned int entry)
+{
+    json_value *v;
+
+    if (!doc->entries[entry].size)
+        return json_lazy_build(doc, entry);  /* nothing to defer */
+
+    doc->refcount += 1;
+    v = json_lazy_node(doc->text[doc->entries[entry].begin] == '{' ? json_type_object : json_type_array, 
+        doc, entry, doc->entries[entry].size, doc->alloc_func);
+    if (!v)
+        doc->refcount -= 1;
+    return v;
+}
+
+static const char* _skip(const char *p, const char *end)
+{
+    /* whitespace and separators */
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || *p == ',' || *p == ':'))
+        p++;
+    return p;
+}
+
+static const char* _string_end(const char *p)
+{
+    /* the closing quote, p is past the opening one */
+    while (*p != '"') {
+        if (*p == '\\')
+            p++;
+        p++;
+    }
+    return p;
+}
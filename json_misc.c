@@ -32,11 +32,312 @@
 
 #include "json.h"
 #include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#ifdef _MSC_VER
+  #include <windows.h>
+  #define _THREAD_LOCAL  __declspec(thread)
+#else
+  #include <pthread.h>
+  #define _THREAD_LOCAL  __thread
+#endif
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ json_pool_alloc_func serves sizes up to POOL_MAX from free lists, one per 
+ multiple of POOL_GRANULE, and forwards larger ones to the C library. It 
+ relies on osize being exact, which holds for everything jsonkit allocates.
+
+ Each thread keeps up to POOL_CACHE_MAX free blocks per class without 
+ locking, and trades POOL_BATCH blocks at a time with a shared pool. Memory 
+ in the pool is reused but never returned to the system.
+*/
+
+#define POOL_GRANULE    16
+#define POOL_MAX        256
+#define POOL_CLASSES    (POOL_MAX / POOL_GRANULE)
+#define POOL_CHUNK      (64 * 1024)
+#define POOL_CACHE_MAX  256
+#define POOL_BATCH      64
+
+typedef struct _pool_block {
+    struct _pool_block *next;
+} _pool_block;
+
+typedef struct _pool_cache {
+    _pool_block *head[POOL_CLASSES];
+    unsigned int count[POOL_CLASSES];
+    int registered;
+} _pool_cache;
+
+static _pool_block *_pool_head[POOL_CLASSES];
+static char *_pool_chunk;
+static size_t _pool_chunk_left;
+#ifdef _MSC_VER
+static SRWLOCK _pool_lock = SRWLOCK_INIT;
+  #define _POOL_LOCK()    AcquireSRWLockExclusive(&_pool_lock)
+  #define _POOL_UNLOCK()  ReleaseSRWLockExclusive(&_pool_lock)
+#else
+static pthread_mutex_t _pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t _pool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t _pool_key;
+  #define _POOL_LOCK()    pthread_mutex_lock(&_pool_lock)
+  #define _POOL_UNLOCK()  pthread_mutex_unlock(&_pool_lock)
+#endif
+
+static _THREAD_LOCAL _pool_cache _cache;
+
+/* allocators with their own json_growth_func, set up before use */
+#define GROWTH_SLOTS    8
+
+typedef struct _growth_slot {
+    json_alloc_func alloc_func;
+    json_growth_func growth_func;
+} _growth_slot;
+
+static _growth_slot _growth[GROWTH_SLOTS];
+static unsigned int _growth_count;
+
+unsigned int json_grow_capacity(
+    json_alloc_func alloc_func, 
+    unsigned int capacity
+    );
+static void* _pool_get(
+    unsigned int cls
+    );
+static void _pool_put(
+    void *ptr, 
+    unsigned int cls
+    );
+static int _pool_refill(
+    _pool_cache *cache, 
+    unsigned int cls
+    );
+static void _pool_release(
+    _pool_cache *cache, 
+    unsigned int cls, 
+    unsigned int count
+    );
+static void _pool_register(
+    _pool_cache *cache
+    );
 
 /*----------------------------------------------------------------------------*/
 
 void* json_default_alloc_func(void *ptr, size_t osize, size_t nsize)
 {
     (void)osize;
+    if (!nsize) {
+        /* realloc(ptr, 0) need not free */
+        free(ptr);
+        return NULL;
+    }
     return realloc(ptr, nsize);
 }
+
+void* json_pool_alloc_func(void *ptr, size_t osize, size_t nsize)
+{
+    void *p;
+
+    if (!ptr)
+        osize = 0;
+    if (osize > POOL_MAX && nsize > POOL_MAX)
+        return realloc(ptr, nsize);
+
+    if (!nsize) {
+        if (osize > POOL_MAX)
+            free(ptr);
+        else if (ptr)
+            _pool_put(ptr, (unsigned int)((osize - 1) / POOL_GRANULE));
+        return NULL;
+    }
+    if (ptr && osize <= POOL_MAX && nsize <= POOL_MAX && 
+        (osize - 1) / POOL_GRANULE == (nsize - 1) / POOL_GRANULE)
+        return ptr;  /* the same class */
+
+    p = nsize <= POOL_MAX ? _pool_get((unsigned int)((nsize - 1) / POOL_GRANULE)) : malloc(nsize);
+    if (!p)
+        return NULL;
+    if (ptr) {
+        memcpy(p, ptr, osize < nsize ? osize : nsize);
+        if (osize <= POOL_MAX)
+            _pool_put(ptr, (unsigned int)((osize - 1) / POOL_GRANULE));
+        else
+            free(ptr);
+    }
+    return p;
+}
+
+/*----------------------------------------------------------------------------*/
+
+int json_set_growth_func(json_alloc_func alloc_func, json_growth_func growth_func)
+{
+    /* not synchronized, json_grow_capacity reads the table on every growth */
+    unsigned int i;
+
+    if (!alloc_func)
+        alloc_func = json_default_alloc_func;
+
+    for (i = 0; i < _growth_count; ++i) {
+        if (_growth[i].alloc_func == alloc_func)
+            break;
+    }
+    if (!growth_func) {
+        if (i < _growth_count)
+            _growth[i] = _growth[--_growth_count];
+        return 1;
+    }
+    if (i == GROWTH_SLOTS)
+        return 0;
+    if (i == _growth_count)
+        _growth_count++;
+    _growth[i].alloc_func = alloc_func;
+    _growth[i].growth_func = growth_func;
+    return 1;
+}
+
+/* used by the containers, the capacity after capacity once it is full */
+unsigned int json_grow_capacity(json_alloc_func alloc_func, unsigned int capacity)
+{
+    unsigned int i, c;
+
+    for (i = 0; i < _growth_count; ++i) {
+        if (_growth[i].alloc_func == alloc_func) {
+            c = _growth[i].growth_func(capacity);
+            return c > capacity ? c : capacity + 1;
+        }
+    }
+
+    /* geometric at any size, appending stays amortized O(1) */
+    if (capacity == 0)
+        return 4;
+    else if (capacity < 1024)
+        return capacity * 2;
+    else
+        return capacity + capacity / 2;
+}
+
+/*----------------------------------------------------------------------------*/
+
+static void* _pool_get(unsigned int cls)
+{
+    _pool_cache *cache = &_cache;
+    _pool_block *block;
+
+    if (!cache->head[cls] && !_pool_refill(cache, cls))
+        return NULL;
+
+    block = cache->head[cls];
+    cache->head[cls] = block->next;
+    cache->count[cls] -= 1;
+    return block;
+}
+
+static void _pool_put(void *ptr, unsigned int cls)
+{
+    _pool_cache *cache = &_cache;
+    _pool_block *block = (_pool_block*)ptr;
+
+    assert(cls < POOL_CLASSES);
+    block->next = cache->head[cls];
+    cache->head[cls] = block;
+    cache->count[cls] += 1;
+    if (cache->count[cls] > POOL_CACHE_MAX)
+        _pool_release(cache, cls, POOL_BATCH);
+}
+
+static int _pool_refill(_pool_cache *cache, unsigned int cls)
+{
+    /* a batch from the shared lists, or carved from the current chunk */
+    size_t size = (cls + 1) * POOL_GRANULE;
+    _pool_block *block;
+    unsigned int count = 0;
+
+    if (!cache->registered)
+        _pool_register(cache);
+
+    _POOL_LOCK();
+    while (count < POOL_BATCH && (block = _pool_head[cls]) != NULL) {
+        _pool_head[cls] = block->next;
+        block->next = cache->head[cls];
+        cache->head[cls] = block;
+        count++;
+    }
+    while (count < POOL_BATCH) {
+        if (_pool_chunk_left < size) {
+            /* the rest of the old chunk is lost, it is smaller than a block */
+            _pool_chunk = (char*)malloc(POOL_CHUNK);
+            if (!_pool_chunk) {
+                _pool_chunk_left = 0;
+                break;
+            }
+            _pool_chunk_left = POOL_CHUNK;
+        }
+        block = (_pool_block*)_pool_chunk;
+        _pool_chunk += size;
+        _pool_chunk_left -= size;
+        block->next = cache->head[cls];
+        cache->head[cls] = block;
+        count++;
+    }
+    _POOL_UNLOCK();
+
+    cache->count[cls] += count;
+    return count != 0;
+}
+
+static void _pool_release(_pool_cache *cache, unsigned int cls, unsigned int count)
+{
+    /* give count cached blocks back to the shared lists */
+    _pool_block *first, *last;
+    unsigned int i;
+
+    if (!count)
+        return;
+
+    first = last = cache->head[cls];
+    for (i = 1; i < count; ++i)
+        last = last->next;
+    cache->head[cls] = last->next;
+    cache->count[cls] -= count;
+
+    _POOL_LOCK();
+    last->next = _pool_head[cls];
+    _pool_head[cls] = first;
+    _POOL_UNLOCK();
+}
+
+#ifdef _MSC_VER
+
+static void _pool_register(_pool_cache *cache)
+{
+    /* no destructor, a thread that exits keeps its cached blocks */
+    cache->registered = 1;
+}
+
+#else
+
+static void _pool_thread_exit(void *data)
+{
+    _pool_cache *cache = (_pool_cache*)data;
+    unsigned int cls;
+
+    for (cls = 0; cls < POOL_CLASSES; ++cls)
+        _pool_release(cache, cls, cache->count[cls]);
+}
+
+static void _pool_key_create()
+{
+    pthread_key_create(&_pool_key, _pool_thread_exit);
+}
+
+static void _pool_register(_pool_cache *cache)
+{
+    /* hand the cache back to the pool when the thread exits */
+    pthread_once(&_pool_once, _pool_key_create);
+    pthread_setspecific(_pool_key, cache);
+    cache->registered = 1;
+}
+
+#endif
@@ -229,15 +229,18 @@ typedef enum modes {
 typedef struct json_parser_stack_item {
     modes mode;
     json_value *value;
-    unsigned int name_begin;
-    unsigned int name_len;
-    unsigned int value_begin;
+    size_t name_begin;
+    size_t name_len;
+    size_t value_begin;
+    size_t begin;  /* where the container starts, for its end event; value_begin is taken by its scalars */
 } json_parser_stack_item;
 
 struct json_parser {
     int depth;
     json_parser_config config;
-    unsigned int char_index;
+    /* In event mode no json_value is built, the events are reported instead. */
+    const json_parser_events *events;
+    size_t char_index;
     int state;
     int top;
     json_parser_stack_item *stack;
@@ -248,6 +251,16 @@ extern void* json_default_alloc_func(
     size_t osize, 
     size_t nsize
     );
+extern json_value* json_object_set_len(
+    json_value *v, 
+    const char *name, 
+    unsigned int len, 
+    json_value *value
+    );
+extern json_value* json_array_append_number(
+    json_value *v, 
+    double dbl
+    );
 static int _push(
     json_parser *parser, 
     modes mode
@@ -282,6 +295,7 @@ json_parser* json_parser_alloc(int depth, json_parser_config config)
         return NULL;
     parser->depth = depth;
     memcpy(&parser->config, &config, sizeof(json_parser_config));
+    parser->events = NULL;
     if (!parser->config.alloc_func)
         parser->config.alloc_func = json_default_alloc_func;
     parser->state = GO;
@@ -298,6 +312,27 @@ json_parser* json_parser_alloc(int depth, json_parser_config config)
     return parser;
 }
 
+json_parser* json_parser_alloc_events(int depth, const json_parser_events *events)
+{
+/*
+    Same as json_parser_alloc, but no json_value is built. Instead the events 
+    are reported to the callbacks as the characters are fed. Offsets are counted 
+    from the first character. Any callback returning false stops the parsing.
+*/
+    json_parser_config config;
+    json_parser *parser;
+
+    assert(events);
+    config.alloc_func = NULL;
+    config.json_str = NULL;
+    config.json_str_len = 0;
+    parser = json_parser_alloc(depth, config);
+    if (parser)
+        parser->events = events;
+
+    return parser;
+}
+
 int json_parser_char(json_parser *parser, int next_char)
 {
 /*
@@ -454,6 +489,14 @@ json_value* json_parser_done(json_parser *parser)
     return result;
 }
 
+int json_parser_complete(json_parser *parser)
+{
+/*
+    Returns true if the characters processed so far form a complete JSON text.
+*/
+    return parser->state == OK && parser->top == 0;
+}
+
 void json_parser_free(json_parser *parser)
 {
     int i;
@@ -472,47 +515,57 @@ void json_parser_free(json_parser *parser)
 
 static json_value* _create_string_value(
     json_parser_config *config, 
-    unsigned int index, 
-    unsigned int len
+    size_t index, 
+    size_t len
     )
 {
     if (config->json_str && index + len <= config->json_str_len) {
-        return json_string_alloc(config->json_str + index, len, config->alloc_func);
+        return json_string_alloc(config->json_str + index, (unsigned int)len, config->alloc_func);
     }
     return NULL;
 }
 
-static json_value* _create_number_value(
+static int _parse_number(
     json_parser_config *config, 
-    unsigned int index, 
-    unsigned int len
+    size_t index, 
+    size_t len, 
+    double *dbl
     )
 {
     char tmp[50];
-    double dbl;
 
     if (config->json_str && len > 0 && len < 50 && index + len <= config->json_str_len) {
         memcpy(tmp, config->json_str + index, len);
         tmp[len] = '\0';
-        dbl = atof(tmp);
-        return json_number_alloc(dbl, config->alloc_func);
+        *dbl = atof(tmp);
+        return true;
     }
-    return NULL;
+    return false;
+}
+
+static json_value* _create_number_value(
+    json_parser_config *config, 
+    size_t index, 
+    size_t len
+    )
+{
+    double dbl;
+
+    if (!_parse_number(config, index, len, &dbl))
+        return NULL;
+    return json_number_alloc(dbl, config->alloc_func);
 }
 
-static unsigned int _get_object_name(
+static const char* _get_object_name(
     json_parser_config *config,
-    unsigned int index,
-    unsigned int len,
-    char name[MAX_NAME_LEN]
+    size_t index,
+    size_t len
     )
 {
     if (config->json_str && len > 0 && len < MAX_NAME_LEN && index + len <= config->json_str_len) {
-        memcpy(name, config->json_str + index, len);
-        name[len] = '\0';
-        return len;
+        return config->json_str + index;
     }
-    return 0;
+    return NULL;
 }
 
 static int _push(json_parser *parser, modes mode)
@@ -523,10 +576,10 @@ static int _push(json_parser *parser, modes mode)
     json_value *v;
     json_parser_stack_item *top_stack_item;
 
-    parser->top += 1;
-    if (parser->top >= parser->depth) {
+    if (parser->top + 1 >= parser->depth) {
         return false;
     }
+    parser->top += 1;
 
     top_stack_item = parser->stack + parser->top;
     top_stack_item->mode = mode;
@@ -534,6 +587,16 @@ static int _push(json_parser *parser, modes mode)
     top_stack_item->name_begin = 0;
     top_stack_item->name_len = 0;
     top_stack_item->value_begin = 0;
+    top_stack_item->begin = parser->char_index;
+
+    if (parser->events) {
+        if (mode == MODE_ARRAY || mode == MODE_OBJECT) {
+            return parser->events->begin(parser->events->ctx, 
+                mode == MODE_ARRAY ? json_type_array : json_type_object, 
+                parser->char_index);
+        }
+        return true;
+    }
 
     if (mode == MODE_ARRAY) {
         v = json_array_alloc(parser->config.alloc_func);
@@ -559,7 +622,7 @@ static int _pop(json_parser *parser, modes mode)
     json_parser_stack_item *top_stack_item, *parent_stack_item;
     json_value *v, *parent;
     modes parent_mode;
-    char name[MAX_NAME_LEN];
+    const char *name;
 
     if (parser->top < 0 || parser->stack[parser->top].mode != mode) {
         return false;
@@ -567,7 +630,16 @@ static int _pop(json_parser *parser, modes mode)
 
     top_stack_item = parser->stack + parser->top;
 
-    if (parser->top > 0) {
+    if (parser->events) {
+        if (mode == MODE_ARRAY || mode == MODE_OBJECT) {
+            if (!parser->events->end(parser->events->ctx, 
+                    mode == MODE_ARRAY ? json_type_array : json_type_object, 
+                    top_stack_item->begin,
+                    parser->char_index - top_stack_item->begin + 1))
+                return false;
+        }
+
+    } else if (parser->top > 0) {
         parent_stack_item = parser->stack + parser->top - 1;
         v = top_stack_item->value;
         parent = parent_stack_item->value;
@@ -602,14 +674,14 @@ static int _pop(json_parser *parser, modes mode)
         } else if (mode == MODE_OBJECT_VALUE) {
             assert(v);
             if (parent && parent_mode == MODE_OBJECT) {
-                /* insert v into the object */
-                if (!_get_object_name(&parser->config, 
+                /* insert v into the object, the name is hashed right from the source text */
+                name = _get_object_name(&parser->config, 
                         parent_stack_item->name_begin, 
-                        parent_stack_item->name_len, 
-                        name)
-                    )
+                        parent_stack_item->name_len
+                    );
+                if (!name)
                     return false;
-                if (!json_object_set(parent, name, v))
+                if (!json_object_set_len(parent, name, (unsigned int)parent_stack_item->name_len, v))
                     return false;
             } else {
                 assert(0);
@@ -627,31 +699,38 @@ static int _pop(json_parser *parser, modes mode)
 static int _change_state(json_parser *parser, int next_state)
 {
     json_parser_stack_item *top_stack_item = parser->stack + parser->top;
+    json_value_type value_type = json_type_null;
+    size_t value_begin = 0, value_len = 0;
     int value_end = 0;
+    double dbl;
     json_value *v = NULL, *parent;
 
     if (next_state == OK) {
         if (parser->state == N3) {
             /* null */
             value_end = 1;
-            v = json_null_alloc(parser->config.alloc_func);
+            value_type = json_type_null;
+            value_begin = parser->char_index - 3;
+            value_len = 4;
         } else if (parser->state == T3) {
             /* true */
             value_end = 1;
-            v = json_boolean_alloc(1, parser->config.alloc_func);
+            value_type = json_type_true;
+            value_begin = parser->char_index - 3;
+            value_len = 4;
         } else if (parser->state == F4) {
             /* false */
             value_end = 1;
-            v = json_boolean_alloc(0, parser->config.alloc_func);
+            value_type = json_type_false;
+            value_begin = parser->char_index - 4;
+            value_len = 5;
         } else if (parser->state == ST) {
             /* end of string in object_value or array */
             assert(top_stack_item->value_begin > 0);
             value_end = 1;
-            v = _create_string_value(
-                    &parser->config, 
-                    top_stack_item->value_begin, 
-                    parser->char_index - top_stack_item->value_begin
-                );
+            value_type = json_type_string;
+            value_begin = top_stack_item->value_begin;
+            value_len = parser->char_index - top_stack_item->value_begin;
         }
     } else if (next_state == ST) {
         if (parser->state == OB || parser->state == KE) {
@@ -659,8 +738,8 @@ static int _change_state(json_parser *parser, int next_state)
             assert(top_stack_item->mode == MODE_OBJECT_KEY);
             top_stack_item->name_begin = parser->char_index + 1;
         } else if (parser->state == VA) {
-            /* begin of string in object_value */
-            assert(top_stack_item->mode == MODE_OBJECT_VALUE);
+            /* begin of string in object_value, or in array after a comma */
+            assert(top_stack_item->mode == MODE_OBJECT_VALUE || top_stack_item->mode == MODE_ARRAY);
             top_stack_item->value_begin = parser->char_index + 1;
         } else if (parser->state == AR) {
             /* begin of string in array */
@@ -672,6 +751,9 @@ static int _change_state(json_parser *parser, int next_state)
             /* end of string in object_name */
             assert(top_stack_item->mode == MODE_OBJECT_KEY);
             top_stack_item->name_len = parser->char_index - top_stack_item->name_begin;
+            if (parser->events && 
+                !parser->events->key(parser->events->ctx, top_stack_item->name_begin, top_stack_item->name_len))
+                return false;
         }
     }
 
@@ -686,15 +768,47 @@ static int _change_state(json_parser *parser, int next_state)
             /* end of number */
             assert(top_stack_item->value_begin > 0);
             value_end = 1;
-            v = _create_number_value(
-                    &parser->config,
-                    top_stack_item->value_begin,
-                    parser->char_index - top_stack_item->value_begin
-                );
+            value_type = json_type_number;
+            value_begin = top_stack_item->value_begin;
+            value_len = parser->char_index - top_stack_item->value_begin;
         }
     }
 
-    if (value_end) {
+    if (value_end && parser->events) {
+        /* report strings with their quotes */
+        if (value_type == json_type_string) {
+            value_begin -= 1;
+            value_len += 2;
+        }
+        if (!parser->events->scalar(parser->events->ctx, value_type, value_begin, value_len))
+            return false;
+
+    } else if (value_end && value_type == json_type_number && top_stack_item->mode == MODE_ARRAY) {
+        /* no node, the array stays typed while it holds numbers only */
+        parent = top_stack_item->value;
+        assert(parent && json_type(parent) == json_type_array);
+        if (!_parse_number(&parser->config, value_begin, value_len, &dbl) || 
+            !json_array_append_number(parent, dbl))
+            return false;
+
+    } else if (value_end) {
+        switch (value_type) {
+        case json_type_null:
+            v = json_null_alloc(parser->config.alloc_func);
+            break;
+        case json_type_true:
+        case json_type_false:
+            v = json_boolean_alloc(value_type == json_type_true, parser->config.alloc_func);
+            break;
+        case json_type_string:
+            v = _create_string_value(&parser->config, value_begin, value_len);
+            break;
+        case json_type_number:
+            v = _create_number_value(&parser->config, value_begin, value_len);
+            break;
+        default:
+            break;
+        }
         if (!v)
             return false;
         
@@ -0,0 +1,809 @@
+/*
+ jsonkit ( https://github.com/zhuyie/jsonkit )
+
+ Copyright (c) 2014, zhuyie
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+    json_diff produces an RFC 6902 patch that turns a into b, json_patch_apply 
+    applies one. Paths are RFC 6901 JSON Pointers over the member names as 
+    they are stored.
+
+    json_diff copies the values of b into the patch, so the patch does not 
+    depend on b and changing one never shows through the other. Applying a 
+    patch copies its values into the document the same way, as do copy and 
+    move within the document.
+
+    json_patch_apply modifies doc in place and takes it over, if an operation 
+    fails the document is freed. For an all or nothing update pass 
+    json_clone_shared(doc): only the containers on the changed paths are then 
+    copied, and doc is left as it was when the patch fails.
+
+    json_merge_patch applies an RFC 7386 merge patch the same way. The values 
+    of the patch are moved into the target rather than cloned: they are shared 
+    first, then the patch is freed and drops its references. Objects of the 
+    patch that hold nulls are rebuilt without them.
+*/
+
+#include "json.h"
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+
+/*----------------------------------------------------------------------------*/
+
+enum patch_ops {
+    PATCH_ADD = 1,
+    PATCH_REMOVE,
+    PATCH_REPLACE,
+    PATCH_MOVE,
+    PATCH_COPY,
+    PATCH_TEST
+};
+
+typedef struct _pointer_buf {  /* the JSON Pointer being built by json_diff */
+    json_alloc_func alloc_func;
+    char *str;
+    unsigned int len, capacity;
+} _pointer_buf;
+
+#define DIFF_INLINE_DEPTH 32
+
+typedef struct _diff_frame {   /* a pair of containers of the same type being compared */
+    json_value *a, *b;
+    unsigned int len;          /* of the path to them */
+    json_iter it;              /* objects: over a, then over b for the added members */
+    int adding;
+    unsigned int index, size_a, size_b;  /* arrays */
+} _diff_frame;
+
+typedef struct _diff_context {
+    json_alloc_func alloc_func;
+    json_value *patch;
+    _pointer_buf path;
+    _diff_frame *stack;        /* instead of recursing, deep trees would overflow the native stack */
+    unsigned int top, capacity;
+    _diff_frame inline_stack[DIFF_INLINE_DEPTH];
+} _diff_context;
+
+#define MERGE_INLINE_DEPTH 32
+
+typedef struct _merge_frame {  /* an object of the patch being merged into one of the target */
+    json_value *target;
+    json_iter it;
+    int fresh;                 /* target is a new object, the patch object has nulls */
+} _merge_frame;
+
+typedef struct _merge_context {
+    json_alloc_func alloc_func;
+    _merge_frame *stack;       /* instead of recursing, as in json_diff */
+    unsigned int top, capacity;
+    _merge_frame inline_stack[MERGE_INLINE_DEPTH];
+} _merge_context;
+
+typedef struct _tokens {       /* a decoded JSON Pointer */
+    json_alloc_func alloc_func;
+    char *str;                 /* NUL separated */
+    unsigned int count;
+    size_t size;
+} _tokens;
+
+extern void* json_default_alloc_func(
+    void *ptr, 
+    size_t osize, 
+    size_t nsize
+    );
+extern json_value* json_array_insert(
+    json_value *v, 
+    unsigned int index, 
+    json_value *value
+    );
+extern json_value* json_pointer_update(
+    json_value *v, 
+    const char *tokens, 
+    unsigned int count, 
+    json_value* (*func)(json_value *parent, const char *token, void *ctx), 
+    void *ctx
+    );
+static int _diff_node(
+    _diff_context *ctx, 
+    json_value *a, 
+    json_value *b
+    );
+static int _diff(
+    _diff_context *ctx, 
+    json_value *a, 
+    json_value *b
+    );
+extern int json_is_shared(
+    json_value *v
+    );
+extern json_value* json_shallow_copy(
+    json_value *v
+    );
+extern json_value* json_share(
+    json_value *v
+    );
+static json_value* _apply_op(
+    json_value *doc, 
+    json_value *op, 
+    json_alloc_func alloc_func
+    );
+static int _has_null_member(
+    json_value *v
+    );
+static int _merge_push(
+    _merge_context *ctx, 
+    json_value *target, 
+    json_value *patch, 
+    int fresh
+    );
+static int _merge_into(
+    json_value *target, 
+    json_value *patch
+    );
+
+/*----------------------------------------------------------------------------*/
+
+json_value* json_diff(json_value *a, json_value *b, json_alloc_func alloc_func)
+{
+    _diff_context ctx;
+
+    assert(a);
+    assert(b);
+
+    if (!alloc_func)
+        alloc_func = json_default_alloc_func;
+
+    ctx.alloc_func = alloc_func;
+    ctx.patch = json_array_alloc(alloc_func);
+    if (!ctx.patch)
+        return NULL;
+    ctx.path.alloc_func = alloc_func;
+    ctx.path.str = NULL;
+    ctx.path.len = 0;
+    ctx.path.capacity = 0;
+    ctx.stack = ctx.inline_stack;
+    ctx.top = 0;
+    ctx.capacity = DIFF_INLINE_DEPTH;
+
+    if (!_diff(&ctx, a, b)) {
+        json_free(ctx.patch);
+        ctx.patch = NULL;
+    }
+    alloc_func(ctx.path.str, ctx.path.capacity, 0);
+    if (ctx.stack != ctx.inline_stack)
+        alloc_func(ctx.stack, sizeof(_diff_frame) * ctx.capacity, 0);
+
+    return ctx.patch;
+}
+
+json_value* json_patch_apply(json_value *doc, json_value *patch)
+{
+    json_value *copy;
+    unsigned int size, i;
+
+    assert(doc);
+    assert(patch);
+
+    size = json_array_size(patch);
+    if (size == (unsigned int)-1) {
+        json_free(doc);
+        return NULL;
+    }
+
+    if (json_is_shared(doc)) {
+        /* our reference, changed through a handle of our own */
+        copy = json_shallow_copy(doc);
+        json_free(doc);
+        doc = copy;
+    }
+
+    for (i = 0; i < size && doc; ++i)
+        doc = _apply_op(doc, json_array_get(patch, i), json_get_alloc_func(doc));
+
+    return doc;
+}
+
+json_value* json_merge_patch(json_value *target, json_value *patch)
+{
+    json_value *copy;
+
+    assert(target);
+    assert(patch);
+
+    if (json_type(patch) != json_type_object) {
+        json_free(target);
+        return patch;
+    }
+
+    if (json_type(target) != json_type_object) {
+        json_free(target);
+        target = json_object_alloc(json_get_alloc_func(patch));
+    } else if (json_is_shared(target)) {
+        copy = json_shallow_copy(target);
+        json_free(target);
+        target = copy;
+    }
+
+    if (target && !_merge_into(target, patch)) {
+        json_free(target);
+        target = NULL;
+    }
+    json_free(patch);
+
+    return target;
+}
+
+/*----------------------------------------------------------------------------*/
+
+static int _path_push(_pointer_buf *path, const char *token, unsigned int len)
+{
+    /* append "/token", escaped */
+    unsigned int need, capacity, i;
+    char *p;
+
+    need = path->len + 1 + len * 2 + 1;
+    if (need > path->capacity) {
+        capacity = path->capacity ? path->capacity : 64;
+        while (capacity < need)
+            capacity *= 2;
+        p = (char*)path->alloc_func(path->str, path->capacity, capacity);  /* realloc */
+        if (!p)
+            return 0;
+        path->str = p;
+        path->capacity = capacity;
+    }
+
+    path->str[path->len++] = '/';
+    for (i = 0; i < len; ++i) {
+        if (token[i] == '~') {
+            path->str[path->len++] = '~';
+            path->str[path->len++] = '0';
+        } else if (token[i] == '/') {
+            path->str[path->len++] = '~';
+            path->str[path->len++] = '1';
+        } else {
+            path->str[path->len++] = token[i];
+        }
+    }
+    path->str[path->len] = '\0';
+    return 1;
+}
+
+static int _path_push_index(_pointer_buf *path, unsigned int index)
+{
+    char tmp[16];
+    int len;
+
+    len = sprintf(tmp, "%u", index);
+    return _path_push(path, tmp, (unsigned int)len);
+}
+
+static int _add_op(_diff_context *ctx, const char *op, json_value *value)
+{
+    /* value is a shared reference, taken over */
+    json_value *v, *str;
+    const char *path = ctx->path.len ? ctx->path.str : "";
+
+    v = json_object_alloc(ctx->alloc_func);
+    if (!v) {
+        json_free(value);
+        return 0;
+    }
+    if (!(str = json_string_alloc(op, (unsigned int)-1, ctx->alloc_func)) || 
+        !json_object_set(v, "op", str)) {
+        json_free(str);
+        json_free(value);
+        json_free(v);
+        return 0;
+    }
+    if (!(str = json_string_alloc(path, ctx->path.len, ctx->alloc_func)) || 
+        !json_object_set(v, "path", str)) {
+        json_free(str);
+        json_free(value);
+        json_free(v);
+        return 0;
+    }
+    if (value && !json_object_set(v, "value", value)) {
+        json_free(value);
+        json_free(v);
+        return 0;
+    }
+    if (!json_array_append(ctx->patch, v)) {
+        json_free(v);
+        return 0;
+    }
+    return 1;
+}
+
+static int _diff_node(_diff_context *ctx, json_value *a, json_value *b)
+{
+    /* compares scalars, containers of the same type get a frame */
+    _diff_frame *stack, *frame;
+    unsigned int capacity;
+
+    /* shared subtrees are identical, frozen ones carry a hash */
+    if (a == b)
+        return 1;
+    if (json_is_frozen(a) && json_is_frozen(b) && json_hash(a) == json_hash(b) && json_equal(a, b))
+        return 1;
+
+    if (json_type(a) != json_type(b))
+        return _add_op(ctx, "replace", json_clone(b, ctx->alloc_func));
+
+    if (json_type(a) != json_type_object && json_type(a) != json_type_array) {
+        if (!json_equal(a, b))
+            return _add_op(ctx, "replace", json_clone(b, ctx->alloc_func));
+        return 1;
+    }
+
+    if (ctx->top == ctx->capacity) {
+        capacity = ctx->capacity * 2;
+        if (ctx->stack == ctx->inline_stack) {
+            stack = (_diff_frame*)ctx->alloc_func(NULL, 0, sizeof(_diff_frame) * capacity);
+            if (stack)
+                memcpy(stack, ctx->inline_stack, sizeof(_diff_frame) * ctx->top);
+        } else {
+            stack = (_diff_frame*)ctx->alloc_func(ctx->stack, 
+                sizeof(_diff_frame) * ctx->capacity, sizeof(_diff_frame) * capacity);  /* realloc */
+        }
+        if (!stack)
+            return 0;
+        ctx->stack = stack;
+        ctx->capacity = capacity;
+    }
+
+    frame = ctx->stack + ctx->top++;
+    frame->a = a;
+    frame->b = b;
+    frame->len = ctx->path.len;
+    if (json_type(a) == json_type_object) {
+        json_iter_begin(&frame->it, a);
+        frame->adding = 0;
+    } else {
+        frame->index = 0;
+        frame->size_a = json_array_size(a);
+        frame->size_b = json_array_size(b);
+    }
+    return 1;
+}
+
+static int _diff(_diff_context *ctx, json_value *a, json_value *b)
+{
+    _diff_frame *frame;
+    json_key key;
+    json_value *child;
+    unsigned int i;
+
+    if (!_diff_node(ctx, a, b))
+        return 0;
+
+    while (ctx->top > 0) {
+        frame = ctx->stack + ctx->top - 1;
+        ctx->path.len = frame->len;
+
+        if (json_type(frame->a) == json_type_object) {
+            /* members are matched through the name hash index */
+            if (!frame->adding) {
+                if (!json_iter_next(&frame->it)) {
+                    json_iter_begin(&frame->it, frame->b);
+                    frame->adding = 1;
+                    continue;
+                }
+                key.name = frame->it.name;
+                key.len = frame->it.name_len;
+                key.hash = frame->it.hash;
+                child = json_object_get_key(frame->b, &key);
+                if (!_path_push(&ctx->path, frame->it.name, frame->it.name_len))
+                    return 0;
+                /* may push a frame and move the stack */
+                if (!(child ? _diff_node(ctx, frame->it.value, child) : _add_op(ctx, "remove", NULL)))
+                    return 0;
+            } else {
+                if (!json_iter_next(&frame->it)) {
+                    ctx->top--;
+                    continue;
+                }
+                key.name = frame->it.name;
+                key.len = frame->it.name_len;
+                key.hash = frame->it.hash;
+                if (json_object_get_key(frame->a, &key))
+                    continue;
+                if (!_path_push(&ctx->path, frame->it.name, frame->it.name_len) || 
+                    !_add_op(ctx, "add", json_clone(frame->it.value, ctx->alloc_func)))
+                    return 0;
+            }
+        } else {
+            /* element by element, the surplus is removed from the end or appended */
+            i = frame->index++;
+            if (i >= frame->size_a && i >= frame->size_b) {
+                ctx->top--;
+                continue;
+            }
+            if (!_path_push_index(&ctx->path, i < frame->size_b ? i : frame->size_a - 1 - (i - frame->size_b)))
+                return 0;
+            if (i >= frame->size_b) {
+                if (!_add_op(ctx, "remove", NULL))
+                    return 0;
+            } else if (i >= frame->size_a) {
+                if (!_add_op(ctx, "add", json_clone(json_array_get(frame->b, i), ctx->alloc_func)))
+                    return 0;
+            } else {
+                if (!_diff_node(ctx, json_array_get(frame->a, i), json_array_get(frame->b, i)))
+                    return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------------*/
+
+static int _tokens_decode(_tokens *tokens, const char *pointer, json_alloc_func alloc_func)
+{
+    /* "/a~1b/c" to "a/b\0c\0" */
+    const char *p;
+    char *out;
+
+    tokens->alloc_func = alloc_func;
+    tokens->str = NULL;
+    tokens->count = 0;
+    tokens->size = 0;
+
+    if (!*pointer)
+        return 1;  /* the whole document */
+    if (*pointer != '/')
+        return 0;
+
+    tokens->size = strlen(pointer) + 1;
+    tokens->str = out = (char*)alloc_func(NULL, 0, tokens->size);
+    if (!out)
+        return 0;
+
+    for (p = pointer; *p; ++p) {
+        if (*p == '/') {
+            if (p != pointer)
+                *out++ = '\0';
+            tokens->count++;
+        } else if (*p == '~') {
+            if (p[1] != '0' && p[1] != '1') {
+                alloc_func(tokens->str, tokens->size, 0);
+                tokens->str = NULL;
+                return 0;
+            }
+            *out++ = p[1] == '0' ? '~' : '/';
+            ++p;
+        } else {
+            *out++ = *p;
+        }
+    }
+    *out = '\0';
+    return 1;
+}
+
+static void _tokens_free(_tokens *tokens)
+{
+    if (tokens->str)
+        tokens->alloc_func(tokens->str, tokens->size, 0);
+}
+
+static int _token_to_index(json_value *array, const char *token, int append, unsigned int *index)
+{
+    const char *p;
+
+    if (append && strcmp(token, "-") == 0) {
+        *index = json_array_size(array);
+        return 1;
+    }
+    if (!*token || (token[0] == '0' && token[1]))
+        return 0;
+    *index = 0;
+    for (p = token; *p; ++p) {
+        if (*p < '0' || *p > '9' || *index > (UINT_MAX - 9) / 10)
+            return 0;
+        *index = *index * 10 + (*p - '0');
+    }
+    return 1;
+}
+
+static json_value* _pointer_get(json_value *v, const _tokens *tokens)
+{
+    const char *token = tokens->str;
+    unsigned int i, index;
+
+    for (i = 0; i < tokens->count && v; ++i) {
+        if (json_type(v) == json_type_object)
+            v = json_object_get(v, token);
+        else if (json_type(v) == json_type_array && _token_to_index(v, token, 0, &index))
+            v = json_array_get(v, index);
+        else
+            v = NULL;
+        token += strlen(token) + 1;
+    }
+    return v;
+}
+
+static json_value* _do_add(json_value *parent, const char *token, void *ctx)
+{
+    json_value *value = (json_value*)ctx;
+    unsigned int index;
+
+    if (json_type(parent) == json_type_object)
+        return json_object_set(parent, token, value);
+    if (json_type(parent) == json_type_array && _token_to_index(parent, token, 1, &index))
+        return json_array_insert(parent, index, value);
+    return NULL;
+}
+
+static json_value* _do_remove(json_value *parent, const char *token, void *ctx)
+{
+    unsigned int index;
+
+    (void)ctx;
+    if (json_type(parent) == json_type_object)
+        return json_object_erase(parent, token);
+    if (json_type(parent) == json_type_array && _token_to_index(parent, token, 0, &index))
+        return json_array_erase(parent, index);
+    return NULL;
+}
+
+static json_value* _do_replace(json_value *parent, const char *token, void *ctx)
+{
+    json_value *value = (json_value*)ctx;
+    unsigned int index;
+
+    if (json_type(parent) == json_type_object)
+        return json_object_get(parent, token) ? json_object_set(parent, token, value) : NULL;
+    if (json_type(parent) == json_type_array && _token_to_index(parent, token, 0, &index) && 
+        index < json_array_size(parent))
+        return json_array_set(parent, index, value);
+    return NULL;
+}
+
+static json_value* _update(
+    json_value *doc, 
+    const _tokens *tokens, 
+    json_value* (*func)(json_value *parent, const char *token, void *ctx), 
+    json_value *value
+    )
+{
+    /* value is taken over on success only, doc stays valid on failure */
+    if (tokens->count == 0) {
+        /* the whole document */
+        if (func == _do_remove)
+            return NULL;
+        json_free(doc);
+        return value;
+    }
+
+    return json_pointer_update(doc, tokens->str, tokens->count, func, value);
+}
+
+static int _op_kind(json_value *op)
+{
+    static const char *names[] = { "add", "remove", "replace", "move", "copy", "test" };
+    const char *name;
+    int i;
+
+    name = json_dotget_string(op, "op");
+    if (!name)
+        return 0;
+    for (i = 0; i < 6; ++i) {
+        if (strcmp(name, names[i]) == 0)
+            return PATCH_ADD + i;
+    }
+    return 0;
+}
+
+static json_value* _apply_op(json_value *doc, json_value *op, json_alloc_func alloc_func)
+{
+    /* on failure doc is freed */
+    _tokens path, from;
+    json_value *value = NULL, *res = NULL, *source;
+    const char *path_str, *str;
+    size_t len;
+    int kind;
+
+    kind = op ? _op_kind(op) : 0;
+    path_str = kind ? json_dotget_string(op, "path") : NULL;
+    if (!path_str || !_tokens_decode(&path, path_str, alloc_func)) {
+        json_free(doc);
+        return NULL;
+    }
+    from.str = NULL;
+
+    switch (kind)
+    {
+    case PATCH_ADD:
+    case PATCH_REPLACE:
+        source = json_dotget(op, "value");
+        if (source && (value = json_clone(source, alloc_func)))
+            res = _update(doc, &path, kind == PATCH_ADD ? _do_add : _do_replace, value);
+        break;
+
+    case PATCH_REMOVE:
+        res = _update(doc, &path, _do_remove, NULL);
+        break;
+
+    case PATCH_MOVE:
+    case PATCH_COPY:
+        str = json_dotget_string(op, "from");
+        if (!str || !_tokens_decode(&from, str, alloc_func))
+            break;
+        /* a value can not be moved into one of its children */
+        len = strlen(str);
+        if (kind == PATCH_MOVE && strncmp(path_str, str, len) == 0 && path_str[len] == '/')
+            break;
+        source = _pointer_get(doc, &from);
+        if (!source || !(value = json_clone(source, alloc_func)))
+            break;
+        if (kind == PATCH_MOVE) {
+            if (from.count == 0 || !(res = _update(doc, &from, _do_remove, NULL)))
+                break;
+            doc = res;
+        }
+        res = _update(doc, &path, _do_add, value);
+        break;
+
+    case PATCH_TEST:
+        source = json_dotget(op, "value");
+        value = _pointer_get(doc, &path);
+        res = source && value && json_equal(source, value) ? doc : NULL;
+        value = NULL;
+        break;
+    }
+
+    _tokens_free(&path);
+    _tokens_free(&from);
+    if (!res) {
+        json_free(value);
+        json_free(doc);
+    }
+    return res;
+}
+
+/*----------------------------------------------------------------------------*/
+
+static int _has_null_member(json_value *v)
+{
+    /* null members of nested objects are erased by a merge patch, null 
+       elements of arrays are not. Without memory for the walk say yes, 
+       merging into an empty object gives the same result */
+    json_walker w;
+    json_walk_event event;
+    int found = 0;
+
+    json_walk_begin(&w, v, json_get_alloc_func(v));
+    while (!found && (event = json_walk_next(&w)) != json_walk_done) {
+        if (event == json_walk_enter && json_type(w.value) == json_type_array)
+            json_walk_skip(&w);
+        else if (event == json_walk_scalar && json_type(w.value) == json_type_null)
+            found = 1;
+        else if (event == json_walk_error)
+            found = 1;
+    }
+    json_walk_end(&w);
+    return found;
+}
+
+static int _merge_push(_merge_context *ctx, json_value *target, json_value *patch, int fresh)
+{
+    _merge_frame *stack, *frame;
+    unsigned int capacity;
+
+    if (ctx->top == ctx->capacity) {
+        capacity = ctx->capacity * 2;
+        if (ctx->stack == ctx->inline_stack) {
+            stack = (_merge_frame*)ctx->alloc_func(NULL, 0, sizeof(_merge_frame) * capacity);
+            if (stack)
+                memcpy(stack, ctx->inline_stack, sizeof(_merge_frame) * ctx->top);
+        } else {
+            stack = (_merge_frame*)ctx->alloc_func(ctx->stack, 
+                sizeof(_merge_frame) * ctx->capacity, sizeof(_merge_frame) * capacity);  /* realloc */
+        }
+        if (!stack)
+            return 0;
+        ctx->stack = stack;
+        ctx->capacity = capacity;
+    }
+
+    frame = ctx->stack + ctx->top++;
+    frame->target = target;
+    json_iter_begin(&frame->it, patch);
+    frame->fresh = fresh;
+    return 1;
+}
+
+static int _merge_into(json_value *target, json_value *patch)
+{
+    /* target is an object that can be modified in place, patch an object. 
+       A nested object is put into its place first and merged into after. 
+       Objects of the patch with nulls are rebuilt without them, and so are 
+       the objects inside them: each subtree is searched for nulls once */
+    _merge_context ctx;
+    _merge_frame *frame;
+    json_key key;
+    json_value *child, *value;
+    int ok, merge, fresh = 0;
+
+    ctx.alloc_func = json_get_alloc_func(target);
+    ctx.stack = ctx.inline_stack;
+    ctx.top = 0;
+    ctx.capacity = MERGE_INLINE_DEPTH;
+    ok = _merge_push(&ctx, target, patch, 0);
+
+    while (ok && ctx.top > 0) {
+        frame = ctx.stack + ctx.top - 1;
+        if (!json_iter_next(&frame->it)) {
+            ctx.top--;
+            continue;
+        }
+        key.name = frame->it.name;
+        key.len = frame->it.name_len;
+        key.hash = frame->it.hash;
+        child = json_object_get_key(frame->target, &key);
+
+        if (json_type(frame->it.value) == json_type_null) {
+            if (child && !json_object_erase(frame->target, frame->it.name))
+                ok = 0;
+            continue;
+        }
+
+        merge = json_type(frame->it.value) == json_type_object;
+        if (merge && child && json_type(child) == json_type_object) {
+            if (!json_is_shared(child)) {
+                ok = _merge_push(&ctx, child, frame->it.value, 0);
+                continue;
+            }
+            value = json_shallow_copy(child);
+            fresh = 0;
+        } else if (merge && (frame->fresh || _has_null_member(frame->it.value))) {
+            /* merged into an empty object to drop the nulls */
+            value = json_object_alloc(ctx.alloc_func);
+            fresh = 1;
+        } else {
+            value = json_share(frame->it.value);
+            merge = 0;
+        }
+
+        if (!value || !json_object_set(frame->target, frame->it.name, value)) {
+            json_free(value);
+            ok = 0;
+        } else if (merge) {
+            ok = _merge_push(&ctx, value, frame->it.value, fresh);
+        }
+    }
+
+    if (ctx.stack != ctx.inline_stack)
+        ctx.alloc_func(ctx.stack, sizeof(_merge_frame) * ctx.capacity, 0);
+    return ok;
+}
@@ -0,0 +1,329 @@
+/*
+ jsonkit ( https://github.com/zhuyie/jsonkit )
+
+ Copyright (c) 2014, zhuyie
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "json.h"
+#include <string.h>
+#include <assert.h>
+
+/*----------------------------------------------------------------------------*/
+
+typedef struct _json_path_segment {
+    json_key key;        /* the segment as an object member name */
+    unsigned int index;  /* the segment as an array index, (unsigned int)-1 if it is not a "[n]" */
+} _json_path_segment;
+
+struct json_path {
+    json_alloc_func alloc_func;
+    size_t size;
+    unsigned int count;
+    _json_path_segment segments[1];
+    /* followed by the segment names */
+};
+
+typedef struct _json_column_state {
+    json_path *path;
+    unsigned int *hints;  /* per segment, where the member was found in the last row */
+} _json_column_state;
+
+extern void* json_default_alloc_func(
+    void *ptr, 
+    size_t osize, 
+    size_t nsize
+    );
+extern json_value* json_object_get_hint(
+    json_value *v, 
+    const json_key *key, 
+    unsigned int *hint
+    );
+extern unsigned int json_segment_to_index(
+    const char *str, 
+    unsigned int len
+    );
+extern const char* json_as_string(
+    json_value *v
+    );
+extern double json_as_number(
+    json_value *v
+    );
+extern int json_as_boolean(
+    json_value *v
+    );
+extern json_value* json_as_type(
+    json_value *v, 
+    json_value_type type
+    );
+static json_value* _eval_hinted(
+    json_value *v, 
+    const json_path *path, 
+    unsigned int *hints
+    );
+static int _column_store(
+    json_column *column, 
+    unsigned int row, 
+    json_value *v
+    );
+
+/*----------------------------------------------------------------------------*/
+
+json_path* json_path_compile(const char *dotname, json_alloc_func alloc_func)
+{
+    json_path *path;
+    const char *p, *begin;
+    char *names;
+    unsigned int count, i, len;
+    size_t size;
+
+    assert(dotname);
+
+    if (!alloc_func)
+        alloc_func = json_default_alloc_func;
+
+    /* count the segments, empty ones never match anything */
+    count = 1;
+    for (p = dotname; *p; ++p) {
+        if (*p == '.')
+            count++;
+    }
+    len = (unsigned int)(p - dotname);
+    if (len + 1 <= count)
+        return NULL;
+
+    size = sizeof(json_path) + sizeof(_json_path_segment) * (count - 1) + len + 1;
+    path = (json_path*)alloc_func(NULL, 0, size);
+    if (!path)
+        return NULL;
+    path->alloc_func = alloc_func;
+    path->size = size;
+    path->count = count;
+
+    names = (char*)(path->segments + count);
+    memcpy(names, dotname, len + 1);
+
+    begin = names;
+    for (i = 0; i < count; ++i) {
+        p = begin;
+        while (*p && *p != '.')
+            p++;
+        if (p == begin) {
+            alloc_func(path, size, 0);
+            return NULL;
+        }
+        len = (unsigned int)(p - begin);
+        json_key_init(&path->segments[i].key, begin, len);
+        path->segments[i].index = json_segment_to_index(begin, len);
+        begin = p + 1;
+    }
+
+    return path;
+}
+
+json_value* json_path_eval(json_value *v, const json_path *path)
+{
+    const _json_path_segment *segment, *end;
+
+    assert(v);
+    assert(path);
+
+    for (segment = path->segments, end = segment + path->count; segment != end; ++segment) {
+        switch (json_type(v))
+        {
+        case json_type_object:
+            v = json_object_get_key(v, &segment->key);
+            break;
+        case json_type_array:
+            v = json_array_get(v, segment->index);
+            break;
+        default:
+            return NULL;
+        }
+        if (!v)
+            return NULL;
+    }
+
+    return v;
+}
+
+const char* json_path_eval_string(json_value *v, const json_path *path)
+{
+    return json_as_string(json_path_eval(v, path));
+}
+
+double json_path_eval_number(json_value *v, const json_path *path)
+{
+    return json_as_number(json_path_eval(v, path));
+}
+
+int json_path_eval_boolean(json_value *v, const json_path *path)
+{
+    return json_as_boolean(json_path_eval(v, path));
+}
+
+json_value* json_path_eval_object(json_value *v, const json_path *path)
+{
+    return json_as_type(json_path_eval(v, path), json_type_object);
+}
+
+json_value* json_path_eval_array(json_value *v, const json_path *path)
+{
+    return json_as_type(json_path_eval(v, path), json_type_array);
+}
+
+void json_path_free(json_path *path)
+{
+    if (!path)
+        return;
+    path->alloc_func(path, path->size, 0);
+}
+
+unsigned int json_columnarize(json_value *array, json_column *columns, unsigned int n)
+{
+    json_alloc_func alloc_func;
+    _json_column_state *states;
+    unsigned int *hints = NULL;
+    unsigned int rows, hint_count = 0, i, res = (unsigned int)-1;
+    json_iter it;
+
+    assert(array);
+    assert(columns || !n);
+
+    if (json_type(array) != json_type_array)
+        return (unsigned int)-1;
+    rows = json_array_size(array);
+    if (!n)
+        return rows;
+
+    alloc_func = json_get_alloc_func(array);
+    states = (_json_column_state*)alloc_func(NULL, 0, sizeof(_json_column_state) * n);
+    if (!states)
+        return (unsigned int)-1;
+    memset(states, 0, sizeof(_json_column_state) * n);
+
+    /* every path is compiled and hashed once for all rows */
+    for (i = 0; i < n; ++i) {
+        states[i].path = json_path_compile(columns[i].path, alloc_func);
+        if (!states[i].path)
+            goto done;
+        hint_count += states[i].path->count;
+    }
+    hints = (unsigned int*)alloc_func(NULL, 0, sizeof(unsigned int) * hint_count);
+    if (!hints)
+        goto done;
+    memset(hints, 0, sizeof(unsigned int) * hint_count);
+    for (i = 0, hint_count = 0; i < n; ++i) {
+        states[i].hints = hints + hint_count;
+        hint_count += states[i].path->count;
+        if (columns[i].valid)
+            memset(columns[i].valid, 0, (rows + 7) / 8);
+    }
+
+    if (!json_iter_begin(&it, array))
+        goto done;
+    while (json_iter_next(&it)) {
+        for (i = 0; i < n; ++i) {
+            if (_column_store(columns + i, it.index, _eval_hinted(it.value, states[i].path, states[i].hints)) && 
+                columns[i].valid)
+                columns[i].valid[it.index / 8] |= (unsigned char)(1 << (it.index % 8));
+        }
+    }
+    res = rows;
+
+done:
+    for (i = 0; i < n; ++i)
+        json_path_free(states[i].path);
+    if (hints)
+        alloc_func(hints, sizeof(unsigned int) * hint_count, 0);
+    alloc_func(states, sizeof(_json_column_state) * n, 0);
+    return res;
+}
+
+/*----------------------------------------------------------------------------*/
+
+static json_value* _eval_hinted(json_value *v, const json_path *path, unsigned int *hints)
+{
+    /* json_path_eval, with a guess for each member lookup */
+    unsigned int i;
+
+    for (i = 0; i < path->count; ++i) {
+        switch (json_type(v))
+        {
+        case json_type_object:
+            v = json_object_get_hint(v, &path->segments[i].key, hints + i);
+            break;
+        case json_type_array:
+            v = json_array_get(v, path->segments[i].index);
+            break;
+        default:
+            return NULL;
+        }
+        if (!v)
+            return NULL;
+    }
+
+    return v;
+}
+
+static int _column_store(json_column *column, unsigned int row, json_value *v)
+{
+    /* the value at row, a zero or NaN if v is missing or of another type */
+    json_value_type type = v ? json_type(v) : json_type_null;
+    json_slice *slice;
+    double dbl;
+
+    switch (column->type)
+    {
+    case json_column_double:
+        ((double*)column->data)[row] = json_as_number(v);  /* NaN for other types too */
+        return type == json_type_number;
+
+    case json_column_int64:
+        ((int64_t*)column->data)[row] = 0;
+        if (type != json_type_number)
+            return 0;
+        dbl = json_number_get(v);
+        if (dbl < -9223372036854775808.0 || dbl >= 9223372036854775808.0 || (double)(int64_t)dbl != dbl)
+            return 0;
+        ((int64_t*)column->data)[row] = (int64_t)dbl;
+        return 1;
+
+    case json_column_string:
+        slice = (json_slice*)column->data + row;
+        slice->str = type == json_type_string ? json_string_get(v) : NULL;
+        slice->len = type == json_type_string ? json_string_len(v) : 0;
+        return type == json_type_string;
+
+    case json_column_boolean:
+        ((unsigned char*)column->data)[row] = type == json_type_true;
+        return type == json_type_true || type == json_type_false;
+    }
+
+    return 0;
+}
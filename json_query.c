@@ -0,0 +1,1514 @@
+/*
+ jsonkit ( https://github.com/zhuyie/jsonkit )
+
+ Copyright (c) 2014, zhuyie
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+    A JSONPath subset:
+
+    $                 the root
+    .name ['name']    member of an object
+    .* [*]            all members / elements
+    ..                recursive descent, followed by one of the other selectors
+    [n]               array element, negative n counts from the end
+    [start:end:step]  array slice, all parts optional, step > 0
+    [?(expr)]         members / elements that satisfy expr
+
+    expr is made of comparisons (== != < <= > >=) between @-relative paths 
+    (@, @.name, @['name'], @[n]) and literals (numbers, 'strings', "strings", 
+    true, false, null), existence tests (@.name), parentheses, && and ||.
+
+    json_query_stream runs the same steps over the parser events. Each value 
+    carries the set of steps that are still to be applied to its children, so 
+    the parts of the text that cannot match are only validated. The steps that 
+    cannot be decided at the start of a value are deferred to its end, where 
+    the byte range of the value is known: a filter follows its @ paths through 
+    the events of the candidate and compares the scalars they reach in the text, 
+    and a negative index waits for the size of the array. The candidate is then 
+    scanned again with the remaining steps. A negative index in an @ path cannot 
+    be followed that way, such filters parse each candidate alone.
+*/
+
+#include "json.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <assert.h>
+
+/*----------------------------------------------------------------------------*/
+
+enum step_kinds {
+    STEP_NAME = 1,
+    STEP_WILDCARD,
+    STEP_INDEX,
+    STEP_SLICE,
+    STEP_FILTER
+};
+
+enum expr_ops {
+    EXPR_OR = 1,
+    EXPR_AND,
+    EXPR_EXISTS,
+    EXPR_EQ,
+    EXPR_NE,
+    EXPR_LT,
+    EXPR_LE,
+    EXPR_GT,
+    EXPR_GE
+};
+
+enum operand_kinds {
+    OPERAND_PATH = 1,
+    OPERAND_NUMBER,
+    OPERAND_STRING,
+    OPERAND_TRUE,
+    OPERAND_FALSE,
+    OPERAND_NULL
+};
+
+typedef struct _query_segment {  /* one step of an @-relative path */
+    json_key key;
+    unsigned int name_offset;
+    int index;
+    int is_index;
+} _query_segment;
+
+typedef struct _query_operand {
+    int kind;
+    double number;
+    json_key str;                /* OPERAND_STRING */
+    unsigned int str_offset;
+    unsigned int first, count;   /* OPERAND_PATH, range in segments */
+} _query_operand;
+
+typedef struct _query_expr {
+    int op;
+    unsigned int left, right;    /* EXPR_OR, EXPR_AND */
+    _query_operand a, b;         /* comparisons, EXPR_EXISTS only uses a */
+} _query_expr;
+
+typedef struct _query_step {
+    int kind;
+    int descendant;              /* preceded by .. */
+    json_key key;                /* STEP_NAME */
+    unsigned int name_offset;
+    int index;                   /* STEP_INDEX */
+    int start, end, step;        /* STEP_SLICE */
+    int has_start, has_end;
+    unsigned int expr;           /* STEP_FILTER, the root expression */
+} _query_step;
+
+struct json_query {
+    json_alloc_func alloc_func;
+    _query_step *steps;
+    unsigned int step_count, step_capacity;
+    _query_expr *exprs;
+    unsigned int expr_count, expr_capacity;
+    _query_segment *segments;
+    unsigned int segment_count, segment_capacity;
+    char *names;  /* all names and string literals, unescaped */
+    unsigned int names_size, names_capacity;
+};
+
+typedef struct _compiler {
+    json_query *q;
+    const char *p;
+} _compiler;
+
+typedef struct _query_out {
+    json_value **results;
+    unsigned int capacity;
+    unsigned int count;
+} _query_out;
+
+#define MAX_STREAM_STEPS 63      /* step sets are bitmasks, with one more bit for "matched" */
+#define UNKNOWN_SIZE ((size_t)-1)
+
+enum stream_status {
+    STREAM_OK = 0,
+    STREAM_STOPPED,              /* by the callback */
+    STREAM_FAILED                /* bad text or out of memory */
+};
+
+typedef struct _probe_slot {     /* an @ path of a filter, followed through the events */
+    unsigned int matched;        /* segments matched on the way to the current value */
+    int found;
+    json_value_type type;
+    size_t index, len;           /* the text of a scalar */
+} _probe_slot;
+
+typedef struct _stream_level {   /* an object or array being scanned */
+    json_value_type type;
+    uint64_t states;             /* steps to apply to the children */
+    uint64_t filters;            /* filter steps waiting for this value to end */
+    uint64_t noprop;             /* steps whose descendant part is already done */
+    size_t count;                /* children so far */
+    size_t size;                 /* children in total, if known */
+    size_t key_begin, key_len;   /* the member name of the next child */
+    _probe_slot *probe;          /* two per expression, for the filters of this value */
+} _stream_level;
+
+typedef struct _stream {
+    const json_query *q;
+    const json_query_stream_config *config;
+    const char *json;
+    _stream_level *levels;
+    int top;
+    uint64_t root_states, root_noprop;
+    size_t root_size;
+    int probing;                 /* filters are decided on the events */
+    int matches;
+    int status;
+} _stream;
+
+extern void* json_default_alloc_func(
+    void *ptr, 
+    size_t osize, 
+    size_t nsize
+    );
+extern json_value* json_share(
+    json_value *v
+    );
+static int _parse_step(
+    _compiler *c
+    );
+static void _match(
+    const json_query *q, 
+    unsigned int i, 
+    json_value *v, 
+    _query_out *out
+    );
+static void _fixup_names(
+    json_query *q
+    );
+static void _stream_run(
+    _stream *s, 
+    size_t len
+    );
+
+/*----------------------------------------------------------------------------*/
+
+json_query* json_query_compile(const char *expr, json_alloc_func alloc_func)
+{
+    json_query *q;
+    _compiler c;
+
+    assert(expr);
+
+    if (!alloc_func)
+        alloc_func = json_default_alloc_func;
+
+    q = (json_query*)alloc_func(NULL, 0, sizeof(json_query));
+    if (!q)
+        return NULL;
+    memset(q, 0, sizeof(json_query));
+    q->alloc_func = alloc_func;
+
+    c.q = q;
+    c.p = expr;
+    while (*c.p == ' ')
+        c.p++;
+    if (*c.p++ != '$') {
+        json_query_free(q);
+        return NULL;
+    }
+    while (*c.p) {
+        if (!_parse_step(&c)) {
+            json_query_free(q);
+            return NULL;
+        }
+    }
+
+    /* the name pool does not move any more */
+    _fixup_names(q);
+
+    return q;
+}
+
+unsigned int json_query_eval(const json_query *query, json_value *v, json_value **results, unsigned int capacity)
+{
+    _query_out out;
+
+    assert(query);
+    assert(v);
+    assert(results || !capacity);
+
+    out.results = results;
+    out.capacity = capacity;
+    out.count = 0;
+    _match(query, 0, v, &out);
+
+    return out.count;
+}
+
+void json_query_free(json_query *query)
+{
+    json_alloc_func alloc_func;
+
+    if (!query)
+        return;
+    alloc_func = query->alloc_func;
+    alloc_func(query->steps, sizeof(_query_step) * query->step_capacity, 0);
+    alloc_func(query->exprs, sizeof(_query_expr) * query->expr_capacity, 0);
+    alloc_func(query->segments, sizeof(_query_segment) * query->segment_capacity, 0);
+    alloc_func(query->names, query->names_capacity, 0);
+    alloc_func(query, sizeof(json_query), 0);
+}
+
+int json_query_stream(const json_query *query, const char *json, size_t len, json_query_stream_config config)
+{
+    _stream s;
+    unsigned int i;
+
+    assert(query);
+    assert(json);
+    assert(config.match);
+    assert(config.depth > 1);
+
+    if (query->step_count > MAX_STREAM_STEPS)
+        return -1;
+    if (!config.alloc_func)
+        config.alloc_func = json_default_alloc_func;
+
+    memset(&s, 0, sizeof(_stream));
+    s.q = query;
+    s.config = &config;
+    s.json = json;
+    s.root_states = 1;  /* step 0 */
+    s.root_size = UNKNOWN_SIZE;
+    s.probing = 1;
+    for (i = 0; i < query->segment_count; ++i) {
+        if (query->segments[i].is_index && query->segments[i].index < 0)
+            s.probing = 0;
+    }
+    _stream_run(&s, len);
+
+    return s.status == STREAM_FAILED ? -1 : s.matches;
+}
+
+/*----------------------------------------------------------------------------*/
+
+static int _grow(json_query *q, void **items, unsigned int *capacity, unsigned int count, size_t size)
+{
+    unsigned int c;
+    void *p;
+
+    if (count < *capacity)
+        return 1;
+
+    c = *capacity ? *capacity * 2 : 8;
+    p = q->alloc_func(*items, size * *capacity, size * c);  /* realloc */
+    if (!p)
+        return 0;
+    *items = p;
+    *capacity = c;
+    return 1;
+}
+
+static _query_step* _new_step(json_query *q)
+{
+    _query_step *step;
+
+    if (!_grow(q, (void**)&q->steps, &q->step_capacity, q->step_count, sizeof(_query_step)))
+        return NULL;
+    step = q->steps + q->step_count++;
+    memset(step, 0, sizeof(_query_step));
+    return step;
+}
+
+static int _new_expr(json_query *q, unsigned int *index)
+{
+    if (!_grow(q, (void**)&q->exprs, &q->expr_capacity, q->expr_count, sizeof(_query_expr)))
+        return 0;
+    *index = q->expr_count++;
+    memset(q->exprs + *index, 0, sizeof(_query_expr));
+    return 1;
+}
+
+static _query_segment* _new_segment(json_query *q)
+{
+    _query_segment *segment;
+
+    if (!_grow(q, (void**)&q->segments, &q->segment_capacity, q->segment_count, sizeof(_query_segment)))
+        return NULL;
+    segment = q->segments + q->segment_count++;
+    memset(segment, 0, sizeof(_query_segment));
+    return segment;
+}
+
+static int _add_name(json_query *q, const char *str, unsigned int len, unsigned int *offset)
+{
+    unsigned int capacity;
+    char *p;
+
+    capacity = q->names_capacity;
+    while (q->names_size + len + 1 > capacity)
+        capacity = capacity ? capacity * 2 : 64;
+    if (capacity != q->names_capacity) {
+        p = (char*)q->alloc_func(q->names, q->names_capacity, capacity);  /* realloc */
+        if (!p)
+            return 0;
+        q->names = p;
+        q->names_capacity = capacity;
+    }
+
+    *offset = q->names_size;
+    memcpy(q->names + q->names_size, str, len);
+    q->names[q->names_size + len] = '\0';
+    q->names_size += len + 1;
+    return 1;
+}
+
+static void _fixup_names(json_query *q)
+{
+    unsigned int i;
+    _query_step *step;
+    _query_expr *expr;
+    _query_segment *segment;
+
+    for (i = 0; i < q->step_count; ++i) {
+        step = q->steps + i;
+        if (step->kind == STEP_NAME)
+            json_key_init(&step->key, q->names + step->name_offset, step->key.len);
+    }
+    for (i = 0; i < q->expr_count; ++i) {
+        expr = q->exprs + i;
+        if (expr->a.kind == OPERAND_STRING)
+            json_key_init(&expr->a.str, q->names + expr->a.str_offset, expr->a.str.len);
+        if (expr->b.kind == OPERAND_STRING)
+            json_key_init(&expr->b.str, q->names + expr->b.str_offset, expr->b.str.len);
+    }
+    for (i = 0; i < q->segment_count; ++i) {
+        segment = q->segments + i;
+        if (!segment->is_index)
+            json_key_init(&segment->key, q->names + segment->name_offset, segment->key.len);
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+
+static void _skip_spaces(_compiler *c)
+{
+    while (*c->p == ' ' || *c->p == '\t' || *c->p == '\r' || *c->p == '\n')
+        c->p++;
+}
+
+static int _parse_int(_compiler *c, int *num)
+{
+    int negative = 0, digits = 0;
+
+    _skip_spaces(c);
+    if (*c->p == '-') {
+        negative = 1;
+        c->p++;
+    }
+    *num = 0;
+    while (*c->p >= '0' && *c->p <= '9') {
+        if (*num > (INT_MAX - (*c->p - '0')) / 10)
+            return 0;  /* out of range, stops on a digit so the step fails */
+        *num = *num * 10 + (*c->p++ - '0');
+        digits++;
+    }
+    if (negative)
+        *num = -*num;
+    _skip_spaces(c);
+    return digits > 0;
+}
+
+static int _parse_quoted(_compiler *c, unsigned int *offset, unsigned int *len)
+{
+    /* 'name' or "name", a backslash escapes the next character */
+    char quote = *c->p++, tmp[256] = {0}, *buf = tmp;
+    unsigned int n = 0, cb = sizeof(tmp);
+    int ok;
+
+    while (*c->p != quote) {
+        if (!*c->p)
+            goto Fail;
+        if (*c->p == '\\' && c->p[1])
+            c->p++;
+        if (n == cb) {
+            char *p = (char*)c->q->alloc_func(buf == tmp ? NULL : buf, buf == tmp ? 0 : cb, cb * 2);
+            if (!p)
+                goto Fail;
+            if (buf == tmp)
+                memcpy(p, tmp, n);
+            buf = p;
+            cb *= 2;
+        }
+        buf[n++] = *c->p++;
+    }
+    c->p++;
+
+    ok = _add_name(c->q, buf, n, offset);
+    *len = n;
+    if (buf != tmp)
+        c->q->alloc_func(buf, cb, 0);
+    return ok;
+
+Fail:
+    if (buf != tmp)
+        c->q->alloc_func(buf, cb, 0);
+    return 0;
+}
+
+static int _is_name_char(char ch)
+{
+    return ch && !strchr(".[]()=!<>&|,' \t\r\n\"", ch);
+}
+
+static int _parse_relative_path(_compiler *c, _query_operand *operand)
+{
+    /* @.name, @['name'], @[n] */
+    _query_segment *segment;
+    const char *begin;
+
+    assert(*c->p == '@');
+    c->p++;
+
+    operand->kind = OPERAND_PATH;
+    operand->first = c->q->segment_count;
+    operand->count = 0;
+
+    for (;;) {
+        if (*c->p == '.') {
+            c->p++;
+            begin = c->p;
+            while (_is_name_char(*c->p))
+                c->p++;
+            if (c->p == begin)
+                return 0;
+            segment = _new_segment(c->q);
+            if (!segment)
+                return 0;
+            segment->key.len = (unsigned int)(c->p - begin);
+            if (!_add_name(c->q, begin, segment->key.len, &segment->name_offset))
+                return 0;
+
+        } else if (*c->p == '[') {
+            c->p++;
+            _skip_spaces(c);
+            segment = _new_segment(c->q);
+            if (!segment)
+                return 0;
+            if (*c->p == '\'' || *c->p == '\"') {
+                if (!_parse_quoted(c, &segment->name_offset, &segment->key.len))
+                    return 0;
+                _skip_spaces(c);
+            } else {
+                segment->is_index = 1;
+                if (!_parse_int(c, &segment->index))
+                    return 0;
+            }
+            if (*c->p++ != ']')
+                return 0;
+
+        } else {
+            break;
+        }
+        operand->count++;
+    }
+
+    return 1;
+}
+
+static int _parse_operand(_compiler *c, _query_operand *operand)
+{
+    char *end;
+
+    _skip_spaces(c);
+
+    if (*c->p == '@') {
+        if (!_parse_relative_path(c, operand))
+            return 0;
+    } else if (*c->p == '\'' || *c->p == '\"') {
+        operand->kind = OPERAND_STRING;
+        if (!_parse_quoted(c, &operand->str_offset, &operand->str.len))
+            return 0;
+    } else if (strncmp(c->p, "true", 4) == 0) {
+        operand->kind = OPERAND_TRUE;
+        c->p += 4;
+    } else if (strncmp(c->p, "false", 5) == 0) {
+        operand->kind = OPERAND_FALSE;
+        c->p += 5;
+    } else if (strncmp(c->p, "null", 4) == 0) {
+        operand->kind = OPERAND_NULL;
+        c->p += 4;
+    } else {
+        operand->kind = OPERAND_NUMBER;
+        operand->number = strtod(c->p, &end);
+        if (end == c->p)
+            return 0;
+        c->p = end;
+    }
+
+    _skip_spaces(c);
+    return 1;
+}
+
+static int _parse_or(_compiler *c, unsigned int *index);
+
+static int _parse_term(_compiler *c, unsigned int *index)
+{
+    static const struct {
+        const char *str;
+        int op;
+    } ops[] = {
+        { "==", EXPR_EQ }, { "!=", EXPR_NE }, { "<=", EXPR_LE }, 
+        { ">=", EXPR_GE }, { "<", EXPR_LT }, { ">", EXPR_GT }
+    };
+    _query_expr *expr;
+    _query_operand a, b;
+    int i, op = 0;
+
+    _skip_spaces(c);
+    if (*c->p == '(') {
+        c->p++;
+        if (!_parse_or(c, index))
+            return 0;
+        if (*c->p++ != ')')
+            return 0;
+        _skip_spaces(c);
+        return 1;
+    }
+
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    if (!_parse_operand(c, &a))
+        return 0;
+    for (i = 0; i < (int)(sizeof(ops) / sizeof(ops[0])); ++i) {
+        if (strncmp(c->p, ops[i].str, strlen(ops[i].str)) == 0) {
+            op = ops[i].op;
+            c->p += strlen(ops[i].str);
+            break;
+        }
+    }
+    if (op) {
+        if (!_parse_operand(c, &b))
+            return 0;
+    } else {
+        if (a.kind != OPERAND_PATH)
+            return 0;
+        op = EXPR_EXISTS;
+    }
+
+    if (!_new_expr(c->q, index))
+        return 0;
+    expr = c->q->exprs + *index;
+    expr->op = op;
+    expr->a = a;
+    expr->b = b;
+    return 1;
+}
+
+static int _parse_and(_compiler *c, unsigned int *index)
+{
+    unsigned int left, right;
+
+    if (!_parse_term(c, &left))
+        return 0;
+    while (c->p[0] == '&' && c->p[1] == '&') {
+        c->p += 2;
+        if (!_parse_term(c, &right))
+            return 0;
+        if (!_new_expr(c->q, index))
+            return 0;
+        c->q->exprs[*index].op = EXPR_AND;
+        c->q->exprs[*index].left = left;
+        c->q->exprs[*index].right = right;
+        left = *index;
+    }
+    *index = left;
+    return 1;
+}
+
+static int _parse_or(_compiler *c, unsigned int *index)
+{
+    unsigned int left, right;
+
+    if (!_parse_and(c, &left))
+        return 0;
+    while (c->p[0] == '|' && c->p[1] == '|') {
+        c->p += 2;
+        if (!_parse_and(c, &right))
+            return 0;
+        if (!_new_expr(c->q, index))
+            return 0;
+        c->q->exprs[*index].op = EXPR_OR;
+        c->q->exprs[*index].left = left;
+        c->q->exprs[*index].right = right;
+        left = *index;
+    }
+    *index = left;
+    return 1;
+}
+
+static int _parse_bracket(_compiler *c, _query_step *step)
+{
+    /* the '[' is consumed */
+    _skip_spaces(c);
+
+    if (*c->p == '*') {
+        c->p++;
+        step->kind = STEP_WILDCARD;
+        _skip_spaces(c);
+
+    } else if (*c->p == '\'' || *c->p == '\"') {
+        step->kind = STEP_NAME;
+        if (!_parse_quoted(c, &step->name_offset, &step->key.len))
+            return 0;
+        _skip_spaces(c);
+
+    } else if (*c->p == '?') {
+        c->p++;
+        step->kind = STEP_FILTER;
+        if (!_parse_or(c, &step->expr))
+            return 0;
+
+    } else {
+        step->kind = STEP_INDEX;
+        step->has_start = _parse_int(c, &step->start);
+        if (*c->p == ':') {
+            c->p++;
+            step->kind = STEP_SLICE;
+            step->has_end = _parse_int(c, &step->end);
+            step->step = 1;
+            if (*c->p == ':') {
+                c->p++;
+                if (!_parse_int(c, &step->step) || step->step <= 0)
+                    return 0;
+            }
+        } else {
+            if (!step->has_start)
+                return 0;
+            step->index = step->start;
+        }
+    }
+
+    return *c->p++ == ']';
+}
+
+static int _parse_step(_compiler *c)
+{
+    _query_step *step;
+    const char *begin;
+    int descendant = 0;
+
+    if (c->p[0] == '.' && c->p[1] == '.') {
+        descendant = 1;
+        c->p += 2;
+    } else if (c->p[0] == '.') {
+        c->p += 1;
+    } else if (c->p[0] != '[') {
+        return 0;
+    }
+
+    step = _new_step(c->q);
+    if (!step)
+        return 0;
+    step->descendant = descendant;
+
+    if (*c->p == '[') {
+        c->p++;
+        return _parse_bracket(c, step);
+    }
+
+    if (*c->p == '*') {
+        c->p++;
+        step->kind = STEP_WILDCARD;
+        return 1;
+    }
+
+    begin = c->p;
+    while (*c->p && *c->p != '.' && *c->p != '[')
+        c->p++;
+    if (c->p == begin)
+        return 0;
+    step->kind = STEP_NAME;
+    step->key.len = (unsigned int)(c->p - begin);
+    return _add_name(c->q, begin, step->key.len, &step->name_offset);
+}
+
+/*----------------------------------------------------------------------------*/
+
+typedef struct _scalar {
+    int type;
+    double number;
+    const char *str;
+    unsigned int len;
+} _scalar;
+
+static json_value* _eval_relative_path(const json_query *q, const _query_operand *operand, json_value *v)
+{
+    const _query_segment *segment, *end;
+
+    segment = q->segments + operand->first;
+    for (end = segment + operand->count; segment != end && v; ++segment) {
+        if (segment->is_index) {
+            int index = segment->index;
+            if (index < 0 && json_type(v) == json_type_array)
+                index += (int)json_array_size(v);
+            v = index >= 0 ? json_array_get(v, (unsigned int)index) : NULL;
+        } else {
+            v = json_object_get_key(v, &segment->key);
+        }
+    }
+
+    return v;
+}
+
+static int _eval_operand(const json_query *q, const _query_operand *operand, json_value *v, _scalar *out)
+{
+    switch (operand->kind)
+    {
+    case OPERAND_PATH:
+        v = _eval_relative_path(q, operand, v);
+        if (!v)
+            return 0;
+        out->type = json_type(v);
+        if (out->type == json_type_number) {
+            out->number = json_number_get(v);
+        } else if (out->type == json_type_string) {
+            out->str = json_string_get(v);
+            out->len = json_string_len(v);
+        }
+        return 1;
+
+    case OPERAND_NUMBER:
+        out->type = json_type_number;
+        out->number = operand->number;
+        return 1;
+
+    case OPERAND_STRING:
+        out->type = json_type_string;
+        out->str = operand->str.name;
+        out->len = operand->str.len;
+        return 1;
+
+    case OPERAND_TRUE:
+        out->type = json_type_true;
+        return 1;
+
+    case OPERAND_FALSE:
+        out->type = json_type_false;
+        return 1;
+
+    case OPERAND_NULL:
+        out->type = json_type_null;
+        return 1;
+    }
+
+    assert(0);
+    return 0;
+}
+
+static int _compare(int op, const _scalar *a, const _scalar *b)
+{
+    int cmp;
+
+    if (a->type != b->type)
+        return op == EXPR_NE;
+
+    switch (a->type)
+    {
+    case json_type_number:
+        if (a->number < b->number)
+            cmp = -1;
+        else if (a->number > b->number)
+            cmp = 1;
+        else if (a->number == b->number)
+            cmp = 0;
+        else  /* NaN */
+            return op == EXPR_NE;
+        break;
+
+    case json_type_string:
+        cmp = memcmp(a->str, b->str, a->len < b->len ? a->len : b->len);
+        if (!cmp)
+            cmp = a->len < b->len ? -1 : (a->len > b->len ? 1 : 0);
+        break;
+
+    case json_type_true:
+    case json_type_false:
+    case json_type_null:
+        /* no ordering */
+        return op == EXPR_EQ;
+
+    default:
+        /* objects and arrays are not compared by value */
+        return op == EXPR_NE;
+    }
+
+    switch (op)
+    {
+    case EXPR_EQ: return cmp == 0;
+    case EXPR_NE: return cmp != 0;
+    case EXPR_LT: return cmp < 0;
+    case EXPR_LE: return cmp <= 0;
+    case EXPR_GT: return cmp > 0;
+    case EXPR_GE: return cmp >= 0;
+    }
+
+    assert(0);
+    return 0;
+}
+
+static int _eval_expr(const json_query *q, unsigned int index, json_value *v)
+{
+    const _query_expr *expr = q->exprs + index;
+    _scalar a, b;
+
+    switch (expr->op)
+    {
+    case EXPR_OR:
+        return _eval_expr(q, expr->left, v) || _eval_expr(q, expr->right, v);
+
+    case EXPR_AND:
+        return _eval_expr(q, expr->left, v) && _eval_expr(q, expr->right, v);
+
+    case EXPR_EXISTS:
+        return _eval_relative_path(q, &expr->a, v) != NULL;
+
+    default:
+        if (!_eval_operand(q, &expr->a, v, &a) || !_eval_operand(q, &expr->b, v, &b))
+            return 0;
+        return _compare(expr->op, &a, &b);
+    }
+}
+
+static unsigned int _child_count(json_value *v)
+{
+    switch (json_type(v))
+    {
+    case json_type_object:
+        return json_object_size(v);
+    case json_type_array:
+        return json_array_size(v);
+    default:
+        return 0;
+    }
+}
+
+static json_value* _child(json_value *v, unsigned int i)
+{
+    return json_type(v) == json_type_object ? json_object_value_by_index(v, i) : json_array_get(v, i);
+}
+
+static void _select(const json_query *q, unsigned int i, json_value *v, _query_out *out)
+{
+    /* apply the selector of step i to the children of v */
+    const _query_step *step = q->steps + i;
+    json_value *child;
+    unsigned int n, k;
+    int index, start, end;
+
+    switch (step->kind)
+    {
+    case STEP_NAME:
+        child = json_object_get_key(v, &step->key);
+        if (child)
+            _match(q, i + 1, child, out);
+        break;
+
+    case STEP_WILDCARD:
+        for (k = 0, n = _child_count(v); k < n; ++k)
+            _match(q, i + 1, _child(v, k), out);
+        break;
+
+    case STEP_INDEX:
+        if (json_type(v) != json_type_array)
+            break;
+        index = step->index;
+        if (index < 0)
+            index += (int)json_array_size(v);
+        if (index >= 0 && (child = json_array_get(v, (unsigned int)index)))
+            _match(q, i + 1, child, out);
+        break;
+
+    case STEP_SLICE:
+        if (json_type(v) != json_type_array)
+            break;
+        n = json_array_size(v);
+        start = step->has_start ? step->start : 0;
+        end = step->has_end ? step->end : (int)n;
+        if (start < 0)
+            start += (int)n;
+        if (end < 0)
+            end += (int)n;
+        if (start < 0)
+            start = 0;
+        if (end > (int)n)
+            end = (int)n;
+        for (index = start; index < end; index += step->step)
+            _match(q, i + 1, json_array_get(v, (unsigned int)index), out);
+        break;
+
+    case STEP_FILTER:
+        for (k = 0, n = _child_count(v); k < n; ++k) {
+            child = _child(v, k);
+            if (_eval_expr(q, step->expr, child))
+                _match(q, i + 1, child, out);
+        }
+        break;
+
+    default:
+        assert(0);
+    }
+}
+
+static void _match(const json_query *q, unsigned int i, json_value *v, _query_out *out)
+{
+    unsigned int n, k;
+
+    if (i == q->step_count) {
+        if (out->count < out->capacity)
+            out->results[out->count] = v;
+        out->count++;
+        return;
+    }
+
+    _select(q, i, v, out);
+
+    if (q->steps[i].descendant) {
+        /* .. applies the selector at every level below v as well */
+        for (k = 0, n = _child_count(v); k < n; ++k)
+            _match(q, i, _child(v, k), out);
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+
+static int _needs_size(const _query_step *step)
+{
+    if (step->kind == STEP_INDEX)
+        return step->index < 0;
+    if (step->kind == STEP_SLICE)
+        return (step->has_start && step->start < 0) || (step->has_end && step->end < 0);
+    return 0;
+}
+
+static int _stream_selects(const _query_step *step, size_t k, size_t size)
+{
+    /* is the k-th element selected by an index or slice step */
+    long start, end;
+
+    if (step->kind == STEP_INDEX) {
+        start = step->index < 0 ? step->index + (long)size : step->index;
+        return start >= 0 && (size_t)start == k;
+    }
+
+    start = step->has_start ? step->start : 0;
+    if (start < 0)
+        start += (long)size;
+    if (start < 0)
+        start = 0;
+    if (step->has_end) {
+        end = step->end < 0 ? step->end + (long)size : step->end;
+        if ((long)k >= end)
+            return 0;
+    }
+    return (long)k >= start && ((long)k - start) % step->step == 0;
+}
+
+static void _stream_child(_stream *s, uint64_t *states, uint64_t *filters)
+{
+    /* the steps for a new value, from the level it belongs to */
+    const json_query *q = s->q;
+    const _query_step *step;
+    _stream_level *parent;
+    uint64_t bit;
+    unsigned int i;
+
+    *states = 0;
+    *filters = 0;
+
+    if (s->top < 0) {
+        *states = s->root_states;
+        return;
+    }
+
+    parent = s->levels + s->top;
+    for (i = 0, bit = 1; i < q->step_count; ++i, bit <<= 1) {
+        if (!(parent->states & bit))
+            continue;
+        step = q->steps + i;
+        if (step->descendant && !(parent->noprop & bit))
+            *states |= bit;
+
+        switch (step->kind)
+        {
+        case STEP_NAME:
+            if (parent->type == json_type_object && 
+                parent->key_len == step->key.len && 
+                !memcmp(s->json + parent->key_begin, step->key.name, step->key.len))
+                *states |= bit << 1;
+            break;
+
+        case STEP_WILDCARD:
+            *states |= bit << 1;
+            break;
+
+        case STEP_INDEX:
+        case STEP_SLICE:
+            /* negative ones are resolved when the array ends */
+            if (parent->type == json_type_array && 
+                (parent->size != UNKNOWN_SIZE || !_needs_size(step)) &&
+                _stream_selects(step, parent->count, parent->size))
+                *states |= bit << 1;
+            break;
+
+        case STEP_FILTER:
+            *filters |= bit;
+            break;
+
+        default:
+            assert(0);
+        }
+    }
+    parent->count++;
+}
+
+static int _stream_number(_stream *s, size_t index, size_t len, double *number)
+{
+    /* the text is not terminated, longer numbers fail as in the parser */
+    char tmp[50];
+
+    if (len >= sizeof(tmp))
+        return 0;
+    memcpy(tmp, s->json + index, len);
+    tmp[len] = '\0';
+    *number = atof(tmp);
+    return 1;
+}
+
+static json_value* _stream_value(_stream *s, json_value_type type, size_t index, size_t len)
+{
+    /* parse a single value out of the text */
+    const json_query_stream_config *config = s->config;
+    const char *str = s->json + index;
+    json_parser_config parser_config;
+    json_parser *parser;
+    json_value *v = NULL;
+    double number;
+    size_t i;
+
+    switch (type)
+    {
+    case json_type_string:
+        return json_string_alloc(str + 1, (unsigned int)(len - 2), config->alloc_func);
+
+    case json_type_number:
+        if (!_stream_number(s, index, len, &number))
+            return NULL;
+        return json_number_alloc(number, config->alloc_func);
+
+    case json_type_true:
+    case json_type_false:
+        return json_boolean_alloc(type == json_type_true, config->alloc_func);
+
+    case json_type_null:
+        return json_null_alloc(config->alloc_func);
+
+    default:
+        parser_config.alloc_func = config->alloc_func;
+        parser_config.json_str = str;
+        parser_config.json_str_len = 0;
+        parser = json_parser_alloc(config->depth, parser_config);
+        if (!parser)
+            return NULL;
+        for (i = 0; i < len; ++i) {
+            if (!json_parser_char(parser, (unsigned char)str[i]))
+                break;
+        }
+        if (i == len)
+            v = json_parser_done(parser);
+        json_parser_free(parser);
+        return v;
+    }
+}
+
+static _probe_slot* _probe_begin(_stream *s, int top, json_value_type type, size_t index, size_t len)
+{
+    /* start following the @ paths from a candidate, at levels[top] */
+    const json_query *q = s->q;
+    _stream_level *level = s->levels + top;
+    const _query_operand *operand;
+    _probe_slot *slot;
+    unsigned int k;
+
+    if (!level->probe) {
+        level->probe = (_probe_slot*)s->config->alloc_func(NULL, 0, sizeof(_probe_slot) * 2 * q->expr_count);
+        if (!level->probe) {
+            s->status = STREAM_FAILED;
+            return NULL;
+        }
+    }
+
+    for (k = 0; k < 2 * q->expr_count; ++k) {
+        operand = k & 1 ? &q->exprs[k / 2].b : &q->exprs[k / 2].a;
+        slot = level->probe + k;
+        slot->matched = 0;
+        slot->found = operand->kind == OPERAND_PATH && operand->count == 0;  /* @ itself */
+        slot->type = type;
+        slot->index = index;
+        slot->len = len;
+    }
+    return level->probe;
+}
+
+static void _probe_child(_stream *s, json_value_type type, size_t index, size_t len)
+{
+    /* a new value, before it is counted: advance the @ paths of the candidates above */
+    const json_query *q = s->q;
+    _stream_level *parent = s->levels + s->top;
+    const _query_operand *operand;
+    const _query_segment *segment;
+    _probe_slot *slot;
+    unsigned int k, depth;
+    int i;
+
+    for (i = 0; s->probing && i <= s->top; ++i) {
+        if (!s->levels[i].filters)
+            continue;
+        depth = (unsigned int)(s->top - i) + 1;
+        for (k = 0; k < 2 * q->expr_count; ++k) {
+            operand = k & 1 ? &q->exprs[k / 2].b : &q->exprs[k / 2].a;
+            slot = s->levels[i].probe + k;
+            if (operand->kind != OPERAND_PATH || operand->count < depth || slot->matched != depth - 1)
+                continue;
+            segment = q->segments + operand->first + depth - 1;
+            if (segment->is_index) {
+                if (parent->type != json_type_array || (size_t)segment->index != parent->count)
+                    continue;
+            } else {
+                if (parent->type != json_type_object || 
+                    parent->key_len != segment->key.len || 
+                    memcmp(s->json + parent->key_begin, segment->key.name, segment->key.len))
+                    continue;
+            }
+            /* a later member with the same name replaces what an earlier one found */
+            slot->found = depth == operand->count;
+            if (slot->found) {
+                slot->type = type;
+                slot->index = index;
+                slot->len = len;
+            } else if (type == json_type_object || type == json_type_array) {
+                slot->matched = depth;
+            }
+        }
+    }
+}
+
+static void _probe_leave(_stream *s)
+{
+    /* the container at levels[top] ends, step back on the paths that went into it */
+    const json_query *q = s->q;
+    _probe_slot *slot;
+    unsigned int k, depth;
+    int i;
+
+    for (i = 0; s->probing && i < s->top; ++i) {
+        if (!s->levels[i].filters)
+            continue;
+        depth = (unsigned int)(s->top - i);
+        for (k = 0; k < 2 * q->expr_count; ++k) {
+            slot = s->levels[i].probe + k;
+            if (slot->matched == depth)
+                slot->matched = depth - 1;
+        }
+    }
+}
+
+static int _probe_operand(_stream *s, const _probe_slot *slot, const _query_operand *operand, _scalar *out)
+{
+    /* like _eval_operand, from what the path reached in the text */
+    if (operand->kind != OPERAND_PATH)
+        return _eval_operand(s->q, operand, NULL, out);
+    if (!slot->found)
+        return 0;
+
+    out->type = slot->type;
+    if (out->type == json_type_number) {
+        if (!_stream_number(s, slot->index, slot->len, &out->number)) {
+            s->status = STREAM_FAILED;
+            return 0;
+        }
+    } else if (out->type == json_type_string) {
+        /* strings are kept as written, as by the parser */
+        out->str = s->json + slot->index + 1;
+        out->len = (unsigned int)(slot->len - 2);
+    }
+    return 1;
+}
+
+static int _probe_expr(_stream *s, const _probe_slot *probe, unsigned int index)
+{
+    /* like _eval_expr, out of memory sets STREAM_FAILED */
+    const _query_expr *expr = s->q->exprs + index;
+    _scalar a, b;
+
+    switch (expr->op)
+    {
+    case EXPR_OR:
+        return _probe_expr(s, probe, expr->left) || 
+            (s->status == STREAM_OK && _probe_expr(s, probe, expr->right));
+
+    case EXPR_AND:
+        return _probe_expr(s, probe, expr->left) && _probe_expr(s, probe, expr->right);
+
+    case EXPR_EXISTS:
+        return probe[2 * index].found;
+
+    default:
+        if (!_probe_operand(s, probe + 2 * index, &expr->a, &a) || 
+            !_probe_operand(s, probe + 2 * index + 1, &expr->b, &b))
+            return 0;
+        return _compare(expr->op, &a, &b);
+    }
+}
+
+static int _stream_emit(_stream *s, json_value_type type, size_t index, size_t len, json_value *v)
+{
+    json_value *value = NULL;
+
+    if (s->config->materialize) {
+        value = v ? json_share(v) : _stream_value(s, type, index, len);
+        if (!value) {
+            s->status = STREAM_FAILED;
+            return 0;
+        }
+    }
+
+    s->matches++;
+    if (!s->config->match(s->config->ctx, s->json + index, len, value)) {
+        s->status = STREAM_STOPPED;
+        return 0;
+    }
+    return 1;
+}
+
+static int _stream_again(
+    _stream *s, 
+    size_t index, 
+    size_t len, 
+    uint64_t states, 
+    uint64_t noprop, 
+    size_t size
+    )
+{
+    /* scan the range of a container again with some other steps */
+    _stream sub;
+
+    memset(&sub, 0, sizeof(_stream));
+    sub.q = s->q;
+    sub.config = s->config;
+    sub.json = s->json + index;
+    sub.root_states = states;
+    sub.root_noprop = noprop;
+    sub.root_size = size;
+    sub.probing = s->probing;
+    _stream_run(&sub, len);
+
+    s->matches += sub.matches;
+    if (sub.status != STREAM_OK) {
+        s->status = sub.status;
+        return 0;
+    }
+    return 1;
+}
+
+static int _stream_complete(
+    _stream *s, 
+    json_value_type type, 
+    size_t index, 
+    size_t len, 
+    uint64_t states, 
+    uint64_t filters, 
+    const _probe_slot *probe
+    )
+{
+    const json_query *q = s->q;
+    json_value *v = NULL;
+    uint64_t bit;
+    unsigned int i;
+    int res = 1;
+
+    if ((states & ((uint64_t)1 << q->step_count)) && !_stream_emit(s, type, index, len, NULL))
+        return 0;
+
+    if (!filters)
+        return 1;
+
+    if (!s->probing) {
+        v = _stream_value(s, type, index, len);
+        if (!v) {
+            s->status = STREAM_FAILED;
+            return 0;
+        }
+    }
+    for (i = 0, bit = 1; res && i < q->step_count; ++i, bit <<= 1) {
+        if (!(filters & bit))
+            continue;
+        if (!(v ? _eval_expr(q, q->steps[i].expr, v) : _probe_expr(s, probe, q->steps[i].expr))) {
+            if (s->status != STREAM_OK)
+                res = 0;
+            continue;
+        }
+        if (i + 1 == q->step_count)
+            res = _stream_emit(s, type, index, len, v);
+        else if (type == json_type_object || type == json_type_array)
+            res = _stream_again(s, index, len, bit << 1, 0, UNKNOWN_SIZE);
+    }
+    json_free(v);
+
+    return res;
+}
+
+static int _on_begin(void *ctx, json_value_type type, size_t index)
+{
+    _stream *s = (_stream*)ctx;
+    _stream_level *level;
+    uint64_t states, filters;
+
+    if (s->top >= 0)
+        _probe_child(s, type, index, 0);
+    _stream_child(s, &states, &filters);
+
+    /* the parser limits the nesting to fewer levels than its depth */
+    level = s->levels + ++s->top;
+    level->type = type;
+    level->states = states;
+    level->filters = filters;
+    level->noprop = s->top == 0 ? s->root_noprop : 0;
+    level->count = 0;
+    level->size = s->top == 0 ? s->root_size : UNKNOWN_SIZE;
+    level->key_begin = 0;
+    level->key_len = 0;
+
+    if (filters && s->probing && !_probe_begin(s, s->top, type, index, 0))
+        return 0;
+    return 1;
+}
+
+static int _on_end(void *ctx, json_value_type type, size_t index, size_t len)
+{
+    _stream *s = (_stream*)ctx;
+    const json_query *q = s->q;
+    _stream_level *level;
+    uint64_t sized = 0, bit;
+    unsigned int i;
+
+    _probe_leave(s);
+    level = s->levels + s->top--;
+    if (!_stream_complete(s, type, index, len, level->states, level->filters, level->probe))
+        return 0;
+
+    /* now the negative indexes can be resolved */
+    if (type == json_type_array && level->size == UNKNOWN_SIZE) {
+        for (i = 0, bit = 1; i < q->step_count; ++i, bit <<= 1) {
+            if ((level->states & bit) && _needs_size(q->steps + i))
+                sized |= bit;
+        }
+        if (sized && !_stream_again(s, index, len, sized, sized, level->count))
+            return 0;
+    }
+
+    return 1;
+}
+
+static int _on_key(void *ctx, size_t index, size_t len)
+{
+    _stream *s = (_stream*)ctx;
+
+    s->levels[s->top].key_begin = index;
+    s->levels[s->top].key_len = len;
+    return 1;
+}
+
+static int _on_scalar(void *ctx, json_value_type type, size_t index, size_t len)
+{
+    _stream *s = (_stream*)ctx;
+    const _probe_slot *probe = NULL;
+    uint64_t states, filters;
+
+    if (s->top >= 0)
+        _probe_child(s, type, index, len);
+    _stream_child(s, &states, &filters);
+    if (filters && s->probing) {
+        /* a scalar takes the level it would open */
+        probe = _probe_begin(s, s->top + 1, type, index, len);
+        if (!probe)
+            return 0;
+    }
+    return _stream_complete(s, type, index, len, states, filters, probe);
+}
+
+static void _stream_run(_stream *s, size_t len)
+{
+    const json_query_stream_config *config = s->config;
+    json_parser_events events;
+    json_parser *parser;
+    size_t size, i;
+    int k;
+
+    size = sizeof(_stream_level) * config->depth;
+    s->levels = (_stream_level*)config->alloc_func(NULL, 0, size);
+    if (!s->levels) {
+        s->status = STREAM_FAILED;
+        return;
+    }
+    memset(s->levels, 0, size);
+    s->top = -1;
+
+    events.ctx = s;
+    events.begin = _on_begin;
+    events.end = _on_end;
+    events.key = _on_key;
+    events.scalar = _on_scalar;
+    parser = json_parser_alloc_events(config->depth, &events);
+    if (parser) {
+        for (i = 0; i < len; ++i) {
+            if (!json_parser_char(parser, (unsigned char)s->json[i]))
+                break;
+        }
+        if (s->status == STREAM_OK && (i != len || !json_parser_complete(parser)))
+            s->status = STREAM_FAILED;
+        json_parser_free(parser);
+    } else {
+        s->status = STREAM_FAILED;
+    }
+
+    for (k = 0; k < config->depth; ++k) {
+        if (s->levels[k].probe)
+            config->alloc_func(s->levels[k].probe, sizeof(_probe_slot) * 2 * s->q->expr_count, 0);
+    }
+    config->alloc_func(s->levels, size, 0);
+}
@@ -0,0 +1,732 @@
+/*
+ jsonkit ( https://github.com/zhuyie/jsonkit )
+
+ Copyright (c) 2014, zhuyie
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "json.h"
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#ifdef _MSC_VER
+  #include <windows.h>
+#else
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ A snapshot file, integers in the byte order of the writer:
+
+   header   magic, version, byte order mark
+   nodes    8 byte aligned, the children before their parents
+   footer   offset of the root, size of the file, magic
+
+ Offsets inside a node are relative to the node itself, so a node needs 
+ nothing but its own address. Every node starts with a json_snode, then:
+
+   string   the characters and a NUL
+   number   the double
+   array    int64_t offsets of the elements
+   object   _snapshot_member entries in member order, an open addressing 
+            index of uint32_t slots (entry + 1, 0 if empty), the names
+*/
+
+#define SNAPSHOT_MAGIC    "jsonsnap"
+#define SNAPSHOT_VERSION  1
+#define SNAPSHOT_BOM      0x01020304
+
+/* member name hashes must be the same in every process, hence a fixed key */
+#define SNAPSHOT_K0       0x6a736f6e6b697430ULL
+#define SNAPSHOT_K1       0x736e617073686f74ULL
+
+typedef struct _snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t bom;
+} _snapshot_header;
+
+typedef struct _snapshot_footer {
+    uint64_t root;
+    uint64_t size;
+    char magic[8];
+} _snapshot_footer;
+
+struct json_snode {
+    uint32_t type;
+    uint32_t size;  /* string length, member or element count */
+};
+
+typedef struct _snapshot_member {
+    int64_t name;
+    int64_t value;
+    uint32_t name_len;
+    uint32_t hash;
+} _snapshot_member;
+
+struct json_snapshot {
+    json_alloc_func alloc_func;
+    const char *base;
+    size_t size;
+    const json_snode *root;
+};
+
+typedef struct _snapshot_writer {
+    FILE *fp;
+    uint64_t pos;
+    int failed;
+} _snapshot_writer;
+
+#define _SNODE_AT(n, offset)  ((const json_snode*)((const char*)(n) + (offset)))
+
+extern void* json_default_alloc_func(
+    void *ptr, 
+    size_t osize, 
+    size_t nsize
+    );
+extern unsigned int json_hash_keyed(
+    const char *str, 
+    size_t len, 
+    uint64_t k0, 
+    uint64_t k1
+    );
+extern double json_nan();
+extern unsigned int json_segment_to_index(
+    const char *str, 
+    unsigned int len
+    );
+static uint32_t _slot_count(
+    uint32_t size
+    );
+static unsigned int _container_size(
+    json_value *v
+    );
+static void _write(
+    _snapshot_writer *writer, 
+    const void *data, 
+    size_t len
+    );
+static void _write_pad(
+    _snapshot_writer *writer
+    );
+static void _write_node(
+    _snapshot_writer *writer, 
+    json_value *v, 
+    const uint64_t *offsets, 
+    json_alloc_func alloc_func
+    );
+static const json_snode* _snode_object_get(
+    const json_snode *n, 
+    const char *name, 
+    unsigned int len
+    );
+static int _check_nodes(
+    const char *base, 
+    size_t size, 
+    uint64_t root, 
+    json_alloc_func alloc_func
+    );
+static int _is_checked(
+    const unsigned char *starts, 
+    uint64_t pos, 
+    int64_t offset
+    );
+static uint64_t _check_node(
+    const char *base, 
+    uint64_t pos, 
+    uint64_t end, 
+    const unsigned char *starts
+    );
+
+/*----------------------------------------------------------------------------*/
+
+int json_snapshot_write(json_value *v, const char *path, json_alloc_func alloc_func)
+{
+    json_walker w;
+    json_walk_event event;
+    _snapshot_writer writer;
+    _snapshot_header header;
+    _snapshot_footer footer;
+    json_value *container;
+    uint64_t *offsets, *parent, offset;
+    unsigned int size;
+
+    assert(v);
+    assert(path);
+
+    if (!alloc_func)
+        alloc_func = json_default_alloc_func;
+
+    writer.fp = fopen(path, "wb");
+    if (!writer.fp)
+        return 0;
+    writer.pos = 0;
+    writer.failed = 0;
+
+    memcpy(header.magic, SNAPSHOT_MAGIC, 8);
+    header.version = SNAPSHOT_VERSION;
+    header.bom = SNAPSHOT_BOM;
+    _write(&writer, &header, sizeof(header));
+
+    /* post-order, each container collects the offsets of its children; after 
+       a failure the walk goes on without writing, to release them. Lazy 
+       containers are read from what the walker built for them */
+    footer.root = 0;
+    json_walk_begin(&w, v, alloc_func);
+    while ((event = json_walk_next(&w)) != json_walk_done) {
+        switch (event)
+        {
+        case json_walk_error:
+            writer.failed = 1;
+            offsets = (uint64_t*)json_walk_data(&w);
+            if (offsets)  /* the container was read on enter, it is still there */
+                alloc_func(offsets, sizeof(uint64_t) * _container_size(json_walk_container(&w)), 0);
+            continue;
+
+        case json_walk_enter:
+            container = json_walk_container(&w);
+            size = container ? _container_size(container) : 0;
+            offsets = size ? (uint64_t*)alloc_func(NULL, 0, sizeof(uint64_t) * size) : NULL;
+            if (!container || (size && !offsets)) {
+                writer.failed = 1;
+                json_walk_skip(&w);
+            } else {
+                json_walk_set_data(&w, offsets);
+            }
+            continue;
+
+        case json_walk_leave:
+            container = json_walk_container(&w);
+            offsets = (uint64_t*)json_walk_data(&w);
+            offset = writer.pos;
+            _write_node(&writer, container, offsets, alloc_func);
+            if (offsets)
+                alloc_func(offsets, sizeof(uint64_t) * _container_size(container), 0);
+            break;
+
+        default:
+            offset = writer.pos;
+            _write_node(&writer, w.value, NULL, alloc_func);
+            break;
+        }
+
+        parent = (uint64_t*)json_walk_parent_data(&w);
+        if (parent)
+            parent[w.index] = offset;
+        else if (w.depth == 0)
+            footer.root = offset;
+    }
+    json_walk_end(&w);
+
+    footer.size = writer.pos + sizeof(footer);
+    memcpy(footer.magic, SNAPSHOT_MAGIC, 8);
+    _write(&writer, &footer, sizeof(footer));
+
+    if (fclose(writer.fp) != 0)
+        writer.failed = 1;
+    if (writer.failed) {
+        remove(path);
+        return 0;
+    }
+    return 1;
+}
+
+json_snapshot* json_snapshot_open(const char *path, json_alloc_func alloc_func)
+{
+    json_snapshot *snapshot;
+    const _snapshot_header *header;
+    const _snapshot_footer *footer;
+    const char *base;
+    size_t size;
+#ifdef _MSC_VER
+    HANDLE file, mapping;
+    LARGE_INTEGER file_size;
+#else
+    struct stat st;
+    void *p;
+    int fd;
+#endif
+
+    assert(path);
+
+    if (!alloc_func)
+        alloc_func = json_default_alloc_func;
+
+#ifdef _MSC_VER
+    file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+    if (!GetFileSizeEx(file, &file_size) || 
+        (uint64_t)file_size.QuadPart < sizeof(_snapshot_header) + sizeof(_snapshot_footer)) {
+        CloseHandle(file);
+        return NULL;
+    }
+    size = (size_t)file_size.QuadPart;
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping)
+        return NULL;
+    base = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);  /* the view keeps it alive */
+    if (!base)
+        return NULL;
+#else
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) != 0 || 
+        (uint64_t)st.st_size < sizeof(_snapshot_header) + sizeof(_snapshot_footer)) {
+        close(fd);
+        return NULL;
+    }
+    size = (size_t)st.st_size;
+    p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);  /* the mapping keeps it alive */
+    if (p == MAP_FAILED)
+        return NULL;
+    base = (const char*)p;
+#endif
+
+    /* the frame first, then every node: readers follow offsets unchecked; 
+       the footer is only read once it is known to be aligned */
+    header = (const _snapshot_header*)base;
+    footer = (const _snapshot_footer*)(base + size - sizeof(_snapshot_footer));
+    snapshot = NULL;
+    if (size % 8 == 0 && 
+        memcmp(header->magic, SNAPSHOT_MAGIC, 8) == 0 && 
+        header->version == SNAPSHOT_VERSION && 
+        header->bom == SNAPSHOT_BOM && 
+        memcmp(footer->magic, SNAPSHOT_MAGIC, 8) == 0 && 
+        footer->size == size && 
+        footer->root >= sizeof(_snapshot_header) && 
+        footer->root % 8 == 0 && 
+        footer->root + sizeof(json_snode) <= size - sizeof(_snapshot_footer) && 
+        _check_nodes(base, size, footer->root, alloc_func))
+        snapshot = (json_snapshot*)alloc_func(NULL, 0, sizeof(json_snapshot));
+
+    if (!snapshot) {
+#ifdef _MSC_VER
+        UnmapViewOfFile(base);
+#else
+        munmap((void*)base, size);
+#endif
+        return NULL;
+    }
+
+    snapshot->alloc_func = alloc_func;
+    snapshot->base = base;
+    snapshot->size = size;
+    snapshot->root = (const json_snode*)(base + footer->root);
+    return snapshot;
+}
+
+const json_snode* json_snapshot_root(const json_snapshot *snapshot)
+{
+    assert(snapshot);
+    return snapshot->root;
+}
+
+void json_snapshot_close(json_snapshot *snapshot)
+{
+    if (!snapshot)
+        return;
+#ifdef _MSC_VER
+    UnmapViewOfFile(snapshot->base);
+#else
+    munmap((void*)snapshot->base, snapshot->size);
+#endif
+    snapshot->alloc_func(snapshot, sizeof(json_snapshot), 0);
+}
+
+json_value_type json_snode_type(const json_snode *n)
+{
+    assert(n);
+    return (json_value_type)n->type;
+}
+
+const char* json_snode_string_get(const json_snode *n)
+{
+    assert(n);
+    return n->type == json_type_string ? (const char*)(n + 1) : NULL;
+}
+
+unsigned int json_snode_string_len(const json_snode *n)
+{
+    assert(n);
+    return n->type == json_type_string ? n->size : 0;
+}
+
+double json_snode_number_get(const json_snode *n)
+{
+    assert(n);
+    return n->type == json_type_number ? *(const double*)(n + 1) : json_nan();
+}
+
+int json_snode_boolean_get(const json_snode *n)
+{
+    assert(n);
+
+    if (n->type == json_type_true)
+        return 1;
+    else if (n->type == json_type_false)
+        return 0;
+    else
+        return -1;
+}
+
+unsigned int json_snode_size(const json_snode *n)
+{
+    assert(n);
+    return (n->type == json_type_object || n->type == json_type_array) ? n->size : 0;
+}
+
+const char* json_snode_name_by_index(const json_snode *n, unsigned int index)
+{
+    assert(n);
+
+    if (n->type != json_type_object || index >= n->size)
+        return NULL;
+    return (const char*)n + ((const _snapshot_member*)(n + 1))[index].name;
+}
+
+const json_snode* json_snode_value_by_index(const json_snode *n, unsigned int index)
+{
+    assert(n);
+
+    if (n->type == json_type_object && index < n->size)
+        return _SNODE_AT(n, ((const _snapshot_member*)(n + 1))[index].value);
+    else if (n->type == json_type_array && index < n->size)
+        return _SNODE_AT(n, ((const int64_t*)(n + 1))[index]);
+    else
+        return NULL;
+}
+
+const json_snode* json_snode_object_get(const json_snode *n, const char *name)
+{
+    assert(n);
+    assert(name);
+    return _snode_object_get(n, name, (unsigned int)strlen(name));
+}
+
+const json_snode* json_snode_array_get(const json_snode *n, unsigned int index)
+{
+    assert(n);
+    return n->type == json_type_array ? json_snode_value_by_index(n, index) : NULL;
+}
+
+const json_snode* json_snode_dotget(const json_snode *n, const char *dotname)
+{
+    const char *p;
+    unsigned int len;
+
+    assert(n);
+    assert(dotname);
+
+    for (;;) {
+        for (p = dotname; *p && *p != '.'; ++p)
+            ;
+        len = (unsigned int)(p - dotname);
+        if (!len)
+            return NULL;
+
+        if (n->type == json_type_object)
+            n = _snode_object_get(n, dotname, len);
+        else if (n->type == json_type_array)
+            n = json_snode_value_by_index(n, json_segment_to_index(dotname, len));
+        else
+            return NULL;
+        if (!n || !*p)
+            return n;
+        dotname = p + 1;
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+
+static uint32_t _slot_count(uint32_t size)
+{
+    /* a power of 2, at most half full */
+    uint32_t count = 1;
+
+    if (!size)
+        return 0;
+    while (count < size * 2)
+        count <<= 1;
+    return count;
+}
+
+static unsigned int _container_size(json_value *v)
+{
+    return json_type(v) == json_type_object ? json_object_size(v) : json_array_size(v);
+}
+
+static void _write(_snapshot_writer *writer, const void *data, size_t len)
+{
+    if (writer->failed || !len)
+        return;
+    if (fwrite(data, 1, len, writer->fp) != len)
+        writer->failed = 1;
+    writer->pos += len;
+}
+
+static void _write_pad(_snapshot_writer *writer)
+{
+    static const char zeros[8] = { 0 };
+    _write(writer, zeros, (size_t)((8 - writer->pos % 8) % 8));
+}
+
+static void _write_node(_snapshot_writer *writer, json_value *v, const uint64_t *offsets, json_alloc_func alloc_func)
+{
+    json_snode node;
+    json_iter it;
+    _snapshot_member member;
+    uint32_t *slots, count, i;
+    int64_t value;
+    uint64_t pos = writer->pos;
+    double dbl;
+
+    if (writer->failed)
+        return;
+
+    node.type = (uint32_t)json_type(v);
+    switch (node.type)
+    {
+    case json_type_string:
+        node.size = json_string_len(v);
+        _write(writer, &node, sizeof(node));
+        _write(writer, json_string_get(v), node.size + 1);
+        break;
+
+    case json_type_number:
+        node.size = 0;
+        dbl = json_number_get(v);
+        _write(writer, &node, sizeof(node));
+        _write(writer, &dbl, sizeof(dbl));
+        break;
+
+    case json_type_array:
+        node.size = json_array_size(v);
+        _write(writer, &node, sizeof(node));
+        for (i = 0; i < node.size; ++i) {
+            value = (int64_t)offsets[i] - (int64_t)pos;
+            _write(writer, &value, sizeof(value));
+        }
+        break;
+
+    case json_type_object:
+        node.size = json_object_size(v);
+        count = _slot_count(node.size);
+        slots = NULL;
+        if (count) {
+            slots = (uint32_t*)alloc_func(NULL, 0, sizeof(uint32_t) * count);
+            if (!slots) {
+                writer->failed = 1;
+                return;
+            }
+            memset(slots, 0, sizeof(uint32_t) * count);
+        }
+
+        _write(writer, &node, sizeof(node));
+        member.name = (int64_t)(sizeof(node) + sizeof(_snapshot_member) * node.size + sizeof(uint32_t) * count);
+        json_iter_begin(&it, v);
+        while (json_iter_next(&it)) {
+            member.value = (int64_t)offsets[it.index] - (int64_t)pos;
+            member.name_len = it.name_len;
+            member.hash = json_hash_keyed(it.name, it.name_len, SNAPSHOT_K0, SNAPSHOT_K1);
+            _write(writer, &member, sizeof(member));
+            member.name += it.name_len + 1;
+
+            for (i = member.hash & (count - 1); slots[i]; i = (i + 1) & (count - 1))
+                ;
+            slots[i] = it.index + 1;
+        }
+        _write(writer, slots, sizeof(uint32_t) * count);
+        json_iter_begin(&it, v);
+        while (json_iter_next(&it))
+            _write(writer, it.name, it.name_len + 1);
+        if (slots)
+            alloc_func(slots, sizeof(uint32_t) * count, 0);
+        break;
+
+    default:
+        node.size = 0;
+        _write(writer, &node, sizeof(node));
+        break;
+    }
+
+    _write_pad(writer);
+}
+
+static const json_snode* _snode_object_get(const json_snode *n, const char *name, unsigned int len)
+{
+    const _snapshot_member *members, *member;
+    const uint32_t *slots;
+    uint32_t count, hash, i;
+
+    if (n->type != json_type_object || !n->size)
+        return NULL;
+
+    members = (const _snapshot_member*)(n + 1);
+    count = _slot_count(n->size);
+    slots = (const uint32_t*)(members + n->size);
+    hash = json_hash_keyed(name, len, SNAPSHOT_K0, SNAPSHOT_K1);
+
+    for (i = hash & (count - 1); slots[i]; i = (i + 1) & (count - 1)) {
+        member = members + slots[i] - 1;
+        if (member->hash == hash && member->name_len == len && 
+            memcmp((const char*)n + member->name, name, len) == 0)
+            return _SNODE_AT(n, member->value);
+    }
+    return NULL;
+}
+
+static int _check_nodes(const char *base, size_t size, uint64_t root, json_alloc_func alloc_func)
+{
+    /* The nodes are packed one after the other, children first. A node may 
+       only point back to the start of a node already checked, so whatever 
+       is reachable from the root is checked too. */
+    unsigned char *starts;
+    uint64_t end = size - sizeof(_snapshot_footer), pos, next;
+    size_t bits = (size_t)(end / 8 + 7) / 8;
+    int res = 1;
+
+    starts = (unsigned char*)alloc_func(NULL, 0, bits);
+    if (!starts)
+        return 0;
+    memset(starts, 0, bits);
+
+    for (pos = sizeof(_snapshot_header); pos < end; pos = next) {
+        next = _check_node(base, pos, end, starts);
+        if (!next) {
+            res = 0;
+            break;
+        }
+        starts[pos / 64] |= (unsigned char)(1 << (pos / 8 % 8));
+    }
+    res = res && pos == end && (starts[root / 64] & (1 << (root / 8 % 8)));
+
+    alloc_func(starts, bits, 0);
+    return res;
+}
+
+static int _is_checked(const unsigned char *starts, uint64_t pos, int64_t offset)
+{
+    /* a child is a node before its parent */
+    uint64_t back = (uint64_t)0 - (uint64_t)offset, child;
+
+    if (offset >= 0 || back > pos || back % 8)
+        return 0;
+    child = pos - back;
+    return (starts[child / 64] & (1 << (child / 8 % 8))) != 0;
+}
+
+static uint64_t _check_node(const char *base, uint64_t pos, uint64_t end, const unsigned char *starts)
+{
+    /* the end of the node at pos, 0 if it is malformed */
+    const json_snode *n = (const json_snode*)(base + pos);
+    const _snapshot_member *members;
+    const int64_t *elements;
+    const uint32_t *slots;
+    uint64_t len, name;
+    uint32_t count, used, i;
+
+    if (end - pos < sizeof(json_snode))
+        return 0;
+
+    switch (n->type)
+    {
+    case json_type_string:
+        len = sizeof(json_snode) + (uint64_t)n->size + 1;
+        if (end - pos < len || ((const char*)(n + 1))[n->size] != '\0')
+            return 0;
+        break;
+
+    case json_type_number:
+        len = sizeof(json_snode) + sizeof(double);
+        break;
+
+    case json_type_true:
+    case json_type_false:
+    case json_type_null:
+        len = sizeof(json_snode);
+        break;
+
+    case json_type_array:
+        len = sizeof(json_snode) + sizeof(int64_t) * (uint64_t)n->size;
+        if (end - pos < len)
+            return 0;
+        elements = (const int64_t*)(n + 1);
+        for (i = 0; i < n->size; ++i) {
+            if (!_is_checked(starts, pos, elements[i]))
+                return 0;
+        }
+        break;
+
+    case json_type_object:
+        /* bounded by the bytes left first, _slot_count would wrap past 2^30 */
+        if (n->size > 0x3fffffff || 
+            (uint64_t)n->size > (end - pos - sizeof(json_snode)) / sizeof(_snapshot_member))
+            return 0;
+        count = _slot_count(n->size);
+        len = sizeof(json_snode) + sizeof(_snapshot_member) * (uint64_t)n->size + sizeof(uint32_t) * (uint64_t)count;
+        if (end - pos < len)
+            return 0;
+        members = (const _snapshot_member*)(n + 1);
+        for (i = 0; i < n->size; ++i) {
+            if (!_is_checked(starts, pos, members[i].value))
+                return 0;
+            /* the names follow the index in member order */
+            name = (uint64_t)members[i].name;
+            if (name != len || end - pos - len < (uint64_t)members[i].name_len + 1 || 
+                base[pos + name + members[i].name_len] != '\0')
+                return 0;
+            len += (uint64_t)members[i].name_len + 1;
+        }
+        /* a lookup stops at an empty slot, there must be one */
+        slots = (const uint32_t*)(members + n->size);
+        for (i = 0, used = 0; i < count; ++i) {
+            if (slots[i] > n->size)
+                return 0;
+            used += slots[i] != 0;
+        }
+        if (count && used >= count)
+            return 0;
+        break;
+
+    default:
+        return 0;
+    }
+
+    len = (len + 7) & ~(uint64_t)7;
+    return end - pos < len ? 0 : pos + len;
+}
@@ -44,16 +44,39 @@
 
 #define BUF_LEN 4096
 
+/*
+ With config.write set, output is staged in buf and handed to the callback 
+ BUF_LEN bytes at a time. Otherwise it goes straight to out: past cap only 
+ the length is counted, unless alloc_func is set to grow out. A NULL out 
+ with no alloc_func just measures.
+*/
 typedef struct context {
     json_write_config config;
-    int written;
+    size_t written;
     int level;
+    char *out;
+    size_t cap;
+    json_alloc_func alloc_func;
     unsigned int buf_size;
     char buf[BUF_LEN];
 } context;
 
-static int _json_write(json_value *v, context *ctx);
-static int _flush(context *ctx);
+extern void* json_default_alloc_func(
+    void *ptr, 
+    size_t osize, 
+    size_t nsize
+    );
+static void _init(
+    context *ctx, 
+    json_write_config config
+    );
+static int _json_write(
+    json_value *v, 
+    context *ctx
+    );
+static int _flush(
+    context *ctx
+    );
 
 int json_write(json_value *v, json_write_config config)
 {
@@ -62,10 +85,7 @@ int json_write(json_value *v, json_write_config config)
     assert(v);
     assert(config.write);
 
-    ctx.config = config;
-    ctx.written = 0;
-    ctx.level = 0;
-    ctx.buf_size = 0;
+    _init(&ctx, config);
     
     if (!_json_write(v, &ctx))
         return 0;
@@ -73,22 +93,128 @@ int json_write(json_value *v, json_write_config config)
     if (!_flush(&ctx))
         return 0;
 
+    return (int)ctx.written;
+}
+
+size_t json_write_to_buffer(json_value *v, json_write_config config, char *out, size_t cap)
+{
+    context ctx;
+
+    assert(v);
+    assert(out || !cap);
+
+    config.write = NULL;
+    _init(&ctx, config);
+    ctx.out = out;
+    ctx.cap = cap;
+
+    if (!_json_write(v, &ctx))
+        return 0;
+
+    return ctx.written;
+}
+
+char* json_write_alloc(json_value *v, json_write_config config, size_t *len, json_alloc_func alloc_func)
+{
+    context ctx;
+    char *out;
+
+    assert(v);
+    assert(len);
+
+    if (!alloc_func)
+        alloc_func = json_default_alloc_func;
+
+    config.write = NULL;
+    _init(&ctx, config);
+    ctx.alloc_func = alloc_func;
+
+    if (!_json_write(v, &ctx)) {
+        if (ctx.out)
+            alloc_func(ctx.out, ctx.cap, 0);
+        return NULL;
+    }
+
+    /* trim to the exact size the caller frees with */
+    assert(ctx.out && ctx.written < ctx.cap);
+    out = (char*)alloc_func(ctx.out, ctx.cap, ctx.written + 1);
+    if (!out) {
+        alloc_func(ctx.out, ctx.cap, 0);
+        return NULL;
+    }
+    out[ctx.written] = '\0';
+    *len = ctx.written;
+    return out;
+}
+
+size_t json_write_measure(json_value *v, json_write_config config)
+{
+    context ctx;
+
+    assert(v);
+
+    config.write = NULL;
+    _init(&ctx, config);
+
+    if (!_json_write(v, &ctx))
+        return 0;
+
     return ctx.written;
 }
 
 /*----------------------------------------------------------------------------*/
 
+static void _init(context *ctx, json_write_config config)
+{
+    ctx->config = config;
+    ctx->written = 0;
+    ctx->level = 0;
+    ctx->out = NULL;
+    ctx->cap = 0;
+    ctx->alloc_func = NULL;
+    ctx->buf_size = 0;
+}
+
+static int _write_direct(const char *str, int len, context *ctx)
+{
+    char *out;
+    size_t n;
+
+    /* the growable target always keeps a byte for the terminator */
+    if (ctx->alloc_func && ctx->written + len >= ctx->cap) {
+        n = ctx->cap < 256 ? 256 : ctx->cap * 2;
+        if (n <= ctx->written + len)
+            n = ctx->written + len + 1;
+        out = (char*)ctx->alloc_func(ctx->out, ctx->cap, n);
+        if (!out)
+            return 0;  /* the old buffer is still ctx->out, freed by the caller */
+        ctx->out = out;
+        ctx->cap = n;
+    }
+
+    if (ctx->written < ctx->cap) {
+        n = ctx->cap - ctx->written;
+        if (n > (size_t)len)
+            n = len;
+        memcpy(ctx->out + ctx->written, str, n);
+    }
+    ctx->written += len;
+    return 1;
+}
+
 static int _write(const char *str, int len, context *ctx)
 {
     int n;
 
+    if (!ctx->config.write)
+        return _write_direct(str, len, ctx);
+
     while (len) {
         n = BUF_LEN - ctx->buf_size;
         if (!n) {
-            if (ctx->config.write(ctx->buf, BUF_LEN) != BUF_LEN)
+            if (ctx->config.write(ctx->config.ctx, ctx->buf, BUF_LEN) != BUF_LEN)
                 return 0;
             ctx->buf_size = 0;
-            ctx->written += BUF_LEN;
             n = BUF_LEN;
         }
         if (n > len)
@@ -107,10 +233,9 @@ static int _write(const char *str, int len, context *ctx)
 static int _flush(context *ctx)
 {
     if (ctx->buf_size) {
-        if (ctx->config.write(ctx->buf, ctx->buf_size) != ctx->buf_size)
+        if (ctx->config.write(ctx->config.ctx, ctx->buf, ctx->buf_size) != (int)ctx->buf_size)
             return 0;
         ctx->buf_size = 0;
-        ctx->written += ctx->buf_size;
     }
     return 1;
 }
@@ -238,136 +363,92 @@ static int _write_number(double number, context *ctx)
     return _write(tmp, len, ctx);
 }
 
-static int _write_object(json_value *v, context *ctx)
+static int _write_scalar(json_value *v, context *ctx)
 {
-    unsigned int size, i;
-    const char *name;
-    json_value *value;
-
-    if (!_write("{", 1, ctx))
-        return 0;
-
-    size = json_object_size(v);
-    if (size > 0) {
-        ctx->level += 1;
-
-        if (!_write_lineend_indent(ctx))
-            return 0;
+    switch (json_type(v))
+    {
+    case json_type_string:
+        return _write_string(json_string_get(v), ctx);
 
-        for (i = 0; i < size; ++i) {
-            name = json_object_name_by_index(v, i);
-            assert(name);
-            value = json_object_value_by_index(v, i);
-            assert(value);
-            if (!_write_string(name, ctx))
-                return 0;
-            if (!_write(":", 1, ctx))
-                return 0;
-            if (!ctx->config.compact && !_write(" ", 1, ctx))
-                return 0;
-            if (!_json_write(value, ctx))
-                return 0;
+    case json_type_number:
+        return _write_number(json_number_get(v), ctx);
 
-            if (i < size - 1) {
-                if (!_write(",", 1, ctx))
-                    return 0;
-                if (!_write_lineend_indent(ctx))
-                    return 0;
-            }
-        }
+    case json_type_true:
+        return _write("true", 4, ctx);
 
-        ctx->level -= 1;
+    case json_type_false:
+        return _write("false", 5, ctx);
 
-        if (!_write_lineend_indent(ctx))
-            return 0;
-    }
+    case json_type_null:
+        return _write("null", 4, ctx);
 
-    if (!_write("}", 1, ctx))
+    default:
+        assert(0);
         return 0;
-
-    return 1;
+    }
 }
 
-static int _write_array(json_value *v, context *ctx)
+static unsigned int _container_size(json_value *v)
 {
-    unsigned int size, i;
-    json_value *child;
-
-    if (!_write("[", 1, ctx))
-        return 0;
-
-    size = json_array_size(v);
-    if (size > 0) {
-        ctx->level += 1;
-
-        if (!_write_lineend_indent(ctx))
-            return 0;
-
-        for (i = 0; i < size; ++i) {
-            child = json_array_get(v, i);
-            assert(child);
-            if (!_json_write(child, ctx))
-                return 0;
-
-            if (i < size - 1) {
-                if (!_write(",", 1, ctx))
-                    return 0;
-                if (!_write_lineend_indent(ctx))
-                    return 0;
-            }
-        }
-        
-        ctx->level -= 1;
-
-        if (!_write_lineend_indent(ctx))
-            return 0;
-    }
-
-    if (!_write("]", 1, ctx))
-        return 0;
-
-    return 1;
+    return json_type(v) == json_type_object ? json_object_size(v) : json_array_size(v);
 }
 
 static int _json_write(json_value *v, context *ctx)
 {
-    json_value_type t;
-    int res = 0;
-
-    t = json_type(v);
-    switch (t)
-    {
-    case json_type_string:
-        res = _write_string(json_string_get(v), ctx);
-        break;
-
-    case json_type_number:
-        res = _write_number(json_number_get(v), ctx);
-        break;
-
-    case json_type_true:
-        res = _write("true", 4, ctx);
-        break;
-
-    case json_type_false:
-        res = _write("false", 5, ctx);
-        break;
+    json_walker w;
+    json_walk_event event;
+    json_value *container;
+    int res = 1;
+
+    json_walk_begin(&w, v, json_get_alloc_func(v));
+    while (res && (event = json_walk_next(&w)) != json_walk_done) {
+        if (event == json_walk_error) {
+            res = 0;
+            break;
+        }
 
-    case json_type_null:
-        res = _write("null", 4, ctx);
-        break;
+        /* separator and member name */
+        if (w.depth > 0 && event != json_walk_leave) {
+            if (w.index > 0)
+                res = _write(",", 1, ctx) && _write_lineend_indent(ctx);
+            if (res && w.name) {
+                res = _write_string(w.name, ctx) && _write(":", 1, ctx) &&
+                    (ctx->config.compact || _write(" ", 1, ctx));
+            }
+            if (!res)
+                break;
+        }
 
-    case json_type_object:
-        res = _write_object(v, ctx);
-        break;
+        switch (event)
+        {
+        case json_walk_enter:
+            /* a lazy container is read from what the walker built for it */
+            container = json_walk_container(&w);
+            if (!container) {
+                res = 0;
+                break;
+            }
+            res = json_type(w.value) == json_type_object ? _write("{", 1, ctx) : _write("[", 1, ctx);
+            if (res && _container_size(container) > 0) {
+                ctx->level += 1;
+                res = _write_lineend_indent(ctx);
+            }
+            break;
 
-    case json_type_array:
-        res = _write_array(v, ctx);
-        break;
+        case json_walk_leave:
+            if (_container_size(json_walk_container(&w)) > 0) {
+                ctx->level -= 1;
+                res = _write_lineend_indent(ctx);
+            }
+            if (res)
+                res = json_type(w.value) == json_type_object ? _write("}", 1, ctx) : _write("]", 1, ctx);
+            break;
 
-    default:
-        assert(0);
+        default:
+            res = _write_scalar(w.value, ctx);
+        }
     }
+    json_walk_end(&w);
 
     return res;
 }
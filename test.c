@@ -1,5 +1,6 @@
 #include "json.h"
 #include <string.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
 
@@ -10,8 +11,24 @@ static void test_null();
 static void test_object();
 static void test_array();
 static void test_dotget_clone();
+static void test_freeze();
+static void test_walk();
 static void test_write();
 static void test_parser();
+static void test_query();
+static void test_query_stream();
+static void test_patch();
+static void test_equal_frozen_hash();
+static void test_compact();
+static void test_snapshot();
+static void test_binary();
+static void test_pool();
+static void test_typed();
+static void test_columnarize();
+static void test_take();
+static void test_capacity();
+static void test_lazy();
+static void test_write_target();
 
 int main(int argc, char **argv)
 {
@@ -22,8 +39,24 @@ int main(int argc, char **argv)
     test_object();
     test_array();
     test_dotget_clone();
+    test_freeze();
+    test_walk();
     test_write();
     test_parser();
+    test_query();
+    test_query_stream();
+    test_patch();
+    test_equal_frozen_hash();
+    test_compact();
+    test_snapshot();
+    test_binary();
+    test_pool();
+    test_typed();
+    test_columnarize();
+    test_take();
+    test_capacity();
+    test_lazy();
+    test_write_target();
     return 0;
 }
 
@@ -73,6 +106,41 @@ static void test_string()
     assert(boolean == -1);
 
     json_free(v);
+
+    /* builder: appends keep the contents, including out of trailing mode */
+    v = json_string_alloc("log:", (unsigned int)-1, NULL);
+    assert(v);
+    for (len = 0; len < 1000; ++len) {
+        v = json_string_append_fmt(v, " %u", len);
+        assert(v);
+    }
+    str = json_string_get(v);
+    assert(strncmp(str, "log: 0 1 2 ", 11) == 0 && strcmp(str + json_string_len(v) - 4, " 999") == 0);
+    v = json_string_concat(v, json_string_get(v), 4);  /* from itself */
+    assert(v && strcmp(json_string_get(v) + json_string_len(v) - 8, " 999log:") == 0);
+    json_free(v);
+
+    v = json_string_reserve(json_string_alloc("", 0, NULL), 64);
+    assert(v);
+    {
+        char *spare = json_string_spare(v, &len);
+        assert(spare && len >= 64);
+        memcpy(spare, "written in place", 16);
+        v = json_string_commit(v, 16);
+        assert(v && strcmp(json_string_get(v), "written in place") == 0);
+        assert(json_string_commit(v, len) == NULL);
+    }
+    {
+        json_value *object, *shared;
+        object = json_object_set(json_object_alloc(NULL), "s", v);
+        shared = json_clone_shared(object);
+        assert(json_string_spare(v, &len) == NULL && len == 0);
+        assert(json_string_append_fmt(v, ", %s %d", "twice", 2) == NULL);  /* left alone while shared */
+        json_free(shared);
+        v = json_string_append_fmt(v, ", %s %d", "twice", 2);
+        assert(v && strcmp(json_dotget_string(object, "s"), "written in place, twice 2") == 0);
+        json_free(object);
+    }
 }
 
 static void test_number()
@@ -192,6 +260,80 @@ static void test_object()
     assert(json_type(v2) == json_type_number);
     assert(json_number_get(v2) == 10);
 
+    {
+        json_iter it;
+        json_key key;
+        assert(json_iter_begin(&it, v));
+        for (i = 0; json_iter_next(&it); ++i) {
+            assert(it.index == (unsigned int)i);
+            assert(strcmp(it.name, json_object_name_by_index(v, i)) == 0 && it.name_len == 1);
+            assert(it.value == json_object_value_by_index(v, i));
+            assert(it.hash == json_key_init(&key, it.name, it.name_len)->hash);
+        }
+        assert(i == 9 && !json_iter_next(&it));
+        assert(!json_iter_begin(&it, v2));
+    }
+
+    {
+        /* more than one batch, with a missing name and a repeated one */
+        const char *many[40];
+        json_value *values[40];
+        for (i = 0; i < 40; ++i)
+            many[i] = i % 10 == 5 ? "x" : names[i % 10];
+        assert(json_object_get_many(v, many, 40, values) == 32);
+        for (i = 0; i < 40; ++i) {
+            if (i % 10 == 5 || i % 10 == 0)
+                assert(values[i] == NULL);
+            else
+                assert(values[i] == json_object_get(v, many[i]));
+        }
+        assert(json_object_get_many(v2, many, 3, values) == 0 && values[2] == NULL);
+    }
+
+    json_free(v);
+
+    /* "Aa" and "BB" collide under djb2, so do all their concatenations */
+    v = json_object_alloc(NULL);
+    assert(v);
+    for (i = 0; i < 256; ++i) {
+        char name[9];
+        int j;
+        for (j = 0; j < 8; j += 2) {
+            name[j] = (i >> (j / 2)) & 1 ? 'A' : 'B';
+            name[j + 1] = (i >> (j / 2)) & 1 ? 'a' : 'B';
+        }
+        name[8] = '\0';
+        if (json_object_get(v, name))
+            continue;
+        v = json_object_set(v, name, json_number_alloc(i, NULL));
+        assert(v);
+        v2 = json_object_get(v, name);
+        assert(v2 && json_number_get(v2) == i);
+    }
+    assert(json_object_size(v) == 16);
+    for (i = 0; i < 16; i += 3) {
+        char name[9];
+        strcpy(name, json_object_name_by_index(v, i / 3));
+        v = json_object_erase(v, name);
+        assert(v && !json_object_get(v, name));
+    }
+    for (i = 0; i < (int)json_object_size(v); ++i)
+        assert(json_object_get(v, json_object_name_by_index(v, i)) == json_object_value_by_index(v, i));
+    json_free(v);
+
+    /* short names are stored inline, long ones are not */
+    v = json_object_alloc(NULL);
+    assert(v);
+    v = json_object_set(v, "short", json_null_alloc(NULL));
+    assert(v);
+    v = json_object_set(v, "a_rather_long_member_name", json_null_alloc(NULL));
+    assert(v);
+    assert(strcmp(json_object_name_by_index(v, 0), "short") == 0);
+    assert(strcmp(json_object_name_by_index(v, 1), "a_rather_long_member_name") == 0);
+    assert(json_object_get(v, "a_rather_long_member_name"));
+    v = json_object_erase(v, "short");
+    assert(v);
+    assert(strcmp(json_object_name_by_index(v, 0), "a_rather_long_member_name") == 0);
     json_free(v);
 }
 
@@ -238,12 +380,41 @@ static void test_array()
     size = json_array_size(v);
     assert(size == 99);
 
+    {
+        json_iter it;
+        size = 0;
+        assert(json_iter_begin(&it, v));
+        while (json_iter_next(&it)) {
+            assert(it.name == NULL && it.value == json_array_get(v, it.index));
+            size++;
+        }
+        assert(size == 99);
+    }
+
     json_free(v);
 }
 
+static int alloc_count = 0;
+static size_t alloc_limit = (size_t)-1;  /* larger blocks fail */
+static void* counting_alloc(void *ptr, size_t osize, size_t nsize)
+{
+    if (nsize > alloc_limit)
+        return NULL;
+    if (!ptr)
+        alloc_count++;
+    if (!nsize) {
+        alloc_count--;
+        free(ptr);
+        return NULL;
+    }
+    return realloc(ptr, nsize);
+}
+
 static void test_dotget_clone()
 {
-    json_value *object, *array, *v;
+    json_value *object, *array, *v, *v2;
+    json_path *path;
+    json_key key;
     unsigned int i;
     int boolean;
 
@@ -269,6 +440,26 @@ static void test_dotget_clone()
     v = json_dotget(object, "");
     assert(v == NULL);
 
+    path = json_path_compile("abc.[3]", NULL);
+    assert(path);
+    v = json_path_eval(object, path);
+    assert(v && v == json_dotget(object, "abc.[3]"));
+    assert(json_path_eval_boolean(object, path) == 1);
+    assert(json_path_eval_object(object, path) == NULL);
+    json_path_free(path);
+    path = json_path_compile("abc.xxx", NULL);
+    assert(path && json_path_eval(object, path) == NULL);
+    json_path_free(path);
+    /* wraps around to 3 if the digits are not bounded */
+    assert(json_dotget(object, "abc.[4294967299]") == NULL);
+    path = json_path_compile("abc.[4294967299]", NULL);
+    assert(path && json_path_eval(object, path) == NULL);
+    json_path_free(path);
+    assert(json_path_compile("", NULL) == NULL);
+    assert(json_path_compile("abc..[3]", NULL) == NULL);
+    assert(json_object_get_key(object, json_key_init(&key, "abc", (unsigned int)-1)) == array);
+    assert(json_object_get_key(object, json_key_init(&key, "abcd", 3)) == array);
+
     boolean = json_dotget_boolean(object, "abc.[3]");
     assert(boolean == 1);
     boolean = json_dotget_boolean(object, "abc.[8]");
@@ -280,12 +471,209 @@ static void test_dotget_clone()
     assert(v);
     json_free(v);
 
+    /* structural clone, into another allocator */
+    v = json_object_alloc(NULL);
+    assert(v);
+    for (i = 0; i < 50; ++i) {
+        char name[40];
+        sprintf(name, i % 2 ? "k%u" : "a_long_key_that_is_not_inline_%u", i);
+        v = json_object_set(v, name, json_number_alloc(i, NULL));
+        assert(v);
+    }
+    v2 = json_clone(v, counting_alloc);
+    assert(v2 && alloc_count > 0);
+    assert(json_object_size(v2) == 50);
+    for (i = 0; i < 50; ++i) {
+        assert(strcmp(json_object_name_by_index(v, i), json_object_name_by_index(v2, i)) == 0);
+        assert(json_object_get(v2, json_object_name_by_index(v, i)));
+    }
+    assert(json_number_get(json_object_get(v2, "k7")) == 7);
+    json_free(v2);
+    assert(alloc_count == 0);
+    json_free(v);
+
+    /* shared clones: mutations only copy the modified path */
+    v = json_clone_shared(object);
+    assert(v && v != object && json_dotget(v, "abc") == json_dotget(object, "abc"));
+    v2 = json_object_set(v, "tmp", json_null_alloc(NULL));  /* the handle is v's own */
+    assert(v2 == v && json_object_size(object) == 1);
+    v = json_object_erase(v, "tmp");
+    assert(v == v2);
+    v = json_dotset(v, "abc.[3]", json_boolean_alloc(0, NULL));
+    assert(v && v != object);
+    assert(json_dotget_boolean(v, "abc.[3]") == 0);
+    assert(json_dotget_boolean(object, "abc.[3]") == 1);
+    assert(json_dotget(v, "abc.[5]") == json_dotget(object, "abc.[5]"));
+    assert(json_dotget(v, "abc") != json_dotget(object, "abc"));
+    v = json_object_set(v, "xyz", json_null_alloc(NULL));
+    assert(v);
+    assert(json_object_size(v) == 2 && json_object_size(object) == 1);
+    array = json_clone_shared(json_dotget(v, "abc"));
+    assert(array);
+    array = json_array_erase(array, 0);
+    assert(array && json_array_size(array) == 9);
+    assert(json_array_size(json_dotget(v, "abc")) == 10);
+    json_free(array);
+    json_free(v);
+
+    json_free(object);
+
+    /* the mutators leave shared children alone instead of dropping a reference the parent holds */
+    object = json_object_alloc(NULL);
+    v = json_object_alloc(NULL);
+    v = json_object_set(v, "x", json_number_alloc(1, NULL));
+    object = json_object_set(object, "in", v);
+    array = json_array_alloc(NULL);
+    array = json_array_append(array, json_number_alloc(1, NULL));
+    array = json_array_append(array, json_string_alloc("s", 1, NULL));
+    object = json_object_set(object, "list", array);
+    object = json_object_set(object, "n", json_number_alloc(2, NULL));
+    assert(object && json_object_size(object) == 3);
+    v = json_clone_shared(object);
+    v2 = json_null_alloc(NULL);
+    assert(json_object_set(json_object_get(v, "in"), "x", v2) == NULL);
+    assert(json_object_take(json_object_get(v, "in"), "x", &array) == NULL);
+    assert(json_array_take(json_object_get(v, "list"), 0, &array) == NULL);
+    assert(json_number_set(json_object_get(v, "n"), 3) == NULL);
+    json_free(v);
+    assert(json_dotget_number(object, "in.x") == 1 && json_dotget_number(object, "n") == 2);
+    assert(json_array_size(json_dotget(object, "list")) == 2);
+    v = json_clone_shared(object);
+    assert(json_dotset(v, "in.x", v2) == v && json_dotset(json_object_get(v, "list"), "[0]", v2) == NULL);
+    json_free(v);
+    assert(json_dotget_number(object, "in.x") == 1);
     json_free(object);
 }
 
+static void test_freeze()
+{
+    json_value *object, *array, *v;
+
+    object = json_object_alloc(NULL);
+    assert(object);
+    array = json_array_alloc(NULL);
+    assert(array);
+    array = json_array_append(array, json_string_alloc("abc", (unsigned int)-1, NULL));
+    assert(array);
+    object = json_object_set(object, "array", array);
+    assert(object);
+
+    assert(json_freeze(object) == object);
+    assert(json_is_frozen(object) && json_is_frozen(array));
+
+    v = json_null_alloc(NULL);
+    assert(json_object_set(object, "null", v) == NULL);
+    assert(json_array_append(array, v) == NULL);
+    assert(json_string_set(json_array_get(array, 0), "x", 1) == NULL);
+    assert(json_dotset(object, "array.[0]", v) == NULL);
+    assert(json_object_erase(object, "array") == NULL);
+    assert(json_dotget_string(object, "array.[0]") && strcmp(json_dotget_string(object, "array.[0]"), "abc") == 0);
+
+    /* a shared clone of a frozen document is the document, a clone is writable */
+    array = json_clone_shared(object);
+    assert(array == object && json_dotset(array, "array.[0]", v) == NULL);
+    json_free(array);
+    array = json_clone(object, NULL);
+    assert(array && !json_is_frozen(array));
+    assert(json_dotset(array, "array.[0]", v) == array);
+    assert(strcmp(json_dotget_string(object, "array.[0]"), "abc") == 0);
+    assert(json_type(json_dotget(array, "array.[0]")) == json_type_null);
+    json_free(array);
+
+    json_free(object);
+}
+
+static int null_write(void *ctx, const char *data, int len)
+{
+    (void)ctx;
+    (void)data;
+    return len;
+}
+
+static void test_walk()
+{
+    json_value *root, *v, *clone;
+    json_walker w;
+    json_walk_event event;
+    json_write_config write_config;
+    int enter = 0, leave = 0, scalar = 0, max_depth = 0;
+    unsigned int i;
+
+    /* [1, {"a": [true]}, "x"] */
+    root = json_array_alloc(NULL);
+    root = json_array_append(root, json_number_alloc(1, NULL));
+    v = json_array_alloc(NULL);
+    v = json_array_append(v, json_boolean_alloc(1, NULL));
+    v = json_object_set(json_object_alloc(NULL), "a", v);
+    root = json_array_append(root, v);
+    root = json_array_append(root, json_string_alloc("x", 1, NULL));
+    assert(root);
+
+    json_walk_begin(&w, root, NULL);
+    while ((event = json_walk_next(&w)) != json_walk_done) {
+        assert(event != json_walk_error);
+        if (event == json_walk_enter)
+            enter++;
+        else if (event == json_walk_leave)
+            leave++;
+        else
+            scalar++;
+        if (event == json_walk_scalar && json_type(w.value) == json_type_true)
+            assert(w.depth == 3 && w.index == 0 && w.name == NULL);
+        if (event == json_walk_enter && w.name)
+            assert(w.depth == 2 && w.name_len == 1 && strcmp(w.name, "a") == 0);
+    }
+    json_walk_end(&w);
+    assert(enter == 3 && leave == 3 && scalar == 3);
+
+    /* skipped containers have no leave */
+    enter = leave = 0;
+    json_walk_begin(&w, root, NULL);
+    while ((event = json_walk_next(&w)) != json_walk_done) {
+        if (event == json_walk_enter && json_type(w.value) == json_type_object)
+            json_walk_skip(&w);
+        else if (event == json_walk_enter)
+            enter++;
+        else if (event == json_walk_leave)
+            leave++;
+    }
+    json_walk_end(&w);
+    assert(enter == 1 && leave == 1);
+    json_free(root);
+
+    /* far deeper than the thread stack would allow with recursion */
+    root = json_array_alloc(NULL);
+    for (i = 0; i < 200000; ++i) {
+        v = json_array_alloc(NULL);
+        assert(v);
+        root = json_array_append(v, root);
+        assert(root);
+    }
+    clone = json_clone(root, NULL);
+    assert(clone);
+
+    json_walk_begin(&w, clone, NULL);
+    while ((event = json_walk_next(&w)) != json_walk_done) {
+        if ((int)w.depth > max_depth)
+            max_depth = (int)w.depth;
+    }
+    json_walk_end(&w);
+    assert(max_depth == 200000);
+
+    write_config.compact = 1;
+    write_config.crlf = 0;
+    write_config.indent = 0;
+    write_config.write = null_write;
+    write_config.ctx = NULL;
+    assert(json_write(clone, write_config) == 2 * 200001);
+
+    json_free(clone);
+    json_free(root);
+}
+
 char buf[8192];
 unsigned int buf_size = 0;
-static int my_write(const char *data, int len)
+static int my_write(void *ctx, const char *data, int len)
 {
     assert(len + buf_size <= 8192);
     memcpy(buf + buf_size, data, len);
@@ -357,8 +745,8 @@ static void test_write()
     write_config.crlf = 1;
     write_config.indent = 4;
     write_config.write = my_write;
+    write_config.ctx = NULL;
     json_write(object, write_config);
-    printf("%s\n", buf);
 
     json_free(object);
 }
@@ -398,4 +786,1120 @@ static void test_parser()
     json_free(res);
 
     json_parser_free(parser);
+
+    /* strings after a comma in an array */
+    config.json_str = "[\"a\", \"b\", [\"c\",\"d\"], {\"k\": [1, \"e\"]}]";
+    parser = json_parser_alloc(20, config);
+    assert(parser);
+    for (i = 0, len = strlen(config.json_str); i < len; ++i)
+        assert(json_parser_char(parser, config.json_str[i]));
+    res = json_parser_done(parser);
+    assert(res && json_array_size(res) == 4);
+    assert(strcmp(json_dotget_string(res, "[1]"), "b") == 0);
+    assert(strcmp(json_dotget_string(res, "[2].[1]"), "d") == 0);
+    assert(strcmp(json_dotget_string(res, "[3].k.[1]"), "e") == 0);
+    json_free(res);
+    json_parser_free(parser);
+}
+
+static json_value* parse(const char *json)
+{
+    json_parser_config config;
+    json_parser *parser;
+    json_value *res;
+    const char *p;
+
+    config.alloc_func = NULL;
+    config.json_str = json;
+    config.json_str_len = 0;
+    parser = json_parser_alloc(20, config);
+    assert(parser);
+    for (p = json; *p; ++p) {
+        if (!json_parser_char(parser, *p)) {
+            json_parser_free(parser);
+            return NULL;
+        }
+    }
+    res = json_parser_done(parser);
+    json_parser_free(parser);
+    return res;
+}
+
+static const char *storeJSON = 
+    "{ \"store\": {"
+    "    \"book\": ["
+    "      { \"category\": \"reference\", \"author\": \"Nigel Rees\", \"price\": 8.95 },"
+    "      { \"category\": \"fiction\", \"author\": \"Evelyn Waugh\", \"price\": 12.99 },"
+    "      { \"category\": \"fiction\", \"author\": \"Herman Melville\", \"isbn\": \"0-553-21311-3\", \"price\": 8.99 },"
+    "      { \"category\": \"fiction\", \"author\": \"J. R. R. Tolkien\", \"isbn\": \"0-395-19395-8\", \"price\": 22.99 }"
+    "    ],"
+    "    \"bicycle\": { \"color\": \"red\", \"price\": 19.95 }"
+    "  }"
+    "}";
+
+static unsigned int query(json_value *v, const char *expr, json_value **results, unsigned int capacity)
+{
+    json_query *q;
+    unsigned int n;
+
+    q = json_query_compile(expr, NULL);
+    assert(q);
+    n = json_query_eval(q, v, results, capacity);
+    json_query_free(q);
+    return n;
+}
+
+static void test_query()
+{
+    json_value *doc, *results[16];
+    unsigned int n;
+
+    doc = parse(storeJSON);
+    assert(doc);
+
+    n = query(doc, "$.store.book[*].author", results, 16);
+    assert(n == 4);
+    assert(strcmp(json_string_get(results[3]), "J. R. R. Tolkien") == 0);
+
+    n = query(doc, "$..author", results, 16);
+    assert(n == 4);
+
+    n = query(doc, "$..price", results, 16);
+    assert(n == 5);
+
+    n = query(doc, "$.store['bicycle'].color", results, 16);
+    assert(n == 1 && strcmp(json_string_get(results[0]), "red") == 0);
+
+    n = query(doc, "$..book[-1].author", results, 16);
+    assert(n == 1 && strcmp(json_string_get(results[0]), "J. R. R. Tolkien") == 0);
+
+    n = query(doc, "$..book[1:3]", results, 16);
+    assert(n == 2 && results[0] == json_dotget(doc, "store.book.[1]"));
+
+    n = query(doc, "$..book[::2].price", results, 16);
+    assert(n == 2 && json_number_get(results[1]) == 8.99);
+
+    n = query(doc, "$..book[?(@.price < 10)].author", results, 16);
+    assert(n == 2 && strcmp(json_string_get(results[1]), "Herman Melville") == 0);
+
+    n = query(doc, "$..book[?(@.isbn)]", results, 16);
+    assert(n == 2);
+
+    n = query(doc, "$..book[?(@.category == 'fiction' && (@.price > 20 || @.price < 9))]", results, 16);
+    assert(n == 2);
+
+    n = query(doc, "$..*", results, 2);
+    assert(n > 2);  /* more matches than results */
+
+    assert(json_query_compile("store.book", NULL) == NULL);
+    assert(json_query_compile("$.store[", NULL) == NULL);
+    assert(json_query_compile("$..book[?(@.price <)]", NULL) == NULL);
+    assert(json_query_compile("$.a[99999999999]", NULL) == NULL);
+    assert(json_query_compile("$.a[-99999999999:]", NULL) == NULL);
+    assert(json_query_compile("$.a[0:1:99999999999]", NULL) == NULL);
+    assert(json_query_compile("$[?(@[99999999999] == 1)]", NULL) == NULL);
+
+    json_free(doc);
+}
+
+static char stream_buf[4096];
+static int stream_values;
+
+static int stream_match(void *ctx, const char *str, size_t len, json_value *value)
+{
+    size_t used = strlen(stream_buf);
+    
+    assert(used + len + 1 < sizeof(stream_buf));
+    if (used)
+        stream_buf[used++] = '|';
+    memcpy(stream_buf + used, str, len);
+    stream_buf[used + len] = '\0';
+    if (value) {
+        stream_values++;
+        json_free(value);
+    }
+    return ctx == NULL;  /* a non-NULL ctx stops at the first match */
+}
+
+static int stream_query(const char *expr, int materialize, void *ctx)
+{
+    json_query_stream_config config;
+    json_query *q;
+    json_value *doc, *results[16];
+    int n;
+
+    q = json_query_compile(expr, NULL);
+    assert(q);
+    config.alloc_func = NULL;
+    config.materialize = materialize;
+    config.depth = 20;
+    config.ctx = ctx;
+    config.match = stream_match;
+    stream_buf[0] = '\0';
+    stream_values = 0;
+    n = json_query_stream(q, storeJSON, strlen(storeJSON), config);
+
+    /* the same matches as on the DOM */
+    if (n >= 0 && !ctx) {
+        doc = parse(storeJSON);
+        assert(json_query_eval(q, doc, results, 16) == (unsigned int)n);
+        json_free(doc);
+    }
+    json_query_free(q);
+    return n;
+}
+
+static int stream_count(const char *expr, const char *json)
+{
+    json_query_stream_config config;
+    json_query *q;
+    json_value *doc, *results[16];
+    char text[sizeof(stream_buf)];
+    int n;
+
+    q = json_query_compile(expr, NULL);
+    assert(q);
+    config.alloc_func = counting_alloc;
+    config.materialize = 0;
+    config.depth = 20;
+    config.ctx = NULL;
+    config.match = stream_match;
+    stream_buf[0] = '\0';
+    alloc_count = 0;
+    n = json_query_stream(q, json, strlen(json), config);
+    assert(alloc_count == 0);
+
+    /* the same matches when they are built */
+    strcpy(text, stream_buf);
+    config.alloc_func = NULL;
+    config.materialize = 1;
+    stream_buf[0] = '\0';
+    stream_values = 0;
+    assert(json_query_stream(q, json, strlen(json), config) == n);
+    assert(strcmp(text, stream_buf) == 0 && stream_values == n);
+
+    doc = parse(json);
+    assert(json_query_eval(q, doc, results, 16) == (unsigned int)n);
+    json_free(doc);
+    json_query_free(q);
+    return n;
+}
+
+static void test_query_stream()
+{
+    json_query_stream_config config;
+    json_query *q;
+
+    assert(stream_query("$.store.bicycle.color", 0, NULL) == 1);
+    assert(strcmp(stream_buf, "\"red\"") == 0 && stream_values == 0);
+
+    assert(stream_query("$.store.bicycle", 1, NULL) == 1);
+    assert(strcmp(stream_buf, "{ \"color\": \"red\", \"price\": 19.95 }") == 0 && stream_values == 1);
+
+    assert(stream_query("$..price", 1, NULL) == 5);
+    assert(strcmp(stream_buf, "8.95|12.99|8.99|22.99|19.95") == 0 && stream_values == 5);
+
+    assert(stream_query("$.store.book[*].author", 0, NULL) == 4);
+    assert(stream_query("$..book[1:3].price", 0, NULL) == 2);
+    assert(strcmp(stream_buf, "12.99|8.99") == 0);
+    assert(stream_query("$..book[::2].price", 0, NULL) == 2);
+
+    /* resolved when the array ends */
+    assert(stream_query("$..book[-1].author", 1, NULL) == 1);
+    assert(strcmp(stream_buf, "\"J. R. R. Tolkien\"") == 0);
+    assert(stream_query("$..book[-3:-1].price", 0, NULL) == 2);
+    assert(strcmp(stream_buf, "12.99|8.99") == 0);
+
+    /* filters are decided on the events */
+    assert(stream_query("$..book[?(@.price < 10)].author", 1, NULL) == 2);
+    assert(strcmp(stream_buf, "\"Nigel Rees\"|\"Herman Melville\"") == 0 && stream_values == 2);
+    assert(stream_query("$..book[?(@.isbn)]", 1, NULL) == 2);
+    assert(stream_query("$..[?(@ > 20)]", 0, NULL) == 1);
+    assert(strcmp(stream_buf, "22.99") == 0);
+    assert(stream_query("$.store[?(@.color == 'red')].price", 0, NULL) == 1);
+    assert(strcmp(stream_buf, "19.95") == 0);
+    assert(stream_query("$..[?(@.author == 'Herman Melville' || @.price > 20)].price", 0, NULL) == 2);
+    assert(strcmp(stream_buf, "8.99|22.99") == 0);
+    assert(stream_query("$..[?(@ == 'fiction')]", 0, NULL) == 3);
+    assert(stream_query("$.store[?(@[3].price > 20)]", 0, NULL) == 1);
+    assert(stream_query("$.store[?(@[-1].price > 20)]", 0, NULL) == 1);  /* parsed alone */
+
+    assert(stream_count("$.a[?(@.b.c)]", "{\"a\": [{\"b\": {\"c\": 1}, \"b\": {}}, {\"b\": {\"c\": [2]}}]}") == 1);
+    assert(stream_count("$.a[?(@.b.c == 1)]", "{\"a\": [{\"b\": {\"c\": 2, \"c\": 1}}, {\"b\": [{\"c\": 1}]}]}") == 1);
+    assert(stream_count("$.a[?(@.s == 'x')].n", "{\"a\": [{\"s\": \"x\", \"n\": 1}, {\"s\": \"xy\", \"n\": 2}]}") == 1);
+    assert(strcmp(stream_buf, "1") == 0);
+    assert(stream_count("$..[?(@.v >= 1e1)]", "[{\"v\": 10.0}, [{\"v\": 9}, {\"w\": {\"v\": 11}}]]") == 2);
+
+    /* containers that end right after a scalar */
+    assert(stream_count("$.a", "{\"a\":[1,2,3]}") == 1);
+    assert(strcmp(stream_buf, "[1,2,3]") == 0);
+    assert(stream_count("$.a[-2:]", "{\"a\":[1,2,3]}") == 2);
+    assert(strcmp(stream_buf, "2|3") == 0);
+    assert(stream_count("$[-1]", "[[1,2],{\"x\":\"y\"}]") == 1);
+    assert(strcmp(stream_buf, "{\"x\":\"y\"}") == 0);
+    assert(stream_count("$[*]", "[[1,2],[true],{\"x\":3}]") == 3);
+    assert(strcmp(stream_buf, "[1,2]|[true]|{\"x\":3}") == 0);
+    assert(stream_count("$..[0]", "[[1,[2,3]],[4]]") == 4);
+
+    assert(stream_query("$..*", 0, NULL) > 20);
+    assert(stream_query("$..price", 0, (void*)1) == 1);  /* stopped */
+    assert(strcmp(stream_buf, "8.95") == 0);
+
+    q = json_query_compile("$.a", NULL);
+    config.alloc_func = NULL;
+    config.materialize = 0;
+    config.depth = 20;
+    config.ctx = NULL;
+    config.match = stream_match;
+    assert(json_query_stream(q, "{\"a\": [1, 2}", 13, config) == -1);
+    json_query_free(q);
+}
+
+static int same(json_value *a, json_value *b)
+{
+    json_value *patch = json_diff(a, b, NULL);
+    int res;
+
+    assert(patch);
+    res = json_array_size(patch) == 0;
+    json_free(patch);
+    return res;
+}
+
+static void test_patch()
+{
+    json_value *a, *b, *patch, *doc, *shared, *v;
+    int i;
+
+    a = parse("{\"name\": \"x\", \"tags\": [1, 2, 3, 4], \"gone\": true, \"sub\": {\"k\": null, \"a/b\": 1}}");
+    b = parse("{\"name\": \"y\", \"tags\": [1, 5], \"new\": [], \"sub\": {\"k\": null, \"a/b\": 2}}");
+    assert(a && b);
+
+    patch = json_diff(a, b, NULL);
+    assert(patch);
+    /* replace name, replace tags/1, 2 removes, remove gone, replace sub/a~1b, add new */
+    assert(json_array_size(patch) == 7);
+    assert(strcmp(json_dotget_string(patch, "[5].path"), "/sub/a~1b") == 0);
+    assert(json_dotget(patch, "[6].value") != json_dotget(b, "new"));  /* copied out of b */
+
+    doc = json_patch_apply(json_clone_shared(a), patch);
+    assert(doc && same(doc, b));
+    assert(!same(doc, a) && json_dotget_boolean(a, "gone") == 1);  /* a is untouched */
+    assert(json_dotget(doc, "new") != json_dotget(patch, "[6].value"));  /* copied out of the patch */
+    json_free(patch);
+    assert(json_array_append(json_dotget(doc, "new"), json_null_alloc(NULL)));
+    assert(json_type(json_dotget(doc, "new.[0]")) == json_type_null);
+    json_free(doc);
+
+    /* the other operations */
+    patch = parse("["
+        "{\"op\": \"add\", \"path\": \"/tags/1\", \"value\": 9},"
+        "{\"op\": \"add\", \"path\": \"/tags/-\", \"value\": 10},"
+        "{\"op\": \"move\", \"from\": \"/sub/k\", \"path\": \"/k\"},"
+        "{\"op\": \"copy\", \"from\": \"/tags\", \"path\": \"/sub/tags\"},"
+        "{\"op\": \"test\", \"path\": \"/sub/tags/1\", \"value\": 9}"
+        "]");
+    assert(patch);
+    doc = json_patch_apply(a, patch);
+    a = NULL;
+    assert(doc);
+    assert(json_array_size(json_dotget(doc, "tags")) == 6);
+    assert(json_dotget_number(doc, "tags.[1]") == 9 && json_dotget_number(doc, "tags.[5]") == 10);
+    assert(json_dotget(doc, "k") && !json_dotget(doc, "sub.k"));
+    assert(same(json_dotget(doc, "sub.tags"), json_dotget(doc, "tags")));
+    assert(json_dotget(doc, "sub.tags") != json_dotget(doc, "tags"));
+    json_free(patch);
+
+    /* a failing test leaves a shared document alone */
+    patch = parse("[{\"op\": \"remove\", \"path\": \"/name\"}, {\"op\": \"test\", \"path\": \"/k\", \"value\": 1}]");
+    assert(patch);
+    shared = json_clone_shared(doc);
+    assert(json_patch_apply(shared, patch) == NULL);
+    assert(json_dotget_string(doc, "name"));
+    json_free(patch);
+
+    patch = parse("[{\"op\": \"move\", \"from\": \"/sub\", \"path\": \"/sub/x\"}]");
+    assert(json_patch_apply(json_clone_shared(doc), patch) == NULL);
+    json_free(patch);
+
+    json_free(doc);
+    json_free(b);
+
+    /* deeper than the native stack would take */
+    a = json_array_alloc(NULL);
+    b = json_array_alloc(NULL);
+    a = json_array_append(a, json_number_alloc(1, NULL));
+    b = json_array_append(b, json_number_alloc(2, NULL));
+    for (i = 0; a && b && i < 200000; ++i) {
+        v = json_array_alloc(NULL);
+        a = v ? json_array_append(v, a) : NULL;
+        v = json_array_alloc(NULL);
+        b = v ? json_array_append(v, b) : NULL;
+    }
+    assert(a && b);
+    patch = json_diff(a, b, NULL);
+    assert(patch && json_array_size(patch) == 1);
+    assert(strlen(json_dotget_string(patch, "[0].path")) == 2 * 200001);
+    assert(json_dotget_number(patch, "[0].value") == 2);
+    json_free(patch);
+    json_free(a);
+    json_free(b);
+
+    /* RFC 7386 */
+    a = parse("{\"a\": \"b\", \"c\": {\"d\": \"e\", \"f\": \"g\"}, \"keep\": [1]}");
+    patch = parse("{\"a\": \"z\", \"c\": {\"f\": null}, \"n\": {\"x\": null, \"y\": 1}, \"list\": [null, 2]}");
+    b = parse("{\"a\": \"z\", \"c\": {\"d\": \"e\"}, \"keep\": [1], \"n\": {\"y\": 1}, \"list\": [null, 2]}");
+    assert(a && patch && b);
+    shared = json_clone_shared(a);
+    v = json_dotget(patch, "list");
+    doc = json_merge_patch(shared, patch);  /* a stays as it was */
+    assert(doc && same(doc, b));
+    assert(json_dotget(doc, "list") == v);  /* moved, not cloned */
+    assert(json_dotget_string(a, "c.f") && strcmp(json_dotget_string(a, "a"), "b") == 0);
+    json_free(doc);
+    json_free(b);
+
+    patch = parse("[1]");
+    doc = json_merge_patch(a, patch);
+    assert(doc == patch);
+    json_free(doc);
+
+    /* deeper than the native stack would take, into a matching target and into nothing */
+    a = parse("{\"x\": 1, \"y\": 2}");
+    patch = parse("{\"x\": null, \"z\": {\"n\": null}}");
+    for (i = 0; a && patch && i < 200000; ++i) {
+        v = json_object_alloc(NULL);
+        a = v ? json_object_set(v, "a", a) : NULL;
+        v = json_object_alloc(NULL);
+        patch = v ? json_object_set(v, "a", patch) : NULL;
+    }
+    assert(a && patch);
+    shared = json_clone(patch, NULL);
+    doc = json_merge_patch(a, patch);
+    for (v = doc, i = 0; v && i < 200000; ++i)
+        v = json_object_get(v, "a");
+    assert(v && json_object_size(v) == 2 && json_dotget_number(v, "y") == 2 && json_object_size(json_dotget(v, "z")) == 0);
+    json_free(doc);
+
+    doc = json_merge_patch(json_object_alloc(NULL), shared);
+    for (v = doc, i = 0; v && i < 200000; ++i)
+        v = json_object_get(v, "a");
+    assert(v && json_object_size(v) == 1 && json_object_size(json_dotget(v, "z")) == 0);
+    json_free(doc);
+}
+
+static void test_equal_frozen_hash()
+{
+    json_value *a, *b, *c;
+    uint64_t h;
+    int i;
+
+    a = parse("{\"id\": 1, \"tags\": [\"x\", \"y\"], \"meta\": {\"a\": null, \"b\": -0}}");
+    b = parse("{\"meta\": {\"b\": 0, \"a\": null}, \"tags\": [\"x\", \"y\"], \"id\": 1}");
+    c = parse("{\"id\": 1, \"tags\": [\"y\", \"x\"], \"meta\": {\"a\": null, \"b\": 0}}");
+    assert(a && b && c);
+
+    /* member order does not matter, element order does */
+    assert(json_equal(a, b) && json_hash(a) == json_hash(b));
+    assert(!json_equal(a, c) && json_hash(a) != json_hash(c));
+    assert(!json_equal(json_dotget(a, "tags"), json_dotget(a, "meta")));
+
+    /* mutable trees are hashed afresh on every call, only frozen ones cache it */
+    h = json_hash(c);
+    assert(json_number_set(json_dotget(c, "id"), 2) && json_hash(c) != h);
+    assert(json_number_set(json_dotget(c, "id"), 1) && json_hash(c) == h);
+    h = json_hash(a);
+    json_freeze(a);
+    json_freeze(c);
+    assert(json_hash(a) == h);
+    assert(json_equal(a, b) && !json_equal(a, c));
+
+    json_free(a);
+    json_free(b);
+    json_free(c);
+
+    /* deeper than the native stack would take */
+    a = json_array_alloc(NULL);
+    for (i = 0; a && i < 100000; ++i) {
+        b = json_array_alloc(NULL);
+        a = b ? json_array_append(b, a) : NULL;
+    }
+    assert(a);
+    b = json_clone(a, NULL);
+    assert(b && json_equal(a, b) && json_hash(a) == json_hash(b));
+    c = json_dotget(b, "[0].[0]");
+    c = json_array_append(c, json_null_alloc(NULL));
+    assert(c && !json_equal(a, b) && json_hash(a) != json_hash(b));
+    json_free(a);
+    json_free(b);
+}
+
+static void test_compact()
+{
+    json_value *v, *c, *shared, *inner;
+    int before;
+
+    v = parse("{\"name\": \"a name longer than sixteen bytes\", \"a member name longer than sixteen\": [1, 2.5, true, null],"
+              " \"empty\": {}, \"list\": [], \"nested\": {\"x\": \"y\"}}");
+    assert(v);
+
+    before = alloc_count;
+    c = json_compact(v, counting_alloc);
+    assert(c);
+    assert(alloc_count == before + 1);
+    assert(json_equal(v, c) && json_hash(v) == json_hash(c));
+    assert(json_is_frozen(c));
+    assert(strcmp(json_dotget_string(c, "nested.x"), "y") == 0);
+    assert(json_dotget_number(c, "a member name longer than sixteen.[1]") == 2.5);
+    inner = json_null_alloc(NULL);
+    assert(json_object_set(c, "z", inner) == NULL);
+    json_free(inner);
+
+    /* inner nodes do not outlive the block, sharing one copies it */
+    inner = json_dotget(c, "nested");
+    shared = json_clone_shared(inner);
+    assert(shared && shared != inner && json_equal(shared, inner));
+    assert(!json_is_frozen(shared));
+    json_free(shared);
+    assert(alloc_count == before + 1);
+
+    /* the root is shared as usual */
+    shared = json_clone_shared(c);
+    assert(shared == c);
+    json_free(c);
+    assert(alloc_count == before + 1);
+    json_free(shared);
+    assert(alloc_count == before);
+    json_free(v);
+
+    /* typed arrays stay typed in the block and in the source */
+    v = parse("{\"series\": [1, 2.5, -3], \"nested\": [[4, 5], []]}");
+    assert(v && json_array_is_typed(json_object_get(v, "series")));
+    c = json_compact(v, counting_alloc);
+    assert(c && json_equal(v, c) && json_hash(v) == json_hash(c));
+    assert(json_array_is_typed(json_object_get(v, "series")));
+    assert(json_array_is_typed(json_object_get(c, "series")));
+    assert(json_array_is_typed(json_dotget(c, "nested.[0]")));
+    assert(json_is_frozen(json_dotget(c, "series.[1]")) && json_dotget_number(c, "series.[1]") == 2.5);
+    assert(json_array_erase(json_object_get(c, "series"), 0) == NULL);
+    json_free(c);
+    c = json_compact(json_object_get(v, "series"), counting_alloc);
+    assert(c && json_array_is_typed(c) && json_equal(c, json_object_get(v, "series")));
+    json_free(c);
+    json_free(v);
+    assert(alloc_count == before);
+}
+
+static unsigned int snode_visit(const json_snode *n)
+{
+    unsigned int count = 1, i;
+
+    for (i = 0; i < json_snode_size(n); ++i) {
+        if (json_snode_type(n) == json_type_object) {
+            assert(json_snode_name_by_index(n, i));
+            json_snode_object_get(n, json_snode_name_by_index(n, i));
+        }
+        count += snode_visit(json_snode_value_by_index(n, i));
+    }
+    if (json_snode_type(n) == json_type_string)
+        count += (unsigned int)strlen(json_snode_string_get(n)) > json_snode_string_len(n);
+    return count;
+}
+
+static void test_snapshot()
+{
+    json_value *v;
+    json_snapshot *snapshot;
+    const json_snode *root, *n;
+    unsigned int i;
+    FILE *fp;
+    char data[4096];
+    size_t size;
+
+    v = parse(storeJSON);
+    assert(v);
+    assert(json_snapshot_write(v, "test.snapshot", NULL));
+    json_free(v);
+
+    snapshot = json_snapshot_open("test.snapshot", NULL);
+    assert(snapshot);
+    root = json_snapshot_root(snapshot);
+    assert(json_snode_type(root) == json_type_object);
+    assert(json_snode_size(root) == 1);
+    assert(strcmp(json_snode_name_by_index(root, 0), "store") == 0);
+
+    assert(json_snode_number_get(json_snode_dotget(root, "store.bicycle.price")) == 19.95);
+    assert(strcmp(json_snode_string_get(json_snode_dotget(root, "store.bicycle.color")), "red") == 0);
+    assert(json_snode_string_len(json_snode_dotget(root, "store.bicycle.color")) == 3);
+    assert(strcmp(json_snode_string_get(json_snode_dotget(root, "store.book.[2].isbn")), "0-553-21311-3") == 0);
+    assert(!json_snode_dotget(root, "store.book.[4]"));
+    assert(!json_snode_dotget(root, "store.nothing"));
+    assert(!json_snode_object_get(root, "Store"));
+
+    n = json_snode_dotget(root, "store.book");
+    assert(json_snode_type(n) == json_type_array && json_snode_size(n) == 4);
+    for (i = 0; i < json_snode_size(n); ++i)
+        assert(json_snode_object_get(json_snode_array_get(n, i), "price"));
+    assert(json_snode_string_get(n) == NULL && json_snode_boolean_get(n) == -1);
+    json_snapshot_close(snapshot);
+
+    /* a damaged node fails the open, it does not crash a reader later */
+    v = parse(storeJSON);
+    assert(v && json_snapshot_write(v, "test.snapshot", NULL));
+    json_free(v);
+    fp = fopen("test.snapshot", "rb");
+    assert(fp);
+    size = fread(data, 1, sizeof(data), fp);
+    fclose(fp);
+    assert(size > 0 && size < sizeof(data));
+    for (i = 0; i < 2 * (size - 40); ++i) {
+        /* the high bits, 0x40 makes counts just above 2^30 */
+        data[16 + i / 2] ^= i % 2 ? 0x40 : 0x80;
+        fp = fopen("test.snapshot", "wb");
+        assert(fp && fwrite(data, 1, size, fp) == size);
+        fclose(fp);
+        snapshot = json_snapshot_open("test.snapshot", NULL);
+        if (snapshot) {
+            snode_visit(json_snapshot_root(snapshot));
+            json_snapshot_close(snapshot);
+        }
+        data[16 + i / 2] ^= i % 2 ? 0x40 : 0x80;
+    }
+
+    /* truncated, the footer would be misaligned */
+    fp = fopen("test.snapshot", "wb");
+    assert(fp && fwrite(data, 1, size - 4, fp) == size - 4);
+    fclose(fp);
+    assert(!json_snapshot_open("test.snapshot", NULL));
+
+    /* not a snapshot */
+    fp = fopen("test.snapshot", "wb");
+    assert(fp);
+    fputs("{\"store\": {}} and some more text to pass the size check", fp);
+    fclose(fp);
+    assert(!json_snapshot_open("test.snapshot", NULL));
+    assert(!json_snapshot_open("test.nothing", NULL));
+    remove("test.snapshot");
+}
+
+static void test_binary()
+{
+    json_value *v, *v2;
+    int len;
+
+    v = parse("{\"ints\": [0, 1, 127, 128, 65536, -1, -33, -129, 4294967296, -4294967297],"
+              " \"floats\": [1.5, 0.1, -2.25, 1e300], \"str\": \"a string longer than thirty-one bytes\","
+              " \"bool\": [true, false, null], \"empty\": {}, \"nested\": [[], {\"x\": \"\"}]}");
+    assert(v);
+
+    buf_size = 0;
+    len = json_msgpack_write(v, my_write, NULL);
+    assert(len > 0 && len == (int)buf_size);
+    v2 = json_msgpack_read(buf, buf_size, 8, NULL);
+    assert(v2 && json_equal(v, v2));
+    json_free(v2);
+    assert(!json_msgpack_read(buf, buf_size - 1, 8, NULL));
+    assert(!json_msgpack_read(buf, buf_size, 2, NULL));
+
+    buf_size = 0;
+    len = json_cbor_write(v, my_write, NULL);
+    assert(len > 0 && len == (int)buf_size);
+    v2 = json_cbor_read(buf, buf_size, 8, NULL);
+    assert(v2 && json_equal(v, v2));
+    json_free(v2);
+    assert(!json_cbor_read(buf, buf_size - 1, 8, NULL));
+    json_free(v);
+
+    /* an empty member name fails the read */
+    assert(!json_msgpack_read("\x81\xa0\x01", 3, 8, NULL));
+    assert(!json_cbor_read("\xa1\x60\x01", 3, 8, NULL));
+
+    /* known encodings */
+    v = parse("{\"a\": [1, -1, 1.5]}");
+    assert(v);
+    buf_size = 0;
+    json_msgpack_write(v, my_write, NULL);
+    assert(buf_size == 11 && memcmp(buf, "\x81\xa1" "a" "\x93\x01\xff\xca\x3f\xc0\x00\x00", 11) == 0);
+    buf_size = 0;
+    json_cbor_write(v, my_write, NULL);
+    assert(buf_size == 11 && memcmp(buf, "\xa1\x61" "a" "\x83\x01\x20\xfa\x3f\xc0\x00\x00", 11) == 0);
+    json_free(v);
+
+    /* CBOR indefinite map and array, a half float and a tag */
+    v = json_cbor_read("\xbf\x61" "a" "\x9f\x01\xf9\x3e\x00\xc1\x01\xff\xff", 12, 8, NULL);
+    assert(v);
+    assert(json_dotget_number(v, "a.[1]") == 1.5 && json_dotget_number(v, "a.[2]") == 1);
+    json_free(v);
+    assert(!json_cbor_read("\x9f\x01", 2, 8, NULL));
+    assert(!json_msgpack_read("\x81\x01\x01", 3, 8, NULL));  /* not a string key */
+}
+
+static void test_pool()
+{
+    json_value *v, *v2, *array;
+    char name[32];
+    void *p;
+    int i;
+
+    v = parse(storeJSON);
+    assert(v);
+    v2 = json_clone(v, json_pool_alloc_func);
+    assert(v2 && json_equal(v, v2));
+
+    /* grows through several classes and then past them */
+    array = json_array_alloc(json_pool_alloc_func);
+    for (i = 0; i < 100; ++i) {
+        sprintf(name, "item %d of a long enough name", i);
+        json_object_set(v2, name, json_number_alloc(i, json_pool_alloc_func));
+        assert(json_array_append(array, json_string_alloc(name, (unsigned int)-1, json_pool_alloc_func)));
+    }
+    assert(json_object_size(v2) == 101);
+    assert(strcmp(json_string_get(json_array_get(array, 99)), "item 99 of a long enough name") == 0);
+    json_object_set(v2, "array", array);
+    assert(json_dotget_number(v2, "item 42 of a long enough name") == 42);
+
+    p = json_pool_alloc_func(NULL, 0, 10);
+    memcpy(p, "123456789", 10);
+    p = json_pool_alloc_func(p, 10, 1000);
+    assert(p && strcmp((char*)p, "123456789") == 0);
+    p = json_pool_alloc_func(p, 1000, 20);
+    assert(p && strcmp((char*)p, "123456789") == 0);
+    assert(json_pool_alloc_func(p, 20, 0) == NULL);
+
+    json_free(v2);
+    json_free(v);
+}
+
+static void test_typed()
+{
+    json_value *v, *v2, *nodes, *a, *first, *x;
+    json_write_config config;
+    json_iter it;
+    double numbers[4];
+    char text[256];
+    unsigned int i, len;
+
+    v = parse("{\"series\": [3, -1.5, 4, 1e3, 5, 9, 2], \"mixed\": [1, \"x\"], \"empty\": []}");
+    assert(v);
+    a = json_object_get(v, "series");
+    assert(a);
+    assert(json_array_is_typed(a) && !json_array_is_typed(json_object_get(v, "mixed")));
+    assert(json_number_get(json_array_get(a, 1)) == -1.5 && json_dotget_number(v, "series.[3]") == 1000);
+    assert(json_array_sum(a) == 1021.5);
+    assert(json_array_min(a) == -1.5 && json_array_max(a) == 1000);
+    assert(json_array_sum(json_object_get(v, "empty")) == 0);
+    assert(json_array_min(json_object_get(v, "mixed")) != json_array_min(json_object_get(v, "mixed")));
+    assert(json_array_get_doubles(a, 5, numbers, 4) == 2 && numbers[0] == 9 && numbers[1] == 2);
+
+    /* the same as the node form everywhere */
+    nodes = json_array_alloc(NULL);
+    for (i = 0; i < json_array_size(a); ++i)
+        json_array_append(nodes, json_number_alloc(json_number_get(json_array_get(a, i)), NULL));
+    assert(json_equal(a, nodes) && json_hash(a) == json_hash(nodes));
+    config.compact = 0;
+    config.indent = 2;
+    config.crlf = 0;
+    config.write = my_write;
+    config.ctx = NULL;
+    buf_size = 0;
+    json_write(nodes, config);
+    len = buf_size;
+    memcpy(text, buf, len);
+    buf_size = 0;
+    json_write(a, config);
+    assert(buf_size == len && memcmp(buf, text, len) == 0);
+    buf_size = 0;
+    json_msgpack_write(a, my_write, NULL);
+    v2 = json_msgpack_read(buf, buf_size, 4, NULL);
+    assert(v2 && json_array_is_typed(v2) && json_equal(v2, nodes));
+    json_free(v2);
+    v2 = json_clone(v, NULL);
+    assert(json_array_is_typed(json_object_get(v2, "series")) && json_equal(v, v2));
+
+    /* element nodes are made when asked for and stay put, erase works in place */
+    first = json_array_get(a, 0);
+    assert(json_array_get(a, 0) == first && json_array_is_typed(a));
+    json_iter_begin(&it, a);
+    for (i = 0; json_iter_next(&it); ++i)
+        assert(it.value == json_array_get(a, i));
+    assert(i == 7 && json_array_is_typed(a));
+    assert(json_number_set(json_array_get(a, 2), 4.5) && json_array_sum(a) == 1022);
+    assert(json_array_doubles(a)[2] == 4.5 && json_array_doubles(a)[3] == 1000);
+    assert(json_array_erase(a, 0) && json_array_is_typed(a) && json_array_size(a) == 6);
+    assert(json_number_get(json_array_get(a, 0)) == -1.5);
+    x = json_array_get(a, 1);
+    for (i = 0; i < 100; ++i)
+        assert(json_array_append(a, json_number_alloc(i, NULL)));
+    assert(json_array_is_typed(a) && json_array_get(a, 1) == x && json_number_get(x) == 4.5);
+    assert(json_array_sum(a) == 1019 + 4950);
+    while (json_array_size(a) > 6)
+        assert(json_array_erase(a, 6));
+    assert(json_array_set(a, 0, json_number_alloc(-2, NULL)) && json_array_is_typed(a));
+    assert(json_array_append(a, json_string_alloc("x", 1, NULL)) && !json_array_is_typed(a));
+    assert(json_array_get(a, 1) == x && json_array_erase(a, 6));
+    assert(json_array_pack(a) == a && json_array_is_typed(a) && json_dotget_number(a, "[5]") == 2);
+    assert(json_array_get(a, 1) == x && json_array_doubles(a)[0] == -2);
+    assert(!json_array_pack(json_object_get(v, "mixed")) && !json_array_doubles(json_object_get(v, "mixed")));
+    v = json_object_set(v, "copy", json_clone_shared(json_array_get(a, 0)));
+    assert(v && json_dotget_number(v, "copy") == -2);
+
+    /* frozen trees keep them */
+    json_freeze(v2);
+    assert(json_array_is_typed(json_object_get(v2, "series")));
+    assert(json_dotget_number(v2, "series.[3]") == 1000);
+    assert(json_is_frozen(json_dotget(v2, "series.[3]")));
+    assert(json_dotget(v2, "series.[3]") == json_dotget(v2, "series.[3]"));
+    assert(!json_number_set(json_dotget(v2, "series.[3]"), 1));
+    assert(json_array_doubles(json_object_get(v2, "series"))[3] == 1000);
+
+    json_free(v2);
+    json_free(nodes);
+    json_free(v);
+}
+
+static void test_columnarize()
+{
+    json_value *v;
+    json_column columns[4];
+    double price[5];
+    int64_t qty[5];
+    json_slice name[5];
+    unsigned char in_stock[5], valid[4][1];
+
+    v = parse("[{\"name\": \"a\", \"price\": 1.5, \"qty\": 3, \"meta\": {\"ok\": true}},"
+              " {\"name\": \"bb\", \"price\": 2, \"qty\": 2.5, \"meta\": {\"ok\": false}},"
+              " {\"qty\": 7, \"price\": \"n/a\", \"name\": \"ccc\"},"
+              " 42,"
+              " {\"name\": null, \"price\": -4, \"qty\": -1, \"meta\": {\"ok\": true}}]");
+    assert(v);
+
+    columns[0].path = "price";
+    columns[0].type = json_column_double;
+    columns[0].data = price;
+    columns[1].path = "qty";
+    columns[1].type = json_column_int64;
+    columns[1].data = qty;
+    columns[2].path = "name";
+    columns[2].type = json_column_string;
+    columns[2].data = name;
+    columns[3].path = "meta.ok";
+    columns[3].type = json_column_boolean;
+    columns[3].data = in_stock;
+    columns[0].valid = valid[0];
+    columns[1].valid = valid[1];
+    columns[2].valid = valid[2];
+    columns[3].valid = valid[3];
+
+    assert(json_columnarize(v, columns, 4) == 5);
+    assert(price[0] == 1.5 && price[1] == 2 && price[4] == -4 && price[2] != price[2]);
+    assert(valid[0][0] == 0x13);
+    assert(qty[0] == 3 && qty[2] == 7 && qty[4] == -1 && valid[1][0] == 0x15);
+    assert(name[1].len == 2 && memcmp(name[1].str, "bb", 2) == 0 && name[2].len == 3);
+    assert(name[4].str == NULL && valid[2][0] == 0x07);
+    assert(in_stock[0] == 1 && in_stock[1] == 0 && in_stock[4] == 1 && valid[3][0] == 0x13);
+
+    columns[0].path = "a..b";
+    assert(json_columnarize(v, columns, 1) == (unsigned int)-1);
+    assert(json_columnarize(json_array_get(v, 0), columns, 1) == (unsigned int)-1);
+    json_free(v);
+}
+
+static void test_take()
+{
+    json_value *doc, *payload, *envelope, *items, *shared, *v, *removed, *expected;
+
+    /* move payload.items under a new envelope without copying it */
+    doc = parse("{\"payload\": {\"id\": 7, \"items\": [1, \"a\", {\"b\": null}]}}");
+    assert(doc);
+    shared = json_clone_shared(doc);
+    doc = json_object_take(doc, "payload", &payload);
+    assert(doc && doc != shared && json_object_size(doc) == 0);
+    assert(json_object_get(shared, "payload") == payload);  /* the shared copy still has it */
+    json_free(shared);
+    items = json_object_get(payload, "items");
+    v = json_object_take(payload, "items", &removed);
+    assert(v == payload && removed == items);
+    assert(json_object_get(payload, "items") == NULL && json_object_size(payload) == 1);
+    envelope = json_object_set(json_object_alloc(NULL), "data", items);
+    assert(envelope);
+    assert(json_object_take(payload, "nothing", &removed) == NULL && removed == NULL);
+    json_free(payload);
+
+    v = json_array_take(items, 1, &removed);
+    assert(v == items && json_array_size(items) == 2);
+    assert(json_type(removed) == json_type_string);
+    json_free(removed);
+
+    /* typed arrays, and items with other owners */
+    v = parse("[1, 2, 3, 4]");
+    assert(v && json_array_is_typed(v));
+    items = parse("[true, false]");
+    assert(items);
+    shared = json_clone_shared(items);
+    v = json_array_splice(v, 1, 2, items, &removed);
+    assert(v && json_array_size(removed) == 2);
+    expected = parse("[1, true, false, 4]");
+    assert(json_equal(v, expected));
+    json_free(expected);
+    expected = parse("[2, 3]");
+    assert(json_equal(removed, expected));
+    json_free(expected);
+    json_free(removed);
+    assert(json_array_size(shared) == 2);
+    json_free(shared);
+
+    v = json_array_concat(v, parse("[5, 6]"));
+    assert(v && json_array_size(v) == 6);
+    v = json_array_splice(v, 0, 5, NULL, NULL);
+    assert(v && json_array_size(v) == 1 && json_number_get(json_array_get(v, 0)) == 6);
+    assert(json_array_splice(v, 1, 1, NULL, NULL) == NULL);
+    assert(json_array_splice(v, 0, 0, v, NULL) == NULL);
+    json_free(v);
+
+    json_free(envelope);
+    json_free(doc);
+}
+
+static int grow_count = 0;
+static unsigned int grow_by_one(unsigned int capacity)
+{
+    grow_count++;
+    return capacity + 1;
+}
+
+static void test_capacity()
+{
+    json_value *v, *object, *shared;
+    unsigned int i;
+    char name[8];
+
+    assert(json_set_growth_func(counting_alloc, grow_by_one));
+
+    /* presized containers never grow */
+    v = json_array_reserve(json_array_alloc(counting_alloc), 100);
+    object = json_object_reserve(json_object_alloc(counting_alloc), 100);
+    assert(v && object);
+    for (i = 0; i < 100; ++i) {
+        sprintf(name, "k%u", i);
+        v = json_array_append(v, json_number_alloc(i, counting_alloc));
+        object = json_object_set(object, name, json_null_alloc(counting_alloc));
+        assert(v && object);
+    }
+    assert(grow_count == 0);
+    v = json_array_append(v, json_null_alloc(counting_alloc));
+    assert(v && grow_count == 1);
+
+    /* shared containers are copied first, frozen ones refuse */
+    shared = json_clone_shared(object);
+    object = json_object_reserve(object, 200);
+    assert(object && object != shared && json_object_size(object) == 100);
+    json_free(shared);
+    object = json_object_set(object, "nested", v);
+    assert(object);
+    v = json_string_alloc("a string that outgrows its initial storage", (unsigned int)-1, counting_alloc);
+    v = json_string_set(v, "short", (unsigned int)-1);
+    object = json_object_set(object, "s", v);
+    assert(object);
+    json_shrink_to_fit(object);
+    assert(json_array_size(json_object_get(object, "nested")) == 101);
+    assert(strcmp(json_dotget_string(object, "s"), "short") == 0);
+    assert(json_object_get(object, "k99"));
+    assert(json_freeze(object) && json_object_reserve(object, 300) == NULL);
+    json_shrink_to_fit(object);
+    json_free(object);
+    assert(alloc_count == 0);
+
+    assert(json_set_growth_func(counting_alloc, NULL));
+    v = json_array_alloc(counting_alloc);
+    v = json_array_append(v, json_null_alloc(counting_alloc));
+    assert(v && grow_count == 1);
+    json_free(v);
+}
+
+static void test_lazy()
+{
+    json_value *doc, *eager, *v, *results[4];
+    json_iter it;
+    json_write_config config;
+    int before;
+    const char *dup = "{\"a\": 1, \"b\": [true, {\"c\": null}], \"a\": [1, 2.5, -2.5e1]}";
+
+    /* only the skeleton up front, the children follow on access */
+    doc = json_parse_lazy(storeJSON, strlen(storeJSON), 20, counting_alloc);
+    assert(doc && json_type(doc) == json_type_object);
+    before = alloc_count;
+    assert(before == 3);  /* text, skeleton, root */
+    v = json_dotget(doc, "store.bicycle.price");
+    assert(v && json_number_get(v) == 19.95);
+    assert(alloc_count > before);
+    assert(json_array_size(json_dotget(doc, "store.book")) == 4);
+    assert(query(doc, "$.store.book[?(@.isbn)].author", results, 4) == 2);
+    assert(strcmp(json_string_get(results[1]), "J. R. R. Tolkien") == 0);
+    eager = parse(storeJSON);
+    assert(json_equal(doc, eager) && json_equal(eager, doc));
+    json_free(eager);
+    json_free(doc);
+    assert(alloc_count == 0);
+
+    /* freed or walked before anything was built */
+    doc = json_parse_lazy(storeJSON, strlen(storeJSON), 20, counting_alloc);
+    json_free(doc);
+    assert(alloc_count == 0);
+    doc = json_parse_lazy(dup, strlen(dup), 20, NULL);
+    eager = parse(dup);
+    assert(doc && eager);
+    config.compact = 1;
+    config.indent = 0;
+    config.crlf = 0;
+    config.write = my_write;
+    config.ctx = NULL;
+    buf_size = 0;
+    assert(json_write(doc, config) > 0);
+    buf[buf_size] = '\0';
+    assert(strcmp(buf, "{\"a\":[1,2.5,-25],\"b\":[true,{\"c\":null}]}") == 0);
+    json_free(doc);
+
+    /* reading the whole of it leaves it lazy, what is built for the walk is released */
+    doc = json_parse_lazy(storeJSON, strlen(storeJSON), 20, counting_alloc);
+    before = alloc_count;
+    buf_size = 0;
+    assert(json_write(doc, config) > 0 && alloc_count == before);
+    v = json_clone(doc, NULL);
+    assert(v && alloc_count == before);
+    json_free(v);
+    v = json_compact(doc, NULL);
+    assert(v && alloc_count == before);
+    json_free(v);
+    buf_size = 0;
+    assert(json_msgpack_write(doc, my_write, NULL) > 0 && alloc_count == before);
+    v = parse(storeJSON);
+    assert(json_equal(doc, v) && json_equal(v, doc) && alloc_count == before);
+    assert(json_hash(doc) == json_hash(v) && alloc_count == before);
+    json_free(v);
+    assert(json_snapshot_write(doc, "test.snapshot", NULL) && alloc_count == before);
+    remove("test.snapshot");
+    alloc_limit = 0;
+    assert(json_write(doc, config) == 0 && alloc_count == before);
+    assert(!json_snapshot_write(doc, "test.snapshot", counting_alloc) && alloc_count == before);
+    alloc_limit = (size_t)-1;
+    json_free(doc);
+    assert(alloc_count == 0);
+
+    /* names repeat in the text, the last one wins as when parsed */
+    doc = json_parse_lazy(dup, strlen(dup), 20, NULL);
+    assert(json_iter_begin(&it, doc));
+    assert(json_object_size(doc) == 2 && json_equal(doc, eager));
+    assert(json_array_is_typed(json_object_get(doc, "a")));
+    doc = json_object_set(doc, "d", json_null_alloc(NULL));
+    assert(doc && json_object_size(doc) == 3);
+    json_free(doc);
+    json_free(eager);
+
+    /* building fails for want of memory, it is empty and tried again on the next access */
+    doc = json_parse_lazy(dup, strlen(dup), 20, counting_alloc);
+    assert(doc);
+    alloc_limit = 0;
+    assert(json_object_size(doc) == 0);
+    alloc_limit = (size_t)-1;
+    assert(json_object_size(doc) == 2);
+    json_free(doc);
+    assert(alloc_count == 0);
+
+    /* built in full when frozen, reading it afterwards allocates nothing */
+    doc = json_parse_lazy(storeJSON, strlen(storeJSON), 20, counting_alloc);
+    before = alloc_count;
+    alloc_limit = 0;
+    assert(json_freeze(doc) == NULL && !json_is_frozen(doc));
+    alloc_limit = (size_t)-1;
+    assert(json_freeze(doc) == doc && json_is_frozen(doc) && alloc_count > before);
+    before = alloc_count;
+    v = json_dotget(doc, "store.book");
+    assert(v && json_is_frozen(v) && json_array_size(v) == 4 && alloc_count == before);
+    assert(json_is_frozen(json_dotget(doc, "store.book.[0].author")));
+    assert(json_object_set(json_array_get(v, 0), "x", NULL) == NULL);
+    eager = parse(storeJSON);
+    assert(json_equal(doc, eager) && json_hash(doc) == json_hash(eager));
+    json_free(eager);
+    json_free(doc);
+    assert(alloc_count == 0);
+
+    assert(json_parse_lazy("[1, 2", 5, 20, NULL) == NULL);
+    assert(json_parse_lazy("{\"\": 1}", 7, 20, NULL) == NULL);
+    assert(json_parse_lazy("[[[1]]]", 7, 3, NULL) == NULL);
+    v = json_parse_lazy("[[], {}]", 8, 20, NULL);
+    assert(v && json_array_size(v) == 2 && json_object_size(json_array_get(v, 1)) == 0);
+    json_free(v);
+}
+
+typedef struct sink {
+    char *data;
+    size_t size, cap;
+} sink;
+
+static int sink_write(void *ctx, const char *data, int len)
+{
+    sink *s = (sink*)ctx;
+    if (s->size + len > s->cap)
+        return 0;
+    memcpy(s->data + s->size, data, len);
+    s->size += len;
+    return len;
+}
+
+static void test_write_target()
+{
+    json_value *v, *a;
+    json_write_config config = {0, 2, 0, sink_write, NULL};
+    sink s;
+    char *out, small[8];
+    size_t len, n;
+    unsigned int i;
+
+    v = parse("{\"s\": \"tab\\tquote\\\"\", \"t\": true, \"n\": null}");
+    assert(v);
+    a = json_array_alloc(NULL);
+    for (i = 0; a && i < 1000; ++i)
+        a = json_array_append(a, json_number_alloc(i + 0.25, NULL));
+    v = json_object_set(v, "a", a);
+    assert(a && v);
+
+    /* larger than the staging buffer */
+    n = json_write_measure(v, config);
+    assert(n > 4096);
+
+    s.data = (char*)malloc(n);
+    s.size = 0;
+    s.cap = n;
+    config.ctx = &s;
+    assert(json_write(v, config) == (int)n && s.size == n);
+    s.size = 0;
+    s.cap = n - 1;
+    assert(json_write(v, config) == 0);
+
+    out = (char*)malloc(n);
+    assert(json_write_to_buffer(v, config, out, n) == n);
+    assert(memcmp(out, s.data, n) == 0);
+    assert(json_write_to_buffer(v, config, small, sizeof(small)) == n);
+    assert(memcmp(small, s.data, sizeof(small)) == 0);
+    free(out);
+
+    alloc_count = 0;
+    out = json_write_alloc(v, config, &len, counting_alloc);
+    assert(out && len == n && out[n] == '\0' && alloc_count == 1);
+    assert(memcmp(out, s.data, n) == 0);
+    counting_alloc(out, len + 1, 0);
+    assert(alloc_count == 0);
+    alloc_limit = 1024;
+    assert(!json_write_alloc(v, config, &len, counting_alloc));
+    alloc_limit = (size_t)-1;
+    assert(alloc_count == 0);
+
+    config.compact = 1;
+    out = json_write_alloc(v, config, &len, json_pool_alloc_func);
+    assert(out && len == json_write_measure(v, config) && len == strlen(out));
+    assert(strcmp(out + len - 9, ",999.25]}") == 0);
+    json_pool_alloc_func(out, len + 1, 0);
+
+    free(s.data);
+    json_free(v);
 }